@@ -4,9 +4,11 @@ shadercRelease.exe -f vs_mesh.sc -o vs_mesh.bin --type vertex --platform windows
 shadercRelease.exe -f fs_mesh.sc -o fs_mesh.bin --type fragment --platform windows --profile 120 -i .
 shadercRelease.exe -f vs_line.sc -o vs_line.bin --type vertex   --platform windows --profile 120 -i .
 shadercRelease.exe -f fs_line.sc -o fs_line.bin --type fragment --platform windows --profile 120 -i .
+shadercRelease.exe -f fs_screen.sc -o fs_screen.bin --type fragment --platform windows --profile 120 -i .
 */
 
 #include "3d.h"
+#include "../src/compositor.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -32,6 +34,7 @@ static const char* VS_BIN_PATH = "C:/Users/spang/Desktop/Projects/paperGB/3d/vs_
 static const char* FS_BIN_PATH = "C:/Users/spang/Desktop/Projects/paperGB/3d/fs_mesh.bin";
 static const char* VS_LINE_BIN_PATH = "C:/Users/spang/Desktop/Projects/paperGB/3d/vs_line.bin";
 static const char* FS_LINE_BIN_PATH = "C:/Users/spang/Desktop/Projects/paperGB/3d/fs_line.bin";
+static const char* FS_SCREEN_BIN_PATH = "C:/Users/spang/Desktop/Projects/paperGB/3d/fs_screen.bin";
 
 // Names of meshes that respond to click-drag rotation
 static const std::unordered_set<std::string> DRAGGABLE_MESH_NAMES = {
@@ -726,6 +729,19 @@ int run3d(TextureBuffer* emuScreenTexBuffer, SharedBool* isPowerOn)
 
     bgfx::UniformHandle s_texColor = bgfx::createUniform("s_texColor", bgfx::UniformType::Sampler);
 
+    // Indexed emuScreen: same vertex shader, fragment shader colors the indices through a palette texture
+    const bool indexedScreen = emuScreenTexBuffer->format == PixelFormat::Indexed8;
+    bgfx::ProgramHandle screenProgram = BGFX_INVALID_HANDLE;
+    bgfx::UniformHandle s_texPalette = BGFX_INVALID_HANDLE;
+    std::vector<char> vsScreenBuffer, fsScreenBuffer;
+    if (indexedScreen)
+    {
+        bgfx::ShaderHandle vshScreen = loadShader(VS_BIN_PATH, vsScreenBuffer);
+        bgfx::ShaderHandle fshScreen = loadShader(FS_SCREEN_BIN_PATH, fsScreenBuffer);
+        screenProgram = bgfx::createProgram(vshScreen, fshScreen, true);
+        s_texPalette = bgfx::createUniform("s_texPalette", bgfx::UniformType::Sampler);
+    }
+
     // ------------------------------------------------------------
     // LINE SHADER + LAYOUT for ray visualisation
     // ------------------------------------------------------------
@@ -940,10 +956,27 @@ int run3d(TextureBuffer* emuScreenTexBuffer, SharedBool* isPowerOn)
         (uint16_t)emuScreenTexBuffer->width,
         (uint16_t)emuScreenTexBuffer->height,
         false, 1,
-        bgfx::TextureFormat::RGBA8,
+        indexedScreen ? bgfx::TextureFormat::R8 : bgfx::TextureFormat::RGBA8,
         BGFX_TEXTURE_NONE
     );
 
+    // 16x1 RGBA palette for indexed pixels, one entry per palette index. Every palette starts with the default
+    // green shades, changing colors only means updating these 64 bytes
+    bgfx::TextureHandle emuScreenPalette = BGFX_INVALID_HANDLE;
+    if (indexedScreen)
+    {
+        emuScreenPalette = bgfx::createTexture2D(16, 1, false, 1, bgfx::TextureFormat::RGBA8, BGFX_TEXTURE_NONE);
+        uint8_t palette[16 * 4];
+        for (int i = 0; i < 16; i++)
+        {
+            palette[i * 4 + 0] = SHADE_COLORS[i & 3][0];
+            palette[i * 4 + 1] = SHADE_COLORS[i & 3][1];
+            palette[i * 4 + 2] = SHADE_COLORS[i & 3][2];
+            palette[i * 4 + 3] = 255;
+        }
+        bgfx::updateTexture2D(emuScreenPalette, 0, 0, 0, 0, 16, 1, bgfx::copy(palette, sizeof(palette)));
+    }
+
     for (auto& meshInst : allMeshes)
     {
         if (meshInst.meshName == "emuScreen")
@@ -1548,23 +1581,20 @@ int run3d(TextureBuffer* emuScreenTexBuffer, SharedBool* isPowerOn)
         bgfx::setViewTransform(0, view, proj);
         bgfx::touch(0);
 
-        // Upload new emuScreen texture if the worker has produced one
+        // Upload the newest emuScreen frame if the worker has published one. The front buffer is ours until the
+        // next acquire, so the copy doesn't hold up the emulator
+        if (emuScreenTexBuffer->acquire())
         {
-            std::lock_guard<std::mutex> lock(emuScreenTexBuffer->mutex);
-            if (emuScreenTexBuffer->dirty)
-            {
-                const bgfx::Memory* mem = bgfx::copy(
-                    emuScreenTexBuffer->pixels.data(),
-                    (uint32_t)emuScreenTexBuffer->pixels.size()
-                );
-                bgfx::updateTexture2D(emuScreenTex, 0, 0,
-                    0, 0,
-                    (uint16_t)emuScreenTexBuffer->width,
-                    (uint16_t)emuScreenTexBuffer->height,
-                    mem
-                );
-                emuScreenTexBuffer->dirty = false;
-            }
+            const bgfx::Memory* mem = bgfx::copy(
+                emuScreenTexBuffer->front(),
+                (uint32_t)emuScreenTexBuffer->frame_size()
+            );
+            bgfx::updateTexture2D(emuScreenTex, 0, 0,
+                0, 0,
+                (uint16_t)emuScreenTexBuffer->width,
+                (uint16_t)emuScreenTexBuffer->height,
+                mem
+            );
         }
 
         // Render all meshes
@@ -1578,8 +1608,16 @@ int run3d(TextureBuffer* emuScreenTexBuffer, SharedBool* isPowerOn)
             bgfx::setVertexBuffer(0, meshInst.buffers.vbh);
             bgfx::setIndexBuffer(meshInst.buffers.ibh);
 
+            // Indices can't be filtered, so the indexed screen is point sampled and gets its colors from the palette
+            bool indexedMesh = indexedScreen && meshInst.meshName == "emuScreen";
+            if (indexedMesh)
+            {
+                const uint32_t pointFlags = BGFX_SAMPLER_POINT | BGFX_SAMPLER_UVW_CLAMP;
+                bgfx::setTexture(0, s_texColor, meshInst.buffers.texture, pointFlags);
+                bgfx::setTexture(1, s_texPalette, emuScreenPalette, pointFlags);
+            }
             // Bind texture if available
-            if (bgfx::isValid(meshInst.buffers.texture))
+            else if (bgfx::isValid(meshInst.buffers.texture))
                 bgfx::setTexture(0, s_texColor, meshInst.buffers.texture);
 
             //Skip culling on screen because it breaks it
@@ -1593,7 +1631,7 @@ int run3d(TextureBuffer* emuScreenTexBuffer, SharedBool* isPowerOn)
                 cullFlag
             );
 
-            bgfx::submit(0, program);
+            bgfx::submit(0, indexedMesh ? screenProgram : program);
         }
 
         // Render pick ray for visualisation
@@ -1638,8 +1676,18 @@ int run3d(TextureBuffer* emuScreenTexBuffer, SharedBool* isPowerOn)
     bgfx::destroy(s_texColor);
     bgfx::destroy(program);
     bgfx::destroy(lineProgram);
+    if (indexedScreen)
+    {
+        bgfx::destroy(emuScreenPalette);
+        bgfx::destroy(s_texPalette);
+        bgfx::destroy(screenProgram);
+    }
     bgfx::shutdown();
 
+    std::cout << "Screen frames: " << emuScreenTexBuffer->get_published() << " published, "
+        << emuScreenTexBuffer->get_dropped() << " dropped, "
+        << emuScreenTexBuffer->get_duplicated() << " duplicated\n";
+
     SDL_DestroyWindow(window);
     SDL_Quit();
 
@@ -0,0 +1,19 @@
+$input v_normal, v_texcoord0
+
+#include <bgfx_shader.sh>
+
+SAMPLER2D(s_texColor, 0);
+SAMPLER2D(s_texPalette, 1);
+
+void main()
+{
+    // Indexed8 screen texture: shade in bits 0-1, palette in bits 2-3. Look it up in the 16x1 palette texture
+    float index = floor(texture2D(s_texColor, v_texcoord0).r * 255.0 + 0.5);
+    vec4 color = texture2D(s_texPalette, vec2((index + 0.5) / 16.0, 0.5));
+
+    // Simple diffuse lighting using world normal
+    vec3 lightDir = normalize(vec3(1.0, 2.0, 1.0));
+    float diff = max(dot(normalize(v_normal), lightDir), 0.2);
+
+    gl_FragColor = vec4(color.rgb * diff, color.a);
+}
\ No newline at end of file
@@ -3,6 +3,10 @@
 #include <fstream>
 #include <vector>
 #include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
 
 #include "cpu.h"
 #include "gb.h"
@@ -13,6 +17,44 @@ using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
 namespace paperGBTests
 {
+	//blank.gb on a GB with a CPU the test drives itself. Everything is freed when it goes out of scope at the end of the test
+	struct TestGB {
+		TestGB(PixelFormat format = PixelFormat::RGBA8) :
+			cart(load_blank()), emuScreenTexBuffer(160, 144, format),
+			gameboy(new GB(*cart, &emuScreenTexBuffer)), cpu(gameboy.get()) {}
+
+		//Bus write the way LD (HL),A does it
+		void write(uint16_t addr, uint8_t byte) {
+			cpu.regs.HL.word = addr;
+			cpu.regs.AF.high = byte;
+			CPU::opcode_table[0x77](cpu);
+		}
+
+		void write(uint16_t addr, const std::vector<uint8_t>& bytes) {
+			for (uint8_t byte : bytes) {
+				write(addr++, byte);
+			}
+		}
+
+		//Bus read the way LD A,(HL) does it
+		uint8_t read(uint16_t addr) {
+			cpu.regs.HL.word = addr;
+			CPU::opcode_table[0x7E](cpu);
+			return cpu.regs.AF.high;
+		}
+
+		static Cartridge* load_blank() {
+			Cartridge* cart = new Cartridge();
+			cart->load_rom("..\\..\\paperGB_Tests\\blank.gb");
+			return cart;
+		}
+
+		std::unique_ptr<Cartridge> cart;
+		TextureBuffer emuScreenTexBuffer;
+		std::unique_ptr<GB> gameboy;
+		CPU cpu;
+	};
+
 	TEST_CLASS(timing_tests)
 	{
 	public:
@@ -34,11 +76,9 @@ namespace paperGBTests
 
 			file.close();
 
-			Cartridge* cart = new Cartridge();
-			cart->load_rom("..\\..\\paperGB_Tests\\blank.gb");
-			TextureBuffer emuScreenTexBuffer;
-			GB* gameboy = new GB(*cart, &emuScreenTexBuffer);
-			CPU cpu = CPU(gameboy);
+			TestGB test;
+			GB* gameboy = test.gameboy.get();
+			CPU& cpu = test.cpu;
 			int start = 0;
 			int end = 0;
 			std::stringstream opcode_stream;
@@ -75,7 +115,7 @@ namespace paperGBTests
 
 					start = gameboy->get_t_cycle_count();
 					gameboy->tick_other_components();
-					cpu.execute_opcode(i);
+					CPU::opcode_table[i](cpu);
 					end = gameboy->get_t_cycle_count();
 					
 					if (end - start == cycles[0]) {
@@ -94,7 +134,7 @@ namespace paperGBTests
 
 				start = gameboy->get_t_cycle_count();
 				gameboy->tick_other_components();
-				cpu.execute_opcode(i);
+				CPU::opcode_table[i](cpu);
 				end = gameboy->get_t_cycle_count();
 
 				Assert::AreEqual(cycles[0], end - start, message.str().c_str());
@@ -120,11 +160,9 @@ namespace paperGBTests
 
 			file.close();
 
-			Cartridge* cart = new Cartridge();
-			cart->load_rom("..\\..\\paperGB_Tests\\blank.gb");
-			TextureBuffer emuScreenTexBuffer;
-			GB* gameboy = new GB(*cart, &emuScreenTexBuffer);
-			CPU cpu = CPU(gameboy);
+			TestGB test;
+			GB* gameboy = test.gameboy.get();
+			CPU& cpu = test.cpu;
 			int start = 0;
 			int end = 0;
 			std::stringstream opcode_stream;
@@ -156,7 +194,7 @@ namespace paperGBTests
 				//One extra cycle for reading 0xCB prefix
 				gameboy->tick_other_components();
 				gameboy->tick_other_components();
-				cpu.execute_CB_opcode(i);
+				CPU::opcode_table[0x100 + i](cpu);
 				end = gameboy->get_t_cycle_count();
 
 				Assert::AreEqual(cycles[0], end - start, message.str().c_str());
@@ -165,4 +203,567 @@ namespace paperGBTests
 			SDL_Quit();
 		}
 	};
-}
+
+	TEST_CLASS(halt_tests)
+	{
+	public:
+
+		//IF bits 5-7 always read 1, so enabling them in IE must not count as a pending interrupt.
+		//A HALT with IME off has to stay halted instead of waking or hitting the halt bug and running INC A twice
+		TEST_METHOD(unused_interrupt_bits)
+		{
+			//IE and IF belong to the GB's own CPU, so that one runs the program
+			TestGB test;
+			CPU& cpu = test.gameboy->get_cpu();
+
+			const std::vector<uint8_t> program = {
+				0xF3,				//DI
+				0x76,				//HALT
+				0x3C,				//INC A
+				0x18, 0xFE			//JR -2
+			};
+			test.write(0xC000, program);
+			test.write(0xFFFF, 0xE0);
+			test.write(0xFF0F, 0x00);
+			Assert::AreEqual(0xE0, (int)test.read(0xFF0F));
+			cpu.regs.AF.high = 0;
+			cpu.regs.PC = 0xC000;
+
+			for (int i = 0; i < 100; i++) {
+				cpu.tick();
+			}
+
+			Assert::AreEqual(0xC002, (int)cpu.regs.PC);
+			Assert::AreEqual(0, (int)cpu.regs.AF.high);
+
+			SDL_Quit();
+		}
+	};
+
+	TEST_CLASS(flag_tests)
+	{
+	public:
+
+		//The rotates, shifts, SWAP and BIT record their flags lazily. F read back after running each of them twice,
+		// the second time with the carry still pending from the first, has to match the flags worked out the eager way
+		TEST_METHOD(lazy_flags)
+		{
+			TestGB test;
+			CPU& cpu = test.cpu;
+
+			//Every op on register A: RLCA RRCA RLA RRA, then CB RLC RRC RL RR SLA SRA SWAP SRL and BIT 0-7
+			std::vector<int> opcodes = { 0x07, 0x0F, 0x17, 0x1F };
+			for (int i = 0x07; i <= 0x7F; i += 8) {
+				opcodes.push_back(0x100 | i);
+			}
+
+			//Result in A and F the way the Pan Docs describe each op
+			auto eager = [](int opcode, uint8_t a, uint8_t f, uint8_t& result) -> uint8_t {
+				bool carry = f & CPU::C;
+				int op = (opcode >> 3) & 7;
+				bool carry_out = false;
+				if (opcode >= 0x140) {
+					result = a;
+					return ((a >> op) & 1 ? 0 : CPU::Z) | CPU::H | (f & CPU::C);
+				}
+				switch (op) {
+				case 0: result = (a << 1) | (a >> 7); carry_out = a & 0x80; break;
+				case 1: result = (a >> 1) | (a << 7); carry_out = a & 1; break;
+				case 2: result = (a << 1) | carry; carry_out = a & 0x80; break;
+				case 3: result = (a >> 1) | (carry << 7); carry_out = a & 1; break;
+				case 4: result = a << 1; carry_out = a & 0x80; break;
+				case 5: result = (a >> 1) | (a & 0x80); carry_out = a & 1; break;
+				case 6: result = (a << 4) | (a >> 4); break;
+				case 7: result = a >> 1; carry_out = a & 1; break;
+				}
+				//The unprefixed A rotates always clear Z
+				bool zero = opcode >= 0x100 && result == 0;
+				return (zero ? CPU::Z : 0) | (carry_out ? CPU::C : 0);
+			};
+
+			std::wstringstream message;
+			for (int opcode : opcodes) {
+				for (int value = 0; value <= 0xFF; value++) {
+					for (int f = 0; f <= 0xF0; f += 0x10) {
+						cpu.set_flag(CPU::Z, f & CPU::Z);
+						cpu.set_flag(CPU::N, f & CPU::N);
+						cpu.set_flag(CPU::H, f & CPU::H);
+						cpu.set_flag(CPU::C, f & CPU::C);
+						cpu.regs.AF.high = value;
+						uint8_t expected_a = value;
+						uint8_t expected_f = f;
+
+						for (int run = 0; run < 2; run++) {
+							expected_f = eager(opcode, expected_a, expected_f, expected_a);
+							CPU::opcode_table[opcode](cpu);
+						}
+
+						message.clear();
+						message.str(L"");
+						message << L"Opcode: " << std::hex << opcode << L" A: " << value << L" F: " << f;
+						uint8_t lazy_f = (cpu.get_flag(CPU::Z) ? CPU::Z : 0) | (cpu.get_flag(CPU::N) ? CPU::N : 0) |
+							(cpu.get_flag(CPU::H) ? CPU::H : 0) | (cpu.get_flag(CPU::C) ? CPU::C : 0);
+						Assert::AreEqual((int)expected_a, (int)cpu.regs.AF.high, message.str().c_str());
+						Assert::AreEqual((int)expected_f, (int)lazy_f, message.str().c_str());
+					}
+				}
+			}
+
+			SDL_Quit();
+		}
+	};
+
+	TEST_CLASS(benchmarks)
+	{
+	public:
+
+		//Instructions per second of CPU::opcode_table.
+		//Before the execute_opcode/execute_CB_opcode switches were removed this workload ran at 113 MIPS through the
+		// switches and 117 MIPS through the table, medians of 15 runs of one GCC -O2 x86-64 build
+		TEST_METHOD(opcode_dispatch)
+		{
+			TestGB test;
+			GB* gameboy = test.gameboy.get();
+			CPU& cpu = test.cpu;
+
+			//Fixed workload of every load, ALU and CB opcode that doesn't write memory or change control flow,
+			// 0x000-0x0FF unprefixed and 0x100-0x1FF CB like opcode_table
+			std::vector<int> workload;
+			for (int i = 0x00; i <= 0xBF; i++) {
+				bool writes_memory = (i >= 0x70 && i <= 0x77) || i == 0x02 || i == 0x12 || i == 0x22 || i == 0x32 || i == 0x08 || i == 0x34 || i == 0x35 || i == 0x36;
+				bool control_flow = i == 0x10 || i == 0x18 || i == 0x20 || i == 0x28 || i == 0x30 || i == 0x38 || i == 0x76;
+				if (!writes_memory && !control_flow) {
+					workload.push_back(i);
+				}
+			}
+			for (int i = 0x00; i <= 0xFF; i++) {
+				//Everything but BIT writes back to (HL)
+				if ((i & 0x7) != 6 || (i >= 0x40 && i <= 0x7F)) {
+					workload.push_back(0x100 | i);
+				}
+			}
+
+			const int ITERATIONS = 20000;
+			const double instructions = (double)ITERATIONS * workload.size();
+
+			auto start = std::chrono::steady_clock::now();
+			for (int n = 0; n < ITERATIONS; n++) {
+				for (int opcode : workload) {
+					gameboy->tick_other_components();
+					if (opcode >= 0x100) {
+						gameboy->tick_other_components();
+					}
+					CPU::opcode_table[opcode](cpu);
+				}
+			}
+			std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+			std::wstringstream message;
+			message << L"opcode_table: " << (instructions / seconds.count()) / 1e6 << L" MIPS";
+			Logger::WriteMessage(message.str().c_str());
+
+			SDL_Quit();
+		}
+
+		//Output frames per second of each Resampler mode, converting APU output to 48 kHz in frame sized chunks
+		TEST_METHOD(resampler_modes)
+		{
+			const int OUT_RATE = 48000;
+			const size_t CHUNK = APU_SAMPLE_RATE / 60;
+			const int CHUNKS = 3000;
+
+			//Square wave like the APU's, with a different frequency on each side
+			std::vector<int16_t> input(CHUNK * 2);
+			for (size_t i = 0; i < CHUNK; i++) {
+				input[i * 2] = (i / 64) & 1 ? 8000 : -8000;
+				input[i * 2 + 1] = (i / 100) & 1 ? 8000 : -8000;
+			}
+
+			const Resampler::Mode modes[3] = { Resampler::Mode::Sinc, Resampler::Mode::Cubic, Resampler::Mode::Linear };
+			const wchar_t* names[3] = { L"sinc", L"cubic", L"linear" };
+			std::wstringstream message;
+			for (int m = 0; m < 3; m++) {
+				Resampler resampler;
+				resampler.set_mode(modes[m]);
+				resampler.set_rates(APU_SAMPLE_RATE, OUT_RATE);
+				//Audio sync keeps the ratio slightly off the base ratio
+				resampler.set_rate_adjust(1.002);
+
+				std::vector<int16_t> output;
+				size_t frames = 0;
+				auto start = std::chrono::steady_clock::now();
+				for (int n = 0; n < CHUNKS; n++) {
+					resampler.process(input.data(), CHUNK, output);
+					frames += output.size() / 2;
+				}
+				std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+				message << names[m] << L": " << (frames / seconds.count()) / 1e6 << L" M frames/s  ";
+
+				//Every mode has to produce the adjusted number of frames, give or take the filter's delay
+				double expected = (double)CHUNK * CHUNKS * OUT_RATE * 1.002 / APU_SAMPLE_RATE;
+				Assert::IsTrue(std::abs(frames - expected) < 64, L"Wrong number of output frames");
+			}
+			Logger::WriteMessage(message.str().c_str());
+		}
+
+		//Time PPU::draw_line on a busy scene: random tiles, the window over part of the screen and 40 objects.
+		//Frames are run once with the background, window and objects on and once with them off,
+		// the difference is the time spent drawing lines
+		TEST_METHOD(draw_line)
+		{
+			TestGB test;
+			GB* gameboy = test.gameboy.get();
+
+			//VRAM and OAM can be written at any time with the LCD off
+			test.write(0xFF40, 0x00);
+			uint32_t seed = 12345;
+			auto random = [&]() -> uint8_t {
+				seed = seed * 1103515245 + 12345;
+				return (uint8_t)(seed >> 16);
+			};
+			for (int addr = 0x8000; addr < 0xA000; addr++) {
+				test.write(addr, random());
+			}
+			for (int i = 0; i < 40; i++) {
+				test.write(0xFE00 + i * 4, 16 + (i * 7) % 144);
+				test.write(0xFE01 + i * 4, 8 + (i * 13) % 160);
+				test.write(0xFE02 + i * 4, random());
+				test.write(0xFE03 + i * 4, random() & 0xF0);
+			}
+			test.write(0xFF47, 0xE4);
+			test.write(0xFF48, 0xD2);
+			test.write(0xFF49, 0x1B);
+			test.write(0xFF4A, 60);
+			test.write(0xFF4B, 80);
+
+			const int FRAMES = 1000;
+			auto run_frames = [&](uint8_t lcd_control) {
+				test.write(0xFF40, lcd_control);
+				auto start = std::chrono::steady_clock::now();
+				for (int frame = 0; frame < FRAMES; frame++) {
+					for (int i = 0; i < 70224 / 4; i++) {
+						gameboy->tick_other_components();
+					}
+				}
+				std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+				return seconds.count();
+			};
+
+			//LCD on with 8x16 objects, the window and both tile data areas in use
+			double drawing_seconds = run_frames(0xF7);
+			double idle_seconds = run_frames(0x80);
+
+			std::wstringstream message;
+			message << L"draw_line: " << (drawing_seconds - idle_seconds) / (FRAMES * 144) * 1e6 << L" us per line, "
+				<< drawing_seconds / FRAMES * 1e6 << L" us per frame";
+			Logger::WriteMessage(message.str().c_str());
+
+			SDL_Quit();
+		}
+	};
+
+	TEST_CLASS(jit_tests)
+	{
+	public:
+
+		//Run the same WRAM program on the block cache interpreter and the JIT and compare them after every tick.
+		//The loop in C1xx gets hot and compiled, the subroutine in C0xx rewrites its own immediate so it stays interpreted
+		TEST_METHOD(lockstep)
+		{
+			TestGB interpreter;
+			TestGB jit;
+			GB* interpreter_gameboy = interpreter.gameboy.get();
+			GB* jit_gameboy = jit.gameboy.get();
+			CPU& interpreter_cpu = interpreter.cpu;
+			CPU& jit_cpu = jit.cpu;
+
+			if (!jit_gameboy->set_jit_enabled(true)) {
+				Logger::WriteMessage(L"JIT not supported on this host, skipping");
+				SDL_Quit();
+				return;
+			}
+			jit_cpu.use_jit = true;
+
+			const std::vector<uint8_t> subroutine = {
+				0x3E, 0x00,			//LD A,0x00
+				0x3C,				//INC A
+				0xEA, 0x01, 0xC0,	//LD (0xC001),A
+				0xC9				//RET
+			};
+			const std::vector<uint8_t> loop = {
+				0x16, 0x40,			//LD D,0x40
+				0x26, 0xC8,			//LD H,0xC8
+				0x68,				//LD L,B
+				0x78,				//LD A,B
+				0xC6, 0x37,			//ADD A,0x37
+				0x81,				//ADD A,C
+				0x89,				//ADC A,C
+				0xDE, 0x11,			//SBC A,0x11
+				0x90,				//SUB B
+				0xA9,				//XOR C
+				0xB0,				//OR B
+				0xE6, 0x5A,			//AND 0x5A
+				0xB8,				//CP B
+				0x22,				//LD (HL+),A
+				0x04,				//INC B
+				0x0D,				//DEC C
+				0x03,				//INC BC
+				0xCB, 0x7F,			//BIT 7,A
+				0xCB, 0xC9,			//SET 1,C
+				0xCB, 0x1F,			//RR A
+				0x17,				//RLA
+				0x2B,				//DEC HL
+				0x7E,				//LD A,(HL)
+				0x34,				//INC (HL)
+				0x1A,				//LD A,(DE)
+				0xCD, 0x00, 0xC0,	//CALL 0xC000
+				0x15,				//DEC D
+				0xC2, 0x02, 0xC1,	//JP NZ,0xC102
+				0x18, 0xFE			//JR -2
+			};
+
+			//Write the program over the bus so both GBs go through the same steps
+			for (TestGB* test : { &interpreter, &jit }) {
+				test->write(0xC000, subroutine);
+				test->write(0xC100, loop);
+				test->cpu.regs.PC = 0xC100;
+			}
+
+			std::wstringstream message;
+			for (int i = 0; i < 20000; i++) {
+				interpreter_cpu.tick();
+				jit_cpu.tick();
+
+				message.clear();
+				message.str(L"");
+				message << L"Tick " << i << L" PC: " << std::hex << interpreter_cpu.regs.PC;
+				Assert::IsTrue(memcmp(&interpreter_cpu.regs, &jit_cpu.regs, sizeof(Registers)) == 0, message.str().c_str());
+				Assert::IsTrue(interpreter_gameboy->get_t_cycle_count() == jit_gameboy->get_t_cycle_count(), message.str().c_str());
+			}
+
+			//The loop has to have finished in both, with the JIT side having run compiled code
+			Assert::AreEqual(0xC128, (int)jit_cpu.regs.PC);
+			Assert::IsTrue(jit_gameboy->get_jit_blocks_compiled() > 0);
+			Assert::IsTrue(jit_gameboy->get_jit_native_runs() > 0);
+
+			//Compare the memory the program wrote
+			for (int addr = 0xC000; addr <= 0xC8FF; addr++) {
+				Assert::AreEqual((int)interpreter.read(addr), (int)jit.read(addr));
+			}
+
+			SDL_Quit();
+		}
+	};
+
+	TEST_CLASS(idle_skip_tests)
+	{
+	public:
+
+		//A loop polling LY has to leave at the same T-cycle with the same registers whether it is fast forwarded or not.
+		//The PPU starts in VBlank so LY counts through the VBlank lines before the first frame is done
+		TEST_METHOD(ly_poll_loop)
+		{
+			TestGB running;
+			TestGB skipping;
+			GB* running_gameboy = running.gameboy.get();
+			GB* skipping_gameboy = skipping.gameboy.get();
+			CPU& running_cpu = running.cpu;
+			CPU& skipping_cpu = skipping.cpu;
+			running_gameboy->set_idle_skip_enabled(false);
+
+			const std::vector<uint8_t> loop = {
+				0xF0, 0x44,			//LDH A,(0x44)
+				0xFE, 0x05,			//CP 0x05
+				0x20, 0xFA,			//JR NZ,-6
+				0x18, 0xFE			//JR -2
+			};
+
+			int ticks[2] = { 0, 0 };
+			TestGB* tests[2] = { &running, &skipping };
+			for (int i = 0; i < 2; i++) {
+				CPU& cpu = tests[i]->cpu;
+				tests[i]->write(0xC000, loop);
+				cpu.regs.PC = 0xC000;
+
+				while (cpu.regs.PC != 0xC006 && ticks[i] < 1000000) {
+					cpu.tick();
+					ticks[i]++;
+				}
+			}
+
+			Assert::AreEqual(0xC006, (int)skipping_cpu.regs.PC);
+			Assert::IsTrue(memcmp(&running_cpu.regs, &skipping_cpu.regs, sizeof(Registers)) == 0);
+			Assert::IsTrue(running_gameboy->get_t_cycle_count() == skipping_gameboy->get_t_cycle_count());
+			Assert::IsTrue(ticks[1] < ticks[0]);
+
+			SDL_Quit();
+		}
+	};
+
+	TEST_CLASS(apu_tests)
+	{
+	public:
+
+		//A channel triggered with length enabled and 1 step of length left shows in NR52 until the next frame
+		// sequencer length clock, which is at most 16384 T-cycles away
+		TEST_METHOD(length_counter)
+		{
+			TestGB test;
+			GB* gameboy = test.gameboy.get();
+
+			test.write(0xFF26, 0x80);
+			test.write(0xFF16, 0x3F);
+			test.write(0xFF17, 0xF0);
+			test.write(0xFF19, 0xC0);
+			Assert::AreEqual(0x02, test.read(0xFF26) & 0x02);
+
+			uint64_t start = gameboy->get_t_cycle_count();
+			while ((test.read(0xFF26) & 0x02) && gameboy->get_t_cycle_count() - start < 20000) {
+				gameboy->tick_other_components();
+			}
+			Assert::AreEqual(0x00, test.read(0xFF26) & 0x02);
+			Assert::IsTrue(gameboy->get_t_cycle_count() - start <= 16384);
+
+			SDL_Quit();
+		}
+	};
+
+	TEST_CLASS(ppu_tests)
+	{
+	public:
+
+		//Every compositor level the host supports has to expand a line to the same pixels as the scalar one
+		TEST_METHOD(compositor_levels)
+		{
+			uint8_t indices[160];
+			uint32_t seed = 1;
+			for (int x = 0; x < 160; x++) {
+				seed = seed * 1103515245 + 12345;
+				indices[x] = (seed >> 16) & 0x0F;
+			}
+
+			Compositor compositor;
+			std::vector<uint8_t> expected(160 * 4);
+			Assert::IsTrue(compositor.set_level(Compositor::Level::Scalar));
+			compositor.expand_line(indices, 0xE4, 0xD2, 0x1B, expected.data());
+			std::vector<uint8_t> expected_indexed(160);
+			compositor.index_line(indices, 0xE4, 0xD2, 0x1B, expected_indexed.data());
+
+			//Indexed pixels keep their palette and color the same as RGBA ones through the shade
+			for (int x = 0; x < 160; x++) {
+				Assert::AreEqual(indices[x] & 0x0C, expected_indexed[x] & 0x0C);
+				Assert::AreEqual(SHADE_COLORS[expected_indexed[x] & 3][0], expected[x * 4]);
+				Assert::AreEqual(SHADE_COLORS[expected_indexed[x] & 3][1], expected[x * 4 + 1]);
+				Assert::AreEqual(SHADE_COLORS[expected_indexed[x] & 3][2], expected[x * 4 + 2]);
+			}
+
+			const Compositor::Level levels[2] = { Compositor::Level::SSSE3, Compositor::Level::AVX2 };
+			for (Compositor::Level level : levels) {
+				if (!compositor.set_level(level)) {
+					Logger::WriteMessage(L"Compositor level not supported on this host, skipping");
+					continue;
+				}
+				std::vector<uint8_t> pixels(160 * 4);
+				compositor.expand_line(indices, 0xE4, 0xD2, 0x1B, pixels.data());
+				Assert::IsTrue(pixels == expected, L"Pixels differ from the scalar compositor");
+				std::vector<uint8_t> indexed(160);
+				compositor.index_line(indices, 0xE4, 0xD2, 0x1B, indexed.data());
+				Assert::IsTrue(indexed == expected_indexed, L"Indexed pixels differ from the scalar compositor");
+			}
+		}
+
+		//Only the first 10 objects in OAM on a line are drawn, and where they overlap the one with the lower X is on top,
+		// or the one earlier in OAM if their X is the same
+		TEST_METHOD(object_priority)
+		{
+			TestGB test(PixelFormat::Indexed8);
+			GB* gameboy = test.gameboy.get();
+			TextureBuffer& emuScreenTexBuffer = test.emuScreenTexBuffer;
+
+			auto write_object = [&](int object_id, uint8_t x, uint8_t flags) {
+				test.write(0xFE00 + object_id * 4, 16);
+				test.write(0xFE01 + object_id * 4, x);
+				test.write(0xFE02 + object_id * 4, 1);
+				test.write(0xFE03 + object_id * 4, flags);
+			};
+
+			test.write(0xFF40, 0x00);
+			//Tile 1 is solid color 3, the background is tile 0 which is all color 0
+			for (int addr = 0x8010; addr < 0x8020; addr++) {
+				test.write(addr, 0xFF);
+			}
+			//12 objects on line 0. Object 1 is later in OAM than object 0 but has the lower X,
+			// objects 2 and 3 share an X and object 2 is earlier in OAM
+			write_object(0, 16, 0x00);
+			write_object(1, 12, 0x10);
+			write_object(2, 40, 0x00);
+			write_object(3, 40, 0x10);
+			for (int object_id = 4; object_id < 12; object_id++) {
+				write_object(object_id, 56 + (object_id - 4) * 8, 0x00);
+			}
+			test.write(0xFF47, 0xE4);
+			test.write(0xFF48, 0xE4);
+			test.write(0xFF49, 0xE4);
+
+			//LCD, background and 8x8 objects on
+			test.write(0xFF40, 0x93);
+			for (int i = 0; i < 3 * 70224 / 4; i++) {
+				gameboy->tick_other_components();
+			}
+			Assert::IsTrue(emuScreenTexBuffer.acquire());
+			const uint8_t* line = emuScreenTexBuffer.front();
+
+			//Indexed pixels are the shade and the palette bits
+			const uint8_t OBP0_PIXEL = 3 | LINE_OBP0;
+			const uint8_t OBP1_PIXEL = 3 | LINE_OBP1;
+			Assert::AreEqual(OBP1_PIXEL, line[4]);
+			Assert::AreEqual(OBP1_PIXEL, line[11]);
+			Assert::AreEqual(OBP0_PIXEL, line[12]);
+			Assert::AreEqual(OBP0_PIXEL, line[32]);
+			Assert::AreEqual(OBP0_PIXEL, line[39]);
+			//Objects 4-9 are drawn, 10 and 11 are past the limit
+			Assert::AreEqual(OBP0_PIXEL, line[48]);
+			Assert::AreEqual(OBP0_PIXEL, line[95]);
+			Assert::AreEqual((uint8_t)0, line[96]);
+			Assert::AreEqual((uint8_t)0, line[111]);
+			//Line 8 has no objects
+			Assert::AreEqual((uint8_t)0, line[8 * 160 + 12]);
+
+			SDL_Quit();
+		}
+	};
+
+	TEST_CLASS(texture_buffer_tests)
+	{
+	public:
+
+		//The renderer gets the newest published frame, frames it never took count as dropped and
+		// acquiring with nothing new counts as duplicated
+		TEST_METHOD(triple_buffer_handoff)
+		{
+			TextureBuffer buffer(160, 144, PixelFormat::Indexed8);
+			Assert::AreEqual((size_t)(160 * 144), buffer.frame_size());
+			Assert::IsFalse(buffer.acquire());
+
+			for (uint8_t frame = 1; frame <= 3; frame++) {
+				memset(buffer.back(), frame, buffer.frame_size());
+				buffer.publish();
+			}
+			Assert::IsTrue(buffer.acquire());
+			Assert::AreEqual((uint8_t)3, buffer.front()[0]);
+			Assert::AreEqual((uint8_t)3, buffer.front()[buffer.frame_size() - 1]);
+
+			//The frame being drawn never shares a buffer with the one being shown
+			memset(buffer.back(), 4, buffer.frame_size());
+			Assert::AreEqual((uint8_t)3, buffer.front()[0]);
+			Assert::IsFalse(buffer.acquire());
+			buffer.publish();
+			Assert::IsTrue(buffer.acquire());
+			Assert::AreEqual((uint8_t)4, buffer.front()[0]);
+
+			Assert::AreEqual((uint64_t)4, buffer.get_published());
+			Assert::AreEqual((uint64_t)2, buffer.get_dropped());
+			Assert::AreEqual((uint64_t)2, buffer.get_duplicated());
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+// Interleaved stereo int16 frames passed from the emulator thread to the SDL audio callback.
+// Wait-free for one producer and one consumer: each side only stores its own index and loads the other's,
+// so the audio callback never takes a lock or waits on the emulator or the renderer.
+class AudioRingBuffer {
+public:
+	AudioRingBuffer() : mask(0), read_index(0), write_index(0) {}
+
+	// Allocate room for at least frames frames and empty the buffer. Not safe while the other side is running
+	void resize(size_t frames) {
+		size_t capacity = 1;
+		while (capacity < frames) {
+			capacity <<= 1;
+		}
+		buffer.assign(capacity * 2, 0);
+		mask = capacity - 1;
+		read_index.store(0, std::memory_order_relaxed);
+		write_index.store(0, std::memory_order_relaxed);
+	}
+
+	size_t capacity() { return mask + 1; }
+
+	// Frames written but not read yet, exact from either side and a snapshot from anywhere else
+	size_t size() {
+		return write_index.load(std::memory_order_acquire) - read_index.load(std::memory_order_acquire);
+	}
+
+	// Producer: copy up to count frames in, returns frames written
+	size_t write(const int16_t* frames, size_t count) {
+		size_t write_pos = write_index.load(std::memory_order_relaxed);
+		size_t read_pos = read_index.load(std::memory_order_acquire);
+		size_t n = std::min(count, capacity() - (write_pos - read_pos));
+		copy_in(frames, n, write_pos);
+		write_index.store(write_pos + n, std::memory_order_release);
+		return n;
+	}
+
+	// Consumer: copy up to count frames out, returns frames read
+	size_t read(int16_t* frames, size_t count) {
+		size_t read_pos = read_index.load(std::memory_order_relaxed);
+		size_t write_pos = write_index.load(std::memory_order_acquire);
+		size_t n = std::min(count, write_pos - read_pos);
+		copy_out(frames, n, read_pos);
+		read_index.store(read_pos + n, std::memory_order_release);
+		return n;
+	}
+
+private:
+	static const size_t BYTES_PER_FRAME = 2 * sizeof(int16_t);
+
+	std::vector<int16_t> buffer;
+	size_t mask;
+
+	// Indices count frames forever and are masked on access, so full and empty don't need a spare slot.
+	// They are on separate cache lines so the two threads don't fight over one
+	alignas(64) std::atomic<size_t> read_index;
+	alignas(64) std::atomic<size_t> write_index;
+
+	// Copy n frames into the ring at index, in two parts if it wraps
+	void copy_in(const int16_t* frames, size_t n, size_t index) {
+		size_t start = index & mask;
+		size_t first = std::min(n, capacity() - start);
+		memcpy(buffer.data() + start * 2, frames, first * BYTES_PER_FRAME);
+		memcpy(buffer.data(), frames + first * 2, (n - first) * BYTES_PER_FRAME);
+	}
+
+	// Copy n frames out of the ring at index, in two parts if it wraps
+	void copy_out(int16_t* frames, size_t n, size_t index) {
+		size_t start = index & mask;
+		size_t first = std::min(n, capacity() - start);
+		memcpy(frames, buffer.data() + start * 2, first * BYTES_PER_FRAME);
+		memcpy(frames + first * 2, buffer.data(), (n - first) * BYTES_PER_FRAME);
+	}
+};
@@ -1,11 +1,88 @@
 #pragma once
-#include <mutex>
+#include <atomic>
+#include <cstdint>
 #include <vector>
-// Shared texture buffer that is written to by the emulator and read by the 3d renderer
-struct TextureBuffer {
-	std::mutex mutex;
-	std::vector<uint8_t> pixels;
-	//dirty means new data ready
-	bool dirty = false;
-	int width, height;
-};
\ No newline at end of file
+// Pixel formats the emulator can hand to the 3d renderer
+enum class PixelFormat {
+	// 4 bytes RGBA per pixel
+	RGBA8,
+	// 1 byte per pixel, the shade in bits 0-1 and the palette (BG, OBP0, OBP1 or none) in bits 2-3.
+	// The screen shader colors it through a 16 entry palette texture
+	Indexed8
+};
+// Screen frames passed from the emulator to the 3d renderer through three buffers.
+// The emulator draws into the back buffer and publishes it by swapping it with the middle one, the renderer takes
+// the newest published frame by swapping the middle one with its front buffer. Each swap is one atomic exchange,
+// so neither side ever waits on the other or copies a frame while holding a lock.
+class TextureBuffer {
+public:
+	TextureBuffer(int in_width = 160, int in_height = 144, PixelFormat in_format = PixelFormat::RGBA8) :
+		width(in_width), height(in_height), format(in_format),
+		back_index(0), front_index(1), middle(2), published(0), dropped(0), duplicated(0) {
+		size_t size = (size_t)width * height * (format == PixelFormat::Indexed8 ? 1 : 4);
+		for (std::vector<uint8_t>& frame : frames) {
+			frame.assign(size, 0);
+		}
+	}
+
+	const int width;
+	const int height;
+	const PixelFormat format;
+
+	// Bytes in one frame
+	size_t frame_size() { return frames[0].size(); }
+
+	// Producer: the frame being drawn, the pointer stays valid but belongs to the renderer after publish()
+	uint8_t* back() { return frames[back_index].data(); }
+
+	// Producer: hand the back buffer to the renderer and continue in the buffer it replaces
+	void publish() {
+		uint8_t previous = middle.exchange(back_index | FRESH, std::memory_order_acq_rel);
+		back_index = previous & INDEX_MASK;
+		published.fetch_add(1, std::memory_order_relaxed);
+		// The renderer never took the previous frame, it gets drawn over
+		if (previous & FRESH) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// Consumer: move the newest published frame to the front. Returns false and keeps the current front if
+	// nothing was published since the last call, meaning the renderer shows the same frame again
+	bool acquire() {
+		if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+			duplicated.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		uint8_t previous = middle.exchange(front_index, std::memory_order_acq_rel);
+		front_index = previous & INDEX_MASK;
+		return true;
+	}
+
+	// Consumer: the frame last acquired
+	const uint8_t* front() { return frames[front_index].data(); }
+
+	// Frames published by the emulator, published frames drawn over before the renderer took them,
+	// and acquire() calls that found no new frame
+	uint64_t get_published() { return published.load(std::memory_order_relaxed); }
+	uint64_t get_dropped() { return dropped.load(std::memory_order_relaxed); }
+	uint64_t get_duplicated() { return duplicated.load(std::memory_order_relaxed); }
+
+private:
+	// Set in middle while it holds a frame the renderer hasn't taken yet
+	static const uint8_t FRESH = 4;
+	static const uint8_t INDEX_MASK = 3;
+
+	std::vector<uint8_t> frames[3];
+
+	// Only touched by their own side
+	uint8_t back_index;
+	uint8_t front_index;
+
+	// Index of the buffer between the two sides and the FRESH flag. On its own cache line from the counters
+	// so the producer's counter updates don't slow down the renderer's checks
+	alignas(64) std::atomic<uint8_t> middle;
+
+	alignas(64) std::atomic<uint64_t> published;
+	std::atomic<uint64_t> dropped;
+	alignas(64) std::atomic<uint64_t> duplicated;
+};
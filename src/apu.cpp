@@ -1,36 +1,614 @@
 #include "apu.h"
 #include "cstring"
+#include "gb.h"
 
-APU::APU() {
-	NR10 = 0;
-	NR11 = 0;
-	NR12 = 0;
-	NR13 = 0;
-	NR14 = 0;
+//Square wave duty cycles, the most significant bit is the first step. 12.5%, 25%, 50% and 75%
+static const uint8_t DUTY_PATTERNS[4] = { 0b00000001, 0b10000001, 0b10000111, 0b01111110 };
 
-	NR21 = 0;
+//Bits that always read as 1 for FF10-FF26, write only registers read 0xFF
+static const uint8_t READ_MASKS[0x17] = {
+	0x80, 0x3F, 0x00, 0xFF, 0xBF,
+	0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+	0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+	0xFF, 0xFF, 0x00, 0x00, 0xBF,
+	0x00, 0x00, 0x70
+};
+
+//Mixed output is at most 4 channels * 15 * master volume 8, scaled so the high passed output can swing both ways
+static const int VOLUME_SCALE = 32;
+
+//The frame sequencer steps when bit 12 of the timer's counter falls, every 8192 T-cycles
+static const uint64_t FRAME_SEQUENCER_PERIOD = 8192;
+
+APU::APU(GB* in_gb) :
+	gb(in_gb)
+{
+	//Register values after the boot ROM
+	NR10 = 0x80;
+	NR11 = 0xBF;
+	NR12 = 0xF3;
+	NR13 = 0xFF;
+	NR14 = 0xBF;
+
+	NR21 = 0x3F;
 	NR22 = 0;
-	NR23 = 0;
-	NR24 = 0;
+	NR23 = 0xFF;
+	NR24 = 0xBF;
 
-	NR30 = 0;
-	NR31 = 0;
-	NR32 = 0;
-	NR33 = 0;
-	NR34 = 0;
+	NR30 = 0x7F;
+	NR31 = 0xFF;
+	NR32 = 0x9F;
+	NR33 = 0xFF;
+	NR34 = 0xBF;
 
-	NR41 = 0;
+	NR41 = 0xFF;
 	NR42 = 0;
 	NR43 = 0;
-	NR44 = 0;
+	NR44 = 0xBF;
 
-	NR50 = 0;
-	NR51 = 0;
-	NR52 = 0;
+	NR50 = 0x77;
+	NR51 = 0xF3;
+	NR52 = 0x80;
 
 	memset(wave, 0, sizeof(wave));
+
+	for (Channel& channel : channels) {
+		channel.enabled = false;
+		channel.dac_enabled = false;
+		channel.length = 0;
+		channel.length_enabled = false;
+		channel.frequency = 0;
+		channel.next_step = NEVER;
+		channel.position = 0;
+		channel.volume = 0;
+		channel.envelope_period = 0;
+		channel.envelope_timer = 0;
+		channel.envelope_increase = false;
+		channel.output = 0;
+	}
+
+	//The boot sound leaves channel 1 on with its envelope faded out
+	Channel& square1 = channels[SQUARE1];
+	square1.enabled = true;
+	square1.dac_enabled = true;
+	square1.length = 64 - (NR11 & 0x3F);
+	square1.frequency = 0x7C1;
+	square1.envelope_period = NR12 & 0x07;
+	square1.envelope_timer = square1.envelope_period;
+	square1.next_step = step_period(SQUARE1);
+
+	sweep_shadow = square1.frequency;
+	sweep_timer = 8;
+	sweep_enabled = false;
+	sweep_negated = false;
+	lfsr = 0x7FFF;
+
+	frame_step = 0;
+	last_time = 0;
+	left_level = 0;
+	right_level = 0;
+	left.reset(0);
+	right.reset(0);
+}
+
+uint8_t APU::read_register(uint16_t addr) {
+	if (addr >= 0xFF30) {
+		return wave[addr - 0xFF30];
+	}
+
+	switch (addr) {
+	case 0xFF10: return NR10 | READ_MASKS[addr - 0xFF10];
+	case 0xFF11: return NR11 | READ_MASKS[addr - 0xFF10];
+	case 0xFF12: return NR12 | READ_MASKS[addr - 0xFF10];
+	case 0xFF13: return NR13 | READ_MASKS[addr - 0xFF10];
+	case 0xFF14: return NR14 | READ_MASKS[addr - 0xFF10];
+	case 0xFF16: return NR21 | READ_MASKS[addr - 0xFF10];
+	case 0xFF17: return NR22 | READ_MASKS[addr - 0xFF10];
+	case 0xFF18: return NR23 | READ_MASKS[addr - 0xFF10];
+	case 0xFF19: return NR24 | READ_MASKS[addr - 0xFF10];
+	case 0xFF1A: return NR30 | READ_MASKS[addr - 0xFF10];
+	case 0xFF1B: return NR31 | READ_MASKS[addr - 0xFF10];
+	case 0xFF1C: return NR32 | READ_MASKS[addr - 0xFF10];
+	case 0xFF1D: return NR33 | READ_MASKS[addr - 0xFF10];
+	case 0xFF1E: return NR34 | READ_MASKS[addr - 0xFF10];
+	case 0xFF20: return NR41 | READ_MASKS[addr - 0xFF10];
+	case 0xFF21: return NR42 | READ_MASKS[addr - 0xFF10];
+	case 0xFF22: return NR43 | READ_MASKS[addr - 0xFF10];
+	case 0xFF23: return NR44 | READ_MASKS[addr - 0xFF10];
+	case 0xFF24: return NR50;
+	case 0xFF25: return NR51;
+	case 0xFF26: {
+		//Channel status changes as lengths run out
+		catch_up(gb->get_t_cycle_count());
+		uint8_t status = NR52 | READ_MASKS[addr - 0xFF10];
+		for (int i = 0; i < 4; i++) {
+			status |= channels[i].enabled << i;
+		}
+		return status;
+	}
+	default:
+		return 0xFF;
+	}
+}
+
+void APU::write_register(uint16_t addr, uint8_t byte) {
+	uint64_t now = gb->get_t_cycle_count();
+	catch_up(now);
+
+	if (addr >= 0xFF30) {
+		wave[addr - 0xFF30] = byte;
+		return;
+	}
+
+	//Only NR52 can be written while powered off, except for the length counters on DMG
+	if (!powered() && addr != 0xFF26) {
+		switch (addr) {
+		case 0xFF11: channels[SQUARE1].length = 64 - (byte & 0x3F); break;
+		case 0xFF16: channels[SQUARE2].length = 64 - (byte & 0x3F); break;
+		case 0xFF1B: channels[WAVE].length = 256 - byte; break;
+		case 0xFF20: channels[NOISE].length = 64 - (byte & 0x3F); break;
+		}
+		return;
+	}
+
+	write(addr, byte, now);
+}
+
+void APU::write(uint16_t addr, uint8_t byte, uint64_t time) {
+	switch (addr) {
+	case 0xFF10:
+		NR10 = byte;
+		if (sweep_negated && (byte & 0x08) == 0) {
+			disable(SQUARE1, time);
+		}
+		break;
+	case 0xFF11:
+		NR11 = byte;
+		channels[SQUARE1].length = 64 - (byte & 0x3F);
+		update_output(SQUARE1, time);
+		break;
+	case 0xFF12:
+		NR12 = byte;
+		write_envelope(SQUARE1, byte, time);
+		break;
+	case 0xFF13:
+		NR13 = byte;
+		channels[SQUARE1].frequency = (channels[SQUARE1].frequency & 0x700) | byte;
+		break;
+	case 0xFF14:
+		NR14 = byte;
+		channels[SQUARE1].frequency = (channels[SQUARE1].frequency & 0xFF) | ((byte & 0x07) << 8);
+		write_control(SQUARE1, byte, 64, time);
+		break;
+	case 0xFF16:
+		NR21 = byte;
+		channels[SQUARE2].length = 64 - (byte & 0x3F);
+		update_output(SQUARE2, time);
+		break;
+	case 0xFF17:
+		NR22 = byte;
+		write_envelope(SQUARE2, byte, time);
+		break;
+	case 0xFF18:
+		NR23 = byte;
+		channels[SQUARE2].frequency = (channels[SQUARE2].frequency & 0x700) | byte;
+		break;
+	case 0xFF19:
+		NR24 = byte;
+		channels[SQUARE2].frequency = (channels[SQUARE2].frequency & 0xFF) | ((byte & 0x07) << 8);
+		write_control(SQUARE2, byte, 64, time);
+		break;
+	case 0xFF1A:
+		NR30 = byte;
+		channels[WAVE].dac_enabled = byte & 0x80;
+		if (!channels[WAVE].dac_enabled) {
+			disable(WAVE, time);
+		}
+		break;
+	case 0xFF1B:
+		NR31 = byte;
+		channels[WAVE].length = 256 - byte;
+		break;
+	case 0xFF1C:
+		NR32 = byte;
+		update_output(WAVE, time);
+		break;
+	case 0xFF1D:
+		NR33 = byte;
+		channels[WAVE].frequency = (channels[WAVE].frequency & 0x700) | byte;
+		break;
+	case 0xFF1E:
+		NR34 = byte;
+		channels[WAVE].frequency = (channels[WAVE].frequency & 0xFF) | ((byte & 0x07) << 8);
+		write_control(WAVE, byte, 256, time);
+		break;
+	case 0xFF20:
+		NR41 = byte;
+		channels[NOISE].length = 64 - (byte & 0x3F);
+		break;
+	case 0xFF21:
+		NR42 = byte;
+		write_envelope(NOISE, byte, time);
+		break;
+	case 0xFF22: {
+		NR43 = byte;
+		//A clock shift of 14 or 15 stops the LFSR, restart it if the new one runs
+		Channel& noise = channels[NOISE];
+		if (noise.enabled && noise.next_step == NEVER && step_period(NOISE) != NEVER) {
+			noise.next_step = time + step_period(NOISE);
+		}
+		break;
+	}
+	case 0xFF23:
+		NR44 = byte;
+		write_control(NOISE, byte, 64, time);
+		break;
+	case 0xFF24:
+		NR50 = byte;
+		update_mixer(time);
+		break;
+	case 0xFF25:
+		NR51 = byte;
+		update_mixer(time);
+		break;
+	case 0xFF26:
+		if ((byte & 0x80) == 0 && powered()) {
+			//Powering off clears every register, DMG keeps the length counters
+			int lengths[4];
+			for (int i = 0; i < 4; i++) {
+				lengths[i] = channels[i].length;
+			}
+			for (uint16_t reg = 0xFF10; reg <= 0xFF25; reg++) {
+				write(reg, 0, time);
+			}
+			for (int i = 0; i < 4; i++) {
+				disable(i, time);
+				channels[i].length = lengths[i];
+				channels[i].position = 0;
+			}
+			NR52 = 0;
+		}
+		else if ((byte & 0x80) != 0 && !powered()) {
+			NR52 = 0x80;
+			frame_step = 0;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void APU::write_envelope(int channel, uint8_t byte, uint64_t time) {
+	//The upper 5 bits being 0 turns the DAC off, the volume and envelope are only loaded on trigger
+	channels[channel].dac_enabled = (byte & 0xF8) != 0;
+	if (!channels[channel].dac_enabled) {
+		disable(channel, time);
+	}
+}
+
+void APU::write_control(int channel, uint8_t byte, int max_length, uint64_t time) {
+	Channel& c = channels[channel];
+
+	//Enabling length when the next frame sequencer step doesn't clock length clocks it once right away
+	bool extra_clock = (frame_step & 1) != 0;
+	bool was_enabled = c.length_enabled;
+	c.length_enabled = byte & 0x40;
+	if (extra_clock && !was_enabled && c.length_enabled && c.length > 0) {
+		c.length--;
+		if (c.length == 0 && (byte & 0x80) == 0) {
+			disable(channel, time);
+		}
+	}
+
+	if (byte & 0x80) {
+		if (c.length == 0) {
+			c.length = max_length;
+			if (extra_clock && c.length_enabled) {
+				c.length--;
+			}
+		}
+		trigger(channel, time);
+	}
+}
+
+void APU::trigger(int channel, uint64_t time) {
+	Channel& c = channels[channel];
+	c.enabled = true;
+
+	if (channel != WAVE) {
+		uint8_t envelope = channel == SQUARE1 ? NR12 : channel == SQUARE2 ? NR22 : NR42;
+		c.volume = envelope >> 4;
+		c.envelope_increase = envelope & 0x08;
+		c.envelope_period = envelope & 0x07;
+		c.envelope_timer = c.envelope_period;
+	}
+	if (channel == WAVE) {
+		c.position = 0;
+	}
+	if (channel == NOISE) {
+		lfsr = 0x7FFF;
+	}
+
+	uint64_t period = step_period(channel);
+	c.next_step = period == NEVER ? NEVER : time + period;
+
+	if (channel == SQUARE1) {
+		int sweep_period = (NR10 >> 4) & 0x07;
+		int shift = NR10 & 0x07;
+		sweep_shadow = c.frequency;
+		sweep_timer = sweep_period == 0 ? 8 : sweep_period;
+		sweep_enabled = sweep_period != 0 || shift != 0;
+		sweep_negated = false;
+		//The overflow check runs right away, which can disable the channel again
+		if (shift != 0) {
+			sweep_calculation(time);
+		}
+	}
+
+	//A channel with its DAC off is disabled right away
+	if (!c.dac_enabled) {
+		disable(channel, time);
+		return;
+	}
+	update_output(channel, time);
+}
+
+void APU::disable(int channel, uint64_t time) {
+	channels[channel].enabled = false;
+	channels[channel].next_step = NEVER;
+	update_output(channel, time);
+}
+
+uint64_t APU::step_period(int channel) {
+	switch (channel) {
+	case SQUARE1:
+	case SQUARE2:
+		//8 steps per cycle at 131072 / (2048 - frequency) Hz
+		return (2048 - channels[channel].frequency) * 4;
+	case WAVE:
+		//32 samples per cycle at 65536 / (2048 - frequency) Hz
+		return (2048 - channels[channel].frequency) * 2;
+	default: {
+		int shift = NR43 >> 4;
+		if (shift >= 14) {
+			return NEVER;
+		}
+		int divisor_code = NR43 & 0x07;
+		uint64_t divisor = divisor_code == 0 ? 8 : divisor_code * 16;
+		return divisor << shift;
+	}
+	}
+}
+
+void APU::step_channel(int channel, uint64_t time) {
+	Channel& c = channels[channel];
+	switch (channel) {
+	case SQUARE1:
+	case SQUARE2:
+		c.position = (c.position + 1) & 7;
+		break;
+	case WAVE:
+		c.position = (c.position + 1) & 31;
+		break;
+	default: {
+		//XOR of the lowest 2 bits is shifted in at bit 14, and also at bit 6 in 7 bit mode
+		uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+		lfsr = (lfsr >> 1) | (bit << 14);
+		if (NR43 & 0x08) {
+			lfsr = (lfsr & ~0x40) | (bit << 6);
+		}
+		break;
+	}
+	}
+	update_output(channel, time);
 }
 
-void APU::tick() {
-	//TODO
-}
\ No newline at end of file
+void APU::update_output(int channel, uint64_t time) {
+	Channel& c = channels[channel];
+
+	int output = 0;
+	if (c.enabled) {
+		switch (channel) {
+		case SQUARE1:
+		case SQUARE2: {
+			uint8_t duty = (channel == SQUARE1 ? NR11 : NR21) >> 6;
+			output = (DUTY_PATTERNS[duty] >> (7 - c.position)) & 1 ? c.volume : 0;
+			break;
+		}
+		case WAVE: {
+			//Upper nibble first. Volume codes 1-3 are 100%, 50% and 25%, 0 mutes
+			uint8_t sample = (wave[c.position >> 1] >> ((c.position & 1) ? 0 : 4)) & 0x0F;
+			int volume_code = (NR32 >> 5) & 0x03;
+			output = volume_code == 0 ? 0 : sample >> (volume_code - 1);
+			break;
+		}
+		default:
+			output = (lfsr & 1) == 0 ? c.volume : 0;
+			break;
+		}
+	}
+
+	if (output != c.output) {
+		c.output = output;
+		update_mixer(time);
+	}
+}
+
+void APU::update_mixer(uint64_t time) {
+	int left_sum = 0;
+	int right_sum = 0;
+	for (int i = 0; i < 4; i++) {
+		if ((NR51 >> (i + 4)) & 1) {
+			left_sum += channels[i].output;
+		}
+		if ((NR51 >> i) & 1) {
+			right_sum += channels[i].output;
+		}
+	}
+
+	int left_out = left_sum * (((NR50 >> 4) & 0x07) + 1) * VOLUME_SCALE;
+	int right_out = right_sum * ((NR50 & 0x07) + 1) * VOLUME_SCALE;
+	if (left_out != left_level) {
+		left.add_delta(time, left_out - left_level);
+		left_level = left_out;
+	}
+	if (right_out != right_level) {
+		right.add_delta(time, right_out - right_level);
+		right_level = right_out;
+	}
+}
+
+void APU::catch_up(uint64_t time) {
+	if (time <= last_time) {
+		return;
+	}
+
+	//Everything is stopped while powered off
+	if (!powered()) {
+		last_time = time;
+		return;
+	}
+
+	while (last_time < time) {
+		uint64_t frame_sequencer_time = next_frame_sequencer_time();
+		uint64_t end = std::min(time, frame_sequencer_time);
+		run_channels(end);
+		last_time = end;
+		if (end == frame_sequencer_time) {
+			clock_frame_sequencer(end);
+		}
+	}
+}
+
+void APU::run_channels(uint64_t time) {
+	//Channels mix linearly so each one can be run up to time on its own
+	for (int i = 0; i < 4; i++) {
+		Channel& c = channels[i];
+		while (c.next_step <= time) {
+			uint64_t step_time = c.next_step;
+			uint64_t period = step_period(i);
+			c.next_step = period == NEVER ? NEVER : step_time + period;
+			step_channel(i, step_time);
+		}
+	}
+}
+
+uint64_t APU::next_frame_sequencer_time() {
+	return last_time + FRAME_SEQUENCER_PERIOD - (gb->timer.counter(last_time) & (FRAME_SEQUENCER_PERIOD - 1));
+}
+
+void APU::clock_frame_sequencer(uint64_t time) {
+	//Length on even steps, sweep on steps 2 and 6 and envelope on step 7
+	switch (frame_step) {
+	case 0:
+	case 4:
+		clock_length(time);
+		break;
+	case 2:
+	case 6:
+		clock_length(time);
+		clock_sweep(time);
+		break;
+	case 7:
+		clock_envelope(time);
+		break;
+	default:
+		break;
+	}
+	frame_step = (frame_step + 1) & 7;
+}
+
+void APU::clock_length(uint64_t time) {
+	for (int i = 0; i < 4; i++) {
+		Channel& c = channels[i];
+		if (c.length_enabled && c.length > 0) {
+			c.length--;
+			if (c.length == 0) {
+				disable(i, time);
+			}
+		}
+	}
+}
+
+void APU::clock_envelope(uint64_t time) {
+	for (int i : { SQUARE1, SQUARE2, NOISE }) {
+		Channel& c = channels[i];
+		if (c.envelope_period == 0) {
+			continue;
+		}
+		if (--c.envelope_timer > 0) {
+			continue;
+		}
+		c.envelope_timer = c.envelope_period;
+		if (c.envelope_increase && c.volume < 15) {
+			c.volume++;
+			update_output(i, time);
+		}
+		else if (!c.envelope_increase && c.volume > 0) {
+			c.volume--;
+			update_output(i, time);
+		}
+	}
+}
+
+void APU::clock_sweep(uint64_t time) {
+	if (--sweep_timer > 0) {
+		return;
+	}
+
+	int period = (NR10 >> 4) & 0x07;
+	sweep_timer = period == 0 ? 8 : period;
+	if (!sweep_enabled || period == 0) {
+		return;
+	}
+
+	uint16_t frequency = sweep_calculation(time);
+	if (frequency <= 2047 && (NR10 & 0x07) != 0) {
+		sweep_shadow = frequency;
+		channels[SQUARE1].frequency = frequency;
+		//Checked again with the new frequency, only for overflow
+		sweep_calculation(time);
+	}
+}
+
+uint16_t APU::sweep_calculation(uint64_t time) {
+	uint16_t delta = sweep_shadow >> (NR10 & 0x07);
+	uint16_t frequency;
+	if (NR10 & 0x08) {
+		frequency = sweep_shadow - delta;
+		sweep_negated = true;
+	}
+	else {
+		frequency = sweep_shadow + delta;
+	}
+
+	if (frequency > 2047) {
+		disable(SQUARE1, time);
+	}
+	return frequency;
+}
+
+void APU::DIV_write(uint64_t time) {
+	catch_up(time);
+
+	//Resetting the counter is a falling edge of bit 12 if it was set
+	if (powered() && ((gb->timer.counter(time) >> 12) & 1)) {
+		clock_frame_sequencer(time);
+	}
+}
+
+void APU::end_frame(uint64_t time) {
+	catch_up(time);
+	left.end_frame(time);
+	right.end_frame(time);
+}
+
+size_t APU::samples_available() {
+	return left.samples_available();
+}
+
+size_t APU::read_samples(int16_t* out, size_t count) {
+	size_t frames = left.read_samples(out, count, 2);
+	right.read_samples(out + 1, frames, 2);
+	return frames;
+}
@@ -1,15 +1,82 @@
+#pragma once
 #include "common.h"
+#include "blip_buffer.h"
 
+class GB;
+
+//Stereo frames per second the APU outputs
+const int APU_SAMPLE_RATE = 4194304 / BlipBuffer::CLOCKS_PER_SAMPLE;
+
+//Square with sweep, square, wave and noise channels, the frame sequencer and the mixer.
+//Nothing is ticked. catch_up() runs the APU from the last T-cycle it ran to now whenever a register is accessed,
+// DIV is reset or GB reads the output. Each channel only does work on the T-cycles its waveform steps and amplitude
+// changes go to band-limited BlipBuffers, so the cost follows how often the output changes and how many samples are
+// read instead of how many cycles are emulated.
+//The frame sequencer steps on the falling edge of bit 12 of the timer's internal counter like on hardware, so DIV
+// writes move it.
+//https://gbdev.io/pandocs/Audio_details.html
 class APU {
 public:
 	friend class MMU;
 
-	APU();
+	APU(GB* in_gb);
+
+	//FF10-FF3F
+	uint8_t read_register(uint16_t addr);
+	void write_register(uint16_t addr, uint8_t byte);
+
+	//Called before DIV is reset at T-cycle time
+	void DIV_write(uint64_t time);
+
+	//Run up to T-cycle time, the output before it can then be read
+	void end_frame(uint64_t time);
 
-	//Execute one cycle
-	void tick();
+	//Stereo frames that can be read
+	size_t samples_available();
+
+	//Read up to count interleaved stereo frames at APU_SAMPLE_RATE into out. Returns frames read
+	size_t read_samples(int16_t* out, size_t count);
 
 private:
+	//Pointer to GB object for the T-cycle count and the timer
+	GB* gb;
+
+	enum ChannelId {
+		SQUARE1,
+		SQUARE2,
+		WAVE,
+		NOISE
+	};
+
+	struct Channel {
+		//Shown in NR52, cleared when the length runs out, the sweep overflows or the DAC is turned off
+		bool enabled;
+		bool dac_enabled;
+
+		int length;
+		bool length_enabled;
+
+		//11 bit period value from NRx3 and NRx4, not used by noise
+		uint16_t frequency;
+
+		//T-cycle of the next waveform step, NEVER while disabled
+		uint64_t next_step;
+
+		//Duty step for squares, sample index for wave
+		int position;
+
+		//Envelope for squares and noise
+		int volume;
+		int envelope_period;
+		int envelope_timer;
+		bool envelope_increase;
+
+		//Digital output 0-15
+		int output;
+	};
+
+	Channel channels[4];
+
 	//FF10-FF14 Sound channel 1
 	uint8_t NR10;
 	uint8_t NR11;
@@ -42,9 +109,75 @@ private:
 	//FF25 Sound panning
 	uint8_t NR51;
 
-	//FF26 Audio master control
+	//FF26 Audio master control, only the power bit is stored
 	uint8_t NR52;
 
 	//FF30-FF3F
 	uint8_t wave[16];
-};
\ No newline at end of file
+
+	//Channel 1 frequency sweep
+	uint16_t sweep_shadow;
+	int sweep_timer;
+	bool sweep_enabled;
+	//A sweep calculation used negate mode since the last trigger, clearing negate then disables the channel
+	bool sweep_negated;
+
+	//Noise linear feedback shift register
+	uint16_t lfsr;
+
+	//Next frame sequencer step 0-7
+	int frame_step;
+
+	//T-cycle the APU has run up to
+	uint64_t last_time;
+
+	//Mixed output last added to the buffers
+	int left_level;
+	int right_level;
+
+	BlipBuffer left;
+	BlipBuffer right;
+
+	bool powered() { return NR52 & 0x80; }
+
+	//Run the channels and frame sequencer up to T-cycle time
+	void catch_up(uint64_t time);
+
+	//Step the channels' waveforms up to and including T-cycle time
+	void run_channels(uint64_t time);
+
+	//T-cycle after last_time where the frame sequencer steps
+	uint64_t next_frame_sequencer_time();
+
+	void clock_frame_sequencer(uint64_t time);
+	void clock_length(uint64_t time);
+	void clock_envelope(uint64_t time);
+	void clock_sweep(uint64_t time);
+
+	//Next sweep frequency, disables channel 1 if it overflows
+	uint16_t sweep_calculation(uint64_t time);
+
+	//T-cycles between waveform steps, NEVER if the channel can't step
+	uint64_t step_period(int channel);
+
+	//Advance the channel's waveform by one step
+	void step_channel(int channel, uint64_t time);
+
+	void trigger(int channel, uint64_t time);
+	void disable(int channel, uint64_t time);
+
+	//Length enable and trigger from NRx4
+	void write_control(int channel, uint8_t byte, int max_length, uint64_t time);
+
+	//Envelope and DAC from NRx2
+	void write_envelope(int channel, uint8_t byte, uint64_t time);
+
+	//Recompute a channel's output from its waveform position and volume
+	void update_output(int channel, uint64_t time);
+
+	//Add the change in the mixed output at T-cycle time to the buffers
+	void update_mixer(uint64_t time);
+
+	//Register write with the APU caught up, also used to clear the registers on power off
+	void write(uint16_t addr, uint8_t byte, uint64_t time);
+};
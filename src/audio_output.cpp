@@ -0,0 +1,150 @@
+#include "audio_output.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+//Largest change rate_control() makes to the rate, small enough that the pitch change can't be heard
+static const double MAX_RATE_DELTA = 0.005;
+
+//Interleaved stereo int16
+static const size_t BYTES_PER_FRAME = 2 * sizeof(int16_t);
+
+//Frames pushed beyond this many latency targets are dropped instead of adding latency
+static const size_t MAX_QUEUED_TARGETS = 3;
+
+AudioOutput::AudioOutput() {
+	device = 0;
+	sample_rate = 48000;
+	latency_target = 0;
+	underruns = 0;
+	overruns = 0;
+	pushes = 0;
+	waits = 0;
+	min_rate = 1;
+	max_rate = 1;
+}
+
+AudioOutput::~AudioOutput() {
+	close();
+}
+
+bool AudioOutput::open(int rate, int latency_ms) {
+	close();
+
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+		LOG_ERROR("Unable to initialize SDL audio: %s", SDL_GetError());
+		return false;
+	}
+
+	SDL_AudioSpec want = SDL_AudioSpec();
+	want.freq = rate;
+	want.format = AUDIO_S16SYS;
+	want.channels = 2;
+	want.samples = 512;
+	want.callback = callback;
+	want.userdata = this;
+
+	SDL_AudioSpec have;
+	device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+	if (device == 0) {
+		LOG_ERROR("Unable to open audio device: %s", SDL_GetError());
+		return false;
+	}
+
+	sample_rate = have.freq;
+	latency_target = (size_t)sample_rate * latency_ms / 1000;
+
+	//All allocation happens here, before the callback can run
+	ring.resize(latency_target * MAX_QUEUED_TARGETS + have.samples);
+	underruns = 0;
+
+	//Start with the queue at the target so the first frames don't underrun while emulation catches up
+	std::vector<int16_t> silence(latency_target * 2, 0);
+	ring.write(silence.data(), latency_target);
+
+	SDL_PauseAudioDevice(device, 0);
+	return true;
+}
+
+void AudioOutput::close() {
+	if (device != 0) {
+		SDL_CloseAudioDevice(device);
+		device = 0;
+	}
+}
+
+void AudioOutput::push(const int16_t* frames, size_t count) {
+	if (device == 0) {
+		return;
+	}
+	pushes++;
+
+	//Without audio sync the queue can grow if emulation runs faster than the device, drop audio instead of adding latency
+	size_t room = latency_target * MAX_QUEUED_TARGETS - std::min(queued_frames(), latency_target * MAX_QUEUED_TARGETS);
+	if (ring.write(frames, std::min(count, room)) < count) {
+		overruns++;
+	}
+}
+
+size_t AudioOutput::queued_frames() {
+	if (device == 0) {
+		return 0;
+	}
+	return ring.size();
+}
+
+void AudioOutput::callback(void* userdata, uint8_t* stream, int len) {
+	AudioOutput* output = (AudioOutput*)userdata;
+	size_t count = len / BYTES_PER_FRAME;
+	size_t read = output->ring.read((int16_t*)stream, count);
+
+	//Play silence for what's missing rather than wait for the emulator
+	if (read < count) {
+		memset(stream + read * BYTES_PER_FRAME, 0, (count - read) * BYTES_PER_FRAME);
+		output->underruns.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void AudioOutput::wait_for_space() {
+	if (device == 0) {
+		return;
+	}
+
+	size_t queued = queued_frames();
+	if (queued > latency_target) {
+		waits++;
+	}
+	while (queued > latency_target) {
+		//Sleep for about as long as the device takes to play the frames over the target.
+		// The callback takes frames a device buffer at a time so this can take a few rounds
+		auto excess = std::chrono::microseconds((queued - latency_target) * 1000000 / sample_rate);
+		std::this_thread::sleep_for(std::max(excess, std::chrono::microseconds(500)));
+		queued = queued_frames();
+	}
+}
+
+double AudioOutput::rate_control() {
+	if (device == 0 || latency_target == 0) {
+		return 1;
+	}
+
+	//-1 when the queue is twice the target, 1 when it is empty
+	double fill = (double)queued_frames() / latency_target;
+	double error = std::clamp(1 - fill, -1.0, 1.0);
+	double rate = 1 + MAX_RATE_DELTA * error;
+
+	min_rate = std::min(min_rate, rate);
+	max_rate = std::max(max_rate, rate);
+	return rate;
+}
+
+void AudioOutput::print_stats() {
+	if (pushes == 0) {
+		return;
+	}
+	LOG("Audio: %d Hz, latency target %zu frames (%.1f ms), %llu underruns, %llu overruns and %llu waits in %llu pushes, rate %.4f - %.4f",
+		sample_rate, latency_target, 1000.0 * latency_target / sample_rate, (unsigned long long)underruns.load(),
+		(unsigned long long)overruns, (unsigned long long)waits, (unsigned long long)pushes, min_rate, max_rate);
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include "common.h"
+#include "AudioRingBuffer.h"
+#include <atomic>
+#include <SDL.h>
+
+//Host audio device the emulator queues interleaved stereo int16 frames on.
+//Frames go through a lock-free ring buffer that SDL's audio callback reads from, so the callback never takes a lock
+// or allocates and audio keeps playing while the emulator or renderer thread stalls.
+//In audio sync mode GB::run() paces emulation off this device instead of the wall clock: after every frame it
+// sleeps until the device has played the queue down to the latency target, so the sound card's clock decides how
+// fast emulation runs and nothing spins.
+//rate_control() nudges how many host frames an emulated second turns into by at most MAX_RATE_DELTA, so the queue
+// settles at the latency target instead of slowly running dry or filling up when the host falls behind.
+class AudioOutput {
+public:
+	AudioOutput();
+	~AudioOutput();
+
+	//Owns the SDL audio device
+	AudioOutput(const AudioOutput&) = delete;
+	AudioOutput& operator=(const AudioOutput&) = delete;
+
+	//Open the default device with latency_ms of queued audio as the target. False if no device could be opened
+	bool open(int rate, int latency_ms);
+
+	void close();
+
+	bool is_open() { return device != 0; }
+
+	//Queue count stereo frames, dropping the ones that don't fit
+	void push(const int16_t* frames, size_t count);
+
+	//Stereo frames in the ring buffer that the callback hasn't taken yet
+	size_t queued_frames();
+
+	//Sleep until the queue has drained to the latency target
+	void wait_for_space();
+
+	//Factor for the host frames per emulated second, above 1 while the queue is below the latency target
+	double rate_control();
+
+	//Log queue fill and rate control statistics
+	void print_stats();
+
+	//Frames per second the device plays
+	int sample_rate;
+
+	//Frames the queue is kept at
+	size_t latency_target;
+
+	//Statistics. Underruns are callbacks that ran out of frames and are counted on the audio thread,
+	// overruns are pushes that didn't fit
+	std::atomic<uint64_t> underruns;
+	uint64_t overruns;
+	uint64_t pushes;
+	uint64_t waits;
+	double min_rate;
+	double max_rate;
+
+private:
+	SDL_AudioDeviceID device;
+
+	AudioRingBuffer ring;
+
+	//SDL audio callback, runs on SDL's audio thread
+	static void callback(void* userdata, uint8_t* stream, int len);
+};
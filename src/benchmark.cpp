@@ -0,0 +1,70 @@
+#include "benchmark.h"
+#include "gb.h"
+#include <algorithm>
+
+Benchmark::Benchmark(GB* in_gb) :
+	gb(in_gb)
+{
+	enabled = false;
+	start_cpu_seconds = 0;
+}
+
+void Benchmark::start() {
+	start_cpu_seconds = FramePacer::thread_cpu_seconds();
+	start_time = std::chrono::steady_clock::now();
+	last_frame_time = start_time;
+	frame_ns.clear();
+}
+
+void Benchmark::frame_done() {
+	auto now = std::chrono::steady_clock::now();
+	frame_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_frame_time).count());
+	last_frame_time = now;
+}
+
+uint64_t Benchmark::percentile(const std::vector<uint64_t>& sorted, double p) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	//Nearest rank
+	size_t rank = (size_t)(p * sorted.size() + 0.999999);
+	rank = std::clamp<size_t>(rank, 1, sorted.size());
+	return sorted[rank - 1];
+}
+
+void Benchmark::print_json() {
+	double host_seconds = std::chrono::duration<double>(last_frame_time - start_time).count();
+	double fps = host_seconds > 0 ? frame_ns.size() / host_seconds : 0;
+
+	//Host CPU time is what pacing saves, wall time per frame stays the same when frames are paced
+	double emulated_seconds = gb->t_cycle_count / (double)T_CYCLES_PER_SECOND;
+	double cpu_ms = (FramePacer::thread_cpu_seconds() - start_cpu_seconds) * 1000;
+	double cpu_ms_per_second = emulated_seconds > 0 ? cpu_ms / emulated_seconds : 0;
+
+	std::vector<uint64_t> sorted = frame_ns;
+	std::sort(sorted.begin(), sorted.end());
+
+	//Emulated T-cycles, split by what the CPU was doing. Halted and idle skipped cycles are fast forwarded
+	uint64_t total_cycles = gb->t_cycle_count;
+	uint64_t halted_cycles = gb->cpu.halted_cycles;
+	uint64_t idle_cycles = gb->idle_skip.skipped_cycles;
+	uint64_t running_cycles = total_cycles - halted_cycles - idle_cycles;
+
+	uint64_t instructions = gb->cpu.instructions + gb->block_cache.ops_executed;
+
+	printf("{\"frames\": %llu, \"host_seconds\": %.6f, \"emulated_fps\": %.3f, \"host_cpu_ms_per_emulated_second\": %.3f, "
+		"\"frame_ns\": {\"p50\": %llu, \"p99\": %llu, \"max\": %llu}, "
+		"\"instructions_retired\": %llu, "
+		"\"cycles\": {\"total\": %llu, \"cpu_running\": %llu, \"cpu_halted\": %llu, \"cpu_idle_skipped\": %llu}, "
+		"\"events\": {\"ppu\": %llu, \"timer\": %llu}, "
+		"\"cpu_mode\": \"%s\"}\n",
+		(unsigned long long)frame_ns.size(), host_seconds, fps, cpu_ms_per_second,
+		(unsigned long long)percentile(sorted, 0.50), (unsigned long long)percentile(sorted, 0.99),
+		(unsigned long long)(sorted.empty() ? 0 : sorted.back()),
+		(unsigned long long)instructions,
+		(unsigned long long)total_cycles, (unsigned long long)running_cycles,
+		(unsigned long long)halted_cycles, (unsigned long long)idle_cycles,
+		(unsigned long long)gb->event_counts[(int)Event::PPU], (unsigned long long)gb->event_counts[(int)Event::TIMA],
+		gb->cpu.use_jit ? "jit" : gb->cpu.use_block_cache ? "block_cache" : "interpreter");
+	fflush(stdout);
+}
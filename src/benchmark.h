@@ -0,0 +1,40 @@
+#pragma once
+#include "common.h"
+#include <vector>
+#include <chrono>
+
+//Forward declaration
+class GB;
+
+//Host frame times and emulated cycle counts for --headless runs. The results are printed as one line of JSON
+// so scripts can compare them across commits.
+//Frame times are taken when the PPU finishes a frame, so with pacing on they include the time spent waiting.
+class Benchmark {
+public:
+	Benchmark(GB* in_gb);
+
+	//Start timing, called right before the first frame starts
+	void start();
+
+	//Record the host time since the last frame ended
+	void frame_done();
+
+	//Print the results as a single line of JSON on stdout, headless runs send everything else to stderr
+	void print_json();
+
+	//Frame times are only recorded while enabled
+	bool enabled;
+
+private:
+	GB* gb;
+
+	std::chrono::steady_clock::time_point start_time;
+	std::chrono::steady_clock::time_point last_frame_time;
+	double start_cpu_seconds;
+
+	//Host nanoseconds per emulated frame
+	std::vector<uint64_t> frame_ns;
+
+	//Frame time at percentile p of the sorted frame times
+	static uint64_t percentile(const std::vector<uint64_t>& sorted, double p);
+};
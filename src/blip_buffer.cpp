@@ -0,0 +1,99 @@
+#include "blip_buffer.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+//Cutoff as a fraction of the sample rate, leaves some room below Nyquist for the window's transition band
+static const double CUTOFF = 0.45;
+
+//High pass pole, about 20 Hz at the APU's sample rate
+static const float HIGH_PASS = 0.999f;
+
+namespace {
+
+//Blackman windowed sinc impulses for each position of a delta inside its sample, each normalized to sum to 1
+// so a step always ends at exactly its amplitude
+struct Kernels {
+	float taps[BlipBuffer::CLOCKS_PER_SAMPLE][BlipBuffer::TAPS];
+
+	Kernels() {
+		const double PI = 3.14159265358979323846;
+		for (int phase = 0; phase < BlipBuffer::CLOCKS_PER_SAMPLE; phase++) {
+			double center = BlipBuffer::TAPS / 2 + (double)phase / BlipBuffer::CLOCKS_PER_SAMPLE;
+			double sum = 0;
+			for (int i = 0; i < BlipBuffer::TAPS; i++) {
+				double x = i - center;
+				double sinc = x == 0 ? 1 : std::sin(2 * PI * CUTOFF * x) / (2 * PI * CUTOFF * x);
+				double w = x / BlipBuffer::TAPS;
+				double window = std::fabs(w) > 0.5 ? 0 : 0.42 + 0.5 * std::cos(2 * PI * w) + 0.08 * std::cos(4 * PI * w);
+				taps[phase][i] = (float)(sinc * window);
+				sum += taps[phase][i];
+			}
+			for (int i = 0; i < BlipBuffer::TAPS; i++) {
+				taps[phase][i] = (float)(taps[phase][i] / sum);
+			}
+		}
+	}
+};
+
+const Kernels kernels;
+
+}
+
+BlipBuffer::BlipBuffer() {
+	//Room for the kernel of a delta in the last sample
+	buffer.resize(MAX_SAMPLES + TAPS, 0);
+	reset(0);
+}
+
+void BlipBuffer::reset(uint64_t time) {
+	std::fill(buffer.begin(), buffer.end(), 0.0f);
+	start_time = time - time % CLOCKS_PER_SAMPLE;
+	available = 0;
+	used = 0;
+	integrator = 0;
+	last_in = 0;
+	last_out = 0;
+}
+
+void BlipBuffer::add_delta(uint64_t time, int delta) {
+	uint64_t offset = time - start_time;
+	uint64_t index = offset / CLOCKS_PER_SAMPLE;
+	if (index >= MAX_SAMPLES) {
+		return;
+	}
+
+	const float* kernel = kernels.taps[offset % CLOCKS_PER_SAMPLE];
+	float* samples = &buffer[index];
+	for (int i = 0; i < TAPS; i++) {
+		samples[i] += delta * kernel[i];
+	}
+	used = std::max<size_t>(used, index + TAPS);
+}
+
+void BlipBuffer::end_frame(uint64_t time) {
+	available = std::min<uint64_t>((time - start_time) / CLOCKS_PER_SAMPLE, MAX_SAMPLES);
+}
+
+size_t BlipBuffer::read_samples(int16_t* out, size_t count, int stride) {
+	size_t n = std::min(count, available);
+
+	for (size_t i = 0; i < n; i++) {
+		integrator += buffer[i];
+		float filtered = integrator - last_in + HIGH_PASS * last_out;
+		last_in = integrator;
+		last_out = filtered;
+		out[i * stride] = (int16_t)std::clamp(filtered, -32768.0f, 32767.0f);
+	}
+
+	//Move the rest down, deltas can already be past the last available sample
+	size_t end = std::max(used, available);
+	size_t remaining = end - n;
+	memmove(buffer.data(), buffer.data() + n, remaining * sizeof(float));
+	std::fill(buffer.begin() + remaining, buffer.begin() + end, 0.0f);
+	used = remaining;
+
+	start_time += n * CLOCKS_PER_SAMPLE;
+	available -= n;
+	return n;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "common.h"
+#include <vector>
+
+//Band-limited step synthesis for one output channel.
+//Amplitude changes are added as deltas at the T-cycle they happen. Each delta is spread over the samples around it
+// as a windowed sinc impulse and reading integrates the samples back into steps, so a square wave comes out without
+// the aliasing of one sampled directly at the output rate.
+//There is one output sample every CLOCKS_PER_SAMPLE T-cycles, so where a delta lands inside its sample picks one of
+// CLOCKS_PER_SAMPLE precomputed kernels.
+//Samples are read through a high pass filter that removes DC like the capacitors on the hardware's output do.
+class BlipBuffer {
+public:
+	static const int CLOCKS_PER_SAMPLE = 32;
+
+	//Length of the impulse kernel in samples, output is delayed by half of it
+	static const int TAPS = 16;
+
+	//Samples that can be waiting to be read, deltas past this are dropped until samples are read
+	static constexpr size_t MAX_SAMPLES = 1 << 16;
+
+	BlipBuffer();
+
+	//Empty the buffer and start it at T-cycle time
+	void reset(uint64_t time);
+
+	//Change the amplitude by delta at T-cycle time. time can't be before the last end_frame()
+	void add_delta(uint64_t time, int delta);
+
+	//Complete the samples before T-cycle time so they can be read
+	void end_frame(uint64_t time);
+
+	size_t samples_available() { return available; }
+
+	//Read up to count samples, writing them stride int16s apart so channels can be interleaved. Returns samples read
+	size_t read_samples(int16_t* out, size_t count, int stride);
+
+private:
+	//Deltas spread by the kernel, integrating them gives the samples
+	std::vector<float> buffer;
+
+	//T-cycle of buffer[0]
+	uint64_t start_time;
+
+	//Completed samples at the start of buffer
+	size_t available;
+
+	//End of the samples deltas have been added to
+	size_t used;
+
+	//Running sum of buffer and the high pass filter's last input and output
+	float integrator;
+	float last_in;
+	float last_out;
+};
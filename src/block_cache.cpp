@@ -0,0 +1,389 @@
+#include "block_cache.h"
+#include "gb.h"
+#include <cstring>
+#include <algorithm>
+
+//Instruction length in bytes. STOP is 1 since CPU::STOP doesn't consume its second byte
+static const uint8_t OPCODE_LENGTH[256] = {
+	1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+	1, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+	1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+	2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1
+};
+
+//M-cycles with conditionals not taken, including the opcode fetch
+static const uint8_t OPCODE_CYCLES[256] = {
+	1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
+	1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
+	2, 3, 2, 2, 1, 1, 2, 1, 2, 2, 2, 2, 1, 1, 2, 1,
+	2, 3, 2, 2, 3, 3, 3, 1, 2, 2, 2, 2, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	2, 2, 2, 2, 2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+	2, 3, 3, 4, 3, 4, 2, 4, 2, 4, 3, 2, 3, 6, 2, 4,
+	2, 3, 3, 1, 3, 4, 2, 4, 2, 4, 3, 1, 3, 1, 2, 4,
+	3, 3, 2, 1, 1, 4, 2, 4, 4, 1, 4, 1, 1, 1, 2, 4,
+	3, 3, 2, 1, 1, 4, 2, 4, 3, 2, 4, 1, 1, 1, 2, 4
+};
+
+//Opcodes a block ends after, anything that can change PC other than falling through
+static bool ends_block(uint8_t opcode) {
+	switch (opcode) {
+	//JR
+	case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+	//RET
+	case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9:
+	//JP
+	case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9:
+	//CALL
+	case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:
+	//RST
+	case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+	//HALT
+	case 0x76:
+		return true;
+	default:
+		return false;
+	}
+}
+
+//Opcodes left to the interpreter, STOP and the unused opcodes
+static bool is_uncacheable(uint8_t opcode) {
+	switch (opcode) {
+	case 0x10:
+	case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB: case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+		return true;
+	default:
+		return false;
+	}
+}
+
+//Longest block, keeps a single decode from walking a whole bank of straight-line data
+static const int MAX_BLOCK_OPS = 64;
+
+//Keys above any ROM offset for code in WRAM and HRAM
+static const uint32_t RAM_KEY = 0x1000000;
+
+BlockCache::BlockCache(GB* in_gb) :
+	gb(in_gb)
+{
+	generation = 0;
+	lookups = 0;
+	hits = 0;
+	blocks_executed = 0;
+	ops_executed = 0;
+	invalidated_blocks = 0;
+	fused_pairs = 0;
+	use_fusion = true;
+	count_pairs = false;
+	memset(code_written, 0, sizeof(code_written));
+	clear_recent();
+}
+
+Block* BlockCache::get_block(uint16_t pc) {
+	retired.clear();
+
+	int64_t key = get_key(pc);
+	if (key < 0) {
+		return nullptr;
+	}
+
+	lookups++;
+	Block*& slot = recent[pc & (RECENT_SIZE - 1)];
+	if (slot != nullptr && slot->key == key && slot->start_pc == pc) {
+		hits++;
+		return slot;
+	}
+
+	auto it = blocks.find((uint32_t)key);
+	if (it != blocks.end()) {
+		hits++;
+		slot = &it->second;
+		return slot;
+	}
+
+	slot = decode(pc, (uint32_t)key);
+	return slot;
+}
+
+void BlockCache::rom_banks_changed() {
+	//Blocks are keyed by ROM offset so the cached blocks stay valid for their own bank,
+	// only a block that is running right now could continue into code from the wrong bank
+	generation++;
+}
+
+void BlockCache::invalidate_write(uint16_t addr) {
+	int page = addr >> 8;
+	bool is_WRAM = addr >= 0xC000 && addr <= 0xDFFF;
+
+	if (!page_blocks[page].empty()) {
+		for (uint32_t key : page_blocks[page]) {
+			auto it = blocks.find(key);
+			if (it != blocks.end()) {
+				retired.push_back(std::move(it->second));
+				blocks.erase(it);
+				invalidated_blocks++;
+			}
+		}
+		page_blocks[page].clear();
+		code_written[page] = true;
+		clear_recent();
+		generation++;
+	}
+
+	if (is_WRAM) {
+		//Nothing left to protect, let writes take the fast path again
+		gb->mmu.set_code_page(page, false);
+	}
+}
+
+void BlockCache::print_stats() {
+	double hit_rate = lookups > 0 ? 100.0 * hits / lookups : 0;
+	double avg_executed = blocks_executed > 0 ? (double)ops_executed / blocks_executed : 0;
+
+	size_t total_ops = 0;
+	size_t longest = 0;
+	uint64_t total_cycles = 0;
+	for (auto& entry : blocks) {
+		total_ops += entry.second.ops.size();
+		total_cycles += entry.second.cycles;
+		if (entry.second.ops.size() > longest) {
+			longest = entry.second.ops.size();
+		}
+	}
+	double avg_ops = blocks.size() > 0 ? (double)total_ops / blocks.size() : 0;
+	double avg_cycles = blocks.size() > 0 ? (double)total_cycles / blocks.size() : 0;
+
+	LOG("Block cache: %llu lookups, %.2f%% hit rate, %zu blocks cached, %llu invalidated",
+		(unsigned long long)lookups, hit_rate, blocks.size(), (unsigned long long)invalidated_blocks);
+	LOG("Block cache: %.2f ops (%.2f M-cycles) per cached block, longest %zu ops, %.2f ops run per executed block, %llu pairs fused",
+		avg_ops, avg_cycles, longest, avg_executed, (unsigned long long)fused_pairs);
+}
+
+void BlockCache::set_pair_counting(bool enabled) {
+	count_pairs = enabled;
+	use_fusion = !enabled;
+	if (enabled) {
+		pair_counts.assign(512 * 512, 0);
+	}
+	else {
+		pair_counts.clear();
+	}
+}
+
+void BlockCache::print_pair_stats(int count) {
+	if (!count_pairs) {
+		return;
+	}
+
+	uint64_t total = 0;
+	std::vector<uint32_t> pairs;
+	for (uint32_t i = 0; i < pair_counts.size(); i++) {
+		if (pair_counts[i] > 0) {
+			pairs.push_back(i);
+			total += pair_counts[i];
+		}
+	}
+	std::sort(pairs.begin(), pairs.end(), [&](uint32_t a, uint32_t b) {
+		return pair_counts[a] > pair_counts[b];
+	});
+
+	LOG("Opcode pairs: %llu pairs run in blocks, %zu different pairs. Most run:", (unsigned long long)total, pairs.size());
+	for (int i = 0; i < count && i < (int)pairs.size(); i++) {
+		uint16_t first = pairs[i] / 512;
+		uint16_t second = pairs[i] % 512;
+
+		bool fused = false;
+		for (const OpcodePair& pair : FUSED_PAIRS) {
+			fused |= pair.first == first && pair.second == second;
+		}
+		LOG("\t{ 0x%02X, 0x%02X },\t\t//%.2f%%%s", first, second, 100.0 * pair_counts[pairs[i]] / total, fused ? " (fused)" : "");
+	}
+}
+
+bool BlockCache::has_self_modifying_code(const Block* block) {
+	if (!(block->key & RAM_KEY)) {
+		return false;
+	}
+
+	int length = 0;
+	for (const MicroOp& op : block->ops) {
+		length += op.length;
+	}
+	for (int page = block->start_pc >> 8; page <= (block->start_pc + length - 1) >> 8; page++) {
+		if (code_written[page]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void BlockCache::clear_native_code() {
+	for (auto& entry : blocks) {
+		entry.second.native_code = nullptr;
+	}
+	for (Block& block : retired) {
+		block.native_code = nullptr;
+	}
+}
+
+int64_t BlockCache::get_key(uint16_t pc) {
+	if (pc <= 0x7FFF) {
+		uint8_t* page = gb->mmu.read_page[pc >> 8];
+		if (page == nullptr) {
+			return -1;
+		}
+		return (page + (pc & 0xFF)) - gb->cart.ROM.data();
+	}
+	else if ((pc >= 0xC000 && pc <= 0xDFFF) || (pc >= 0xFF80 && pc <= 0xFFFE)) {
+		return RAM_KEY | pc;
+	}
+	return -1;
+}
+
+void BlockCache::get_region(uint16_t pc, uint16_t& start, uint16_t& end) {
+	if (pc <= 0x3FFF) {
+		start = 0x0000;
+		end = 0x3FFF;
+	}
+	else if (pc <= 0x7FFF) {
+		start = 0x4000;
+		end = 0x7FFF;
+	}
+	else if (pc >= 0xC000 && pc <= 0xDFFF) {
+		start = 0xC000;
+		end = 0xDFFF;
+	}
+	else {
+		start = 0xFF80;
+		end = 0xFFFE;
+	}
+}
+
+uint8_t BlockCache::peek(uint16_t addr) {
+	if (addr >= 0xFF80) {
+		return gb->mmu.HRAM[addr - 0xFF80];
+	}
+	return gb->mmu.read_page[addr >> 8][addr & 0xFF];
+}
+
+Block* BlockCache::decode(uint16_t pc, uint32_t key) {
+	uint16_t region_start;
+	uint16_t region_end;
+	get_region(pc, region_start, region_end);
+
+	Block block;
+	block.start_pc = pc;
+	block.key = key;
+	block.cycles = 0;
+	block.exec_count = 0;
+	block.native_code = nullptr;
+	block.jit_rejected = false;
+
+	int addr = pc;
+	while ((int)block.ops.size() < MAX_BLOCK_OPS) {
+		uint8_t opcode = peek(addr);
+		if (is_uncacheable(opcode)) {
+			break;
+		}
+
+		MicroOp op;
+		op.immediate = 0;
+		if (opcode == 0xCB) {
+			if (addr + 1 > region_end) {
+				break;
+			}
+			uint8_t CB_opcode = peek(addr + 1);
+			op.opcode = 0x100 | CB_opcode;
+			op.handler = CPU::opcode_table[op.opcode];
+			op.fetch_length = 2;
+			op.length = 2;
+			//(HL) operands take 2 extra cycles, 1 for BIT which doesn't write back
+			if ((CB_opcode & 0x7) != 6) {
+				op.cycles = 2;
+			}
+			else {
+				op.cycles = (CB_opcode >> 6) == 1 ? 3 : 4;
+			}
+		}
+		else {
+			op.length = OPCODE_LENGTH[opcode];
+			if (addr + op.length - 1 > region_end) {
+				break;
+			}
+			op.opcode = opcode;
+			op.handler = CPU::opcode_table[opcode];
+			op.fetch_length = 1;
+			op.cycles = OPCODE_CYCLES[opcode];
+			if (op.length == 2) {
+				op.immediate = peek(addr + 1);
+			}
+			else if (op.length == 3) {
+				op.immediate = peek(addr + 1) | (peek(addr + 2) << 8);
+			}
+		}
+
+		block.ops.push_back(op);
+		block.cycles += op.cycles;
+		addr += op.length;
+
+		if (ends_block(opcode) || addr > region_end) {
+			break;
+		}
+	}
+
+	if (block.ops.empty()) {
+		return nullptr;
+	}
+	block.idle_loop = IdleSkip::is_idle_loop(block);
+
+	//The second op of a pair stays in the block, the fused handler uses it for the fetch and immediate and the JIT
+	// compiles it on its own. Pairs don't overlap so the first op is never the second op of another pair
+	if (use_fusion) {
+		for (size_t i = 0; i + 1 < block.ops.size(); i++) {
+			for (size_t pair = 0; pair < FUSED_PAIR_COUNT; pair++) {
+				if (block.ops[i].opcode == FUSED_PAIRS[pair].first && block.ops[i + 1].opcode == FUSED_PAIRS[pair].second) {
+					block.ops[i].handler = CPU::fused_table[pair];
+					fused_pairs++;
+					i++;
+					break;
+				}
+			}
+		}
+	}
+
+	Block* cached = &(blocks[key] = std::move(block));
+
+	//Watch the pages the code came from for writes
+	if (key & RAM_KEY) {
+		for (int page = pc >> 8; page <= (addr - 1) >> 8; page++) {
+			page_blocks[page].push_back(key);
+			if (page < 0xE0) {
+				gb->mmu.set_code_page(page, true);
+			}
+		}
+	}
+
+	return cached;
+}
+
+void BlockCache::clear_recent() {
+	memset(recent, 0, sizeof(recent));
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include "common.h"
+#include "cpu.h"
+#include <vector>
+#include <unordered_map>
+
+//Forward declaration
+class GB;
+
+//One pre-decoded instruction
+struct MicroOp {
+	//opcode_table entry, CB opcodes point straight at the CB half of the table.
+	// The first op of a fused pair points at its fused_table entry instead, which also runs the op after it
+	CPU::OpcodeHandler handler;
+
+	//Index into opcode_table, 0x100-0x1FF for CB opcodes
+	uint16_t opcode;
+
+	//n8/n16 operand read at decode time
+	uint16_t immediate;
+
+	//Bytes fetched before the handler runs, 2 for CB opcodes
+	uint8_t fetch_length;
+
+	//Total instruction length including the immediate
+	uint8_t length;
+
+	//M-cycles when a conditional is not taken
+	uint8_t cycles;
+};
+
+//Straight-line run of instructions ending at the first branch
+struct Block {
+	uint16_t start_pc;
+
+	//Key the block is cached under, see BlockCache::get_key()
+	uint32_t key;
+
+	//Sum of the ops' M-cycles when every conditional is not taken
+	uint32_t cycles;
+
+	std::vector<MicroOp> ops;
+
+	//Times the block was looked up, the JIT compiles blocks once they get hot
+	uint32_t exec_count;
+
+	//Compiled x86-64 code, nullptr until the JIT compiles the block
+	void* native_code;
+
+	//Set when the JIT can't or shouldn't compile the block so it isn't tried again
+	bool jit_rejected;
+
+	//Polling loop that IdleSkip can fast forward
+	bool idle_loop;
+};
+
+//Cache of decoded blocks keyed by where the code physically lives, the ROM offset for cartridge code so
+// a block in one ROM bank is never confused with the same PC in another bank.
+//Only ROM, WRAM and HRAM code is cached, everything else goes through the plain interpreter.
+//WRAM pages that hold cached code have their fast write pointer removed in the MMU so writes reach
+// invalidate_write() and drop the blocks before they can run stale code.
+class BlockCache {
+public:
+	BlockCache(GB* in_gb);
+
+	//Block starting at pc, decoding it on a miss. nullptr if the code at pc can't be cached
+	Block* get_block(uint16_t pc);
+
+	//Called when the ROM banks are switched
+	void rom_banks_changed();
+
+	//Called on writes to WRAM pages holding code and on every HRAM write
+	void invalidate_write(uint16_t addr);
+
+	//Incremented whenever a running block may no longer match memory, the CPU stops a block when it changes
+	uint32_t generation;
+
+	//Log hit rate and block length statistics
+	void print_stats();
+
+	//True if the block's code is in a WRAM/HRAM page that has had cached code overwritten
+	bool has_self_modifying_code(const Block* block);
+
+	//Forget every block's compiled code, called by the JIT when it throws its code buffer away
+	void clear_native_code();
+
+	//Run FUSED_PAIRS as one handler, on by default
+	bool use_fusion;
+
+	//Count which opcode pairs run back to back in blocks to find pairs worth fusing.
+	// Turns fusion off so the counts are per opcode, call before anything runs
+	void set_pair_counting(bool enabled);
+	bool count_pairs;
+
+	void count_pair(uint16_t first, uint16_t second) {
+		pair_counts[first * 512 + second]++;
+	}
+
+	//Log the most run pairs in the same format as FUSED_PAIRS
+	void print_pair_stats(int count);
+
+	//Statistics
+	uint64_t lookups;
+	uint64_t hits;
+	uint64_t blocks_executed;
+	uint64_t ops_executed;
+	uint64_t invalidated_blocks;
+	uint64_t fused_pairs;
+
+private:
+	GB* gb;
+
+	std::unordered_map<uint32_t, Block> blocks;
+
+	//Invalidated blocks are kept until the next lookup since the CPU may still be inside one of them
+	std::vector<Block> retired;
+
+	//Direct mapped cache in front of blocks indexed by pc so most lookups skip the hash
+	static const int RECENT_SIZE = 1024;
+	Block* recent[RECENT_SIZE];
+
+	//Keys of the cached blocks overlapping each WRAM/HRAM page
+	std::vector<uint32_t> page_blocks[256];
+
+	//Pages where cached code has been written over
+	bool code_written[256];
+
+	//Times each pair ran, indexed by first * 512 + second. Only allocated while counting
+	std::vector<uint64_t> pair_counts;
+
+	//Key for the code at pc or -1 if it isn't in a cacheable region
+	int64_t get_key(uint16_t pc);
+
+	//First and last address of the region holding pc, instructions never cross a region
+	static void get_region(uint16_t pc, uint16_t& start, uint16_t& end);
+
+	//Read code byte without ticking
+	uint8_t peek(uint16_t addr);
+
+	Block* decode(uint16_t pc, uint32_t key);
+
+	void clear_recent();
+};
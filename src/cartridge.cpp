@@ -4,14 +4,52 @@
 
 Cartridge::Cartridge() {
 	mbc_num = 0;
+	mapper = &mapper_funcs<0>;
 	RAM_enabled = false;
 	has_battery = false;
 	rom_size = 0;
+	rom_bank_count = 0;
 	rom_bank_num = 1;
 	ram_size = 0;
 	ram_bank_num = 0;
 	banking_mode = 0;
 	rom_bank_extra_bit = 0;
+	update_banks();
+}
+
+Cartridge::Cartridge(const Cartridge& other) {
+	*this = other;
+}
+
+Cartridge& Cartridge::operator=(const Cartridge& other) {
+	mbc_num = other.mbc_num;
+	mapper = other.mapper;
+	banking_mode = other.banking_mode;
+	ROM = other.ROM;
+	rom_size = other.rom_size;
+	rom_bank_count = other.rom_bank_count;
+	rom_bank_num = other.rom_bank_num;
+	rom_bank_extra_bit = other.rom_bank_extra_bit;
+	RAM = other.RAM;
+	ram_size = other.ram_size;
+	ram_bank_num = other.ram_bank_num;
+	RAM_enabled = other.RAM_enabled;
+	has_battery = other.has_battery;
+	save_path = other.save_path;
+	update_banks();
+	return *this;
+}
+
+std::string Cartridge::get_title() {
+	//Up to 16 characters at 0134, newer headers reuse the end for the manufacturer code and CGB flag
+	std::string title;
+	for (uint16_t address = 0x0134; address <= 0x0143 && address < ROM.size(); address++) {
+		if (ROM[address] < 0x20 || ROM[address] > 0x7E) {
+			break;
+		}
+		title += (char)ROM[address];
+	}
+	return title;
 }
 
 bool Cartridge::load_rom(char* filepath) {
@@ -36,6 +74,11 @@ bool Cartridge::load_rom(char* filepath) {
 	}
 	file.close();
 
+	rom_bank_count = (rom_size / 1024) / 16;
+	//Pad small or odd sized ROMs to whole banks so every mapped bank is 16KB of readable memory
+	int padded_size = rom_size < 0x8000 ? 0x8000 : (rom_size + 0x3FFF) & ~0x3FFF;
+	ROM.resize(padded_size, 0xFF);
+
 	//Header checksum
 	uint8_t checksum = 0;
 	for (uint16_t address = 0x0134; address <= 0x014C; address++) {
@@ -112,6 +155,14 @@ bool Cartridge::load_rom(char* filepath) {
 		has_battery = false;
 	}
 	
+	switch (mbc_num) {
+	case 1: mapper = &mapper_funcs<1>; break;
+	case 2: mapper = &mapper_funcs<2>; break;
+	case 3: mapper = &mapper_funcs<3>; break;
+	case 5: mapper = &mapper_funcs<5>; break;
+	default: mapper = &mapper_funcs<0>; break;
+	}
+
 	//MBC2 has 512 half-bytes of RAM in the chip
 	if (mbc_num == 2) {
 		ram_size = 512;
@@ -141,6 +192,7 @@ bool Cartridge::load_rom(char* filepath) {
 		file.close();
 	}
 
+	update_banks();
 	return true;
 }
 
@@ -155,82 +207,36 @@ void Cartridge::save() {
 	file.close();
 }
 
-int Cartridge::get_rom_addr(uint16_t addr) {
-	switch (mbc_num) {
-	case 1:
-		if (addr < 0x4000) {
-			if (banking_mode == 1) {
-				//If > 5 bit bank number is not needed
-				if ((rom_size / 1024) / 16 < 32) {
-					return addr;
-				}
-				return (ram_bank_num << 19) + addr;
-			}
-			else {
-				return addr;
-			}
-		}
-		else {
-			//If > 5 bit bank number is not needed
-			if ((rom_size / 1024) / 16 < 32) {
-				return (rom_bank_num << 14) + (addr - 0x4000);
-			}
-			return (ram_bank_num << 19) + (rom_bank_num << 14) + (addr - 0x4000);
-		}
-	case 2:
-		if (addr < 0x4000) {
-			return addr;
-		}
-		else {
-			return (rom_bank_num << 14) + (addr - 0x4000);
-		}
-	case 3:
-		if (addr < 0x4000) {
-			return addr;
-		}
-		else {
-			return (rom_bank_num << 14) + (addr - 0x4000);
-		}
-	case 5:
-		if (addr < 0x4000) {
-			return addr;
-		}
-		else {
-			return (rom_bank_extra_bit << 22) + (rom_bank_num << 14) + (addr - 0x4000);
-		}
-	default:
-		return addr;
+void Cartridge::update_banks() {
+	if (ROM.empty()) {
+		rom_bank0_base = nullptr;
+		rom_bankN_base = nullptr;
+	}
+	else {
+		//Bank numbers past the end of the ROM wrap around like the unused address lines on real carts
+		int banks = ROM.size() / 0x4000;
+		rom_bank0_base = &ROM[((mapper->get_rom_addr(*this, 0x0000) / 0x4000) % banks) * 0x4000];
+		rom_bankN_base = &ROM[((mapper->get_rom_addr(*this, 0x4000) / 0x4000) % banks) * 0x4000];
 	}
-}
 
-int Cartridge::get_ram_addr(uint16_t addr) {
-	addr -= 0xA000;
-	switch (mbc_num) {
-	case 1:
-		if (banking_mode == 1) {
-			//if only one ram bank
-			if ((ram_size / 1024) / 8 == 1) {
-				return addr;
-			}
-			return (ram_bank_num << 13) + addr;
-		}
-		else {
-			return addr;
-		}
-	case 2:
-		return addr & 0x1FF;
-	case 3:
-		return (ram_bank_num << 13) + addr;
-	case 5:
-		return (ram_bank_num << 13) + addr;
-	default:
-		return addr;
+	int ram_addr = mapper->get_ram_addr(*this, 0xA000);
+	if (RAM.empty() || ram_addr < 0) {
+		ram_bank_base = nullptr;
+	}
+	else {
+		//Same for RAM, in 8KB banks. Carts with less than 8KB of RAM only have one bank
+		int bank_size = ram_size < 0x2000 ? ram_size : 0x2000;
+		int banks = ram_size / bank_size;
+		ram_bank_base = &RAM[((ram_addr / bank_size) % banks) * bank_size];
 	}
 }
 
 uint8_t Cartridge::read_ROM(uint16_t addr) {
-	if (addr < 0x8000) {
-		return ROM[get_rom_addr(addr)];
+	if (addr < 0x4000) {
+		return rom_bank0_base[addr];
+	}
+	else if (addr < 0x8000) {
+		return rom_bankN_base[addr - 0x4000];
 	}
 	else {
 		//LOG_WARN("Invalid ROM read at addr: %X", addr);
@@ -239,113 +245,17 @@ uint8_t Cartridge::read_ROM(uint16_t addr) {
 }
 
 void Cartridge::write_ROM(uint16_t addr, uint8_t byte) {
-	switch(mbc_num) {
-	case 1:
-		if (addr >= 0x0000 && addr <= 0x1FFF) {
-			if ((byte & 0xF) == 0xA) {
-				RAM_enabled = true;
-			}
-			else {
-				RAM_enabled = false;
-				save();
-			}
-		}
-		else if (addr >= 0x2000 && addr <= 0x3FFF) {
-			byte = byte & 0x1F;
-			if (byte == 0) {
-				rom_bank_num = 1;
-			}
-			else {
-				//Mask unneeded bits
-				if (byte > ((rom_size / 1024) / 16)) {
-					byte &= (1 << ((rom_size / 1024) / 16)) - 1;
-				}
-				rom_bank_num = byte;
-			}
-		}
-		else if (addr >= 0x4000 && addr <= 0x5FFF) {
-			ram_bank_num = byte & 0x03;
-		}
-		else if (addr >= 0x6000 && addr <= 0x7FFF) {
-			banking_mode = byte & 1;
-		}
-		break;
-	case 2:
-		if (addr >= 0x0000 && addr <= 0x3FFF) {
-			if ((addr >> 8) == 0) {
-				if ((byte & 0xF) == 0xA) {
-					RAM_enabled = true;
-				}
-				else {
-					RAM_enabled = false;
-					save();
-				}
-			}
-			else {
-				rom_bank_num = byte & 0xF;
-				if (rom_bank_num == 0) rom_bank_num = 1;
-			}
-		}
-		break;
-	case 3:
-		if (addr >= 0x0000 && addr <= 0x1FFF) {
-			if ((byte & 0xF) == 0xA) {
-				RAM_enabled = true;
-			}
-			else if (byte == 0){
-				RAM_enabled = false;
-				save();
-			}
-		}
-		else if (addr >= 0x2000 && addr <= 0x3FFF) {
-			rom_bank_num = byte & 0x7F;
-			if (rom_bank_num == 0) rom_bank_num = 1;
-		}
-		else if (addr >= 0x4000 && addr <= 0x5FFF) {
-			if ((byte & 0xF) > 0xC) {
-				byte = 0xC;
-				LOG_WARN("To large of a value written to RAM Bank Number, defaulting to max acceptable value");
-			}
-			ram_bank_num = byte & 0xF;
-		}
-		else if (addr >= 0x6000 && addr <= 0x7FFF) {
-			//TODO: Implement RTC registers
-			LOG_WARN("Attempted latch unimplemented RTC clock");
-		}
-		break;
-	case 5:
-		if (addr >= 0x0000 && addr <= 0x1FFF) {
-			if ((byte & 0xF) == 0xA) {
-				RAM_enabled = true;
-			}
-			else if (byte == 0) {
-				RAM_enabled = false;
-				save();
-			}
-		}
-		else if (addr >= 0x2000 && addr <= 0x2FFF) {
-			rom_bank_num = byte;
-		}
-		else if (addr >= 0x3000 && addr <= 0x3FFF) {
-			rom_bank_extra_bit = byte & 1;
-		}
-		else if (addr >= 0x4000 && addr <= 0x5FFF) {
-			ram_bank_num = byte & 0xF;
-		}
-		break;
-	default:
-		break;
-	}
+	mapper->write_ROM(*this, addr, byte);
 }
 
 uint8_t Cartridge::read_RAM(uint16_t addr) {
 	if (addr - 0xA000 < ram_size) {
 		if (RAM_enabled) {
-			if (mbc_num == 3 && ram_bank_num > 0x7) {
+			if (ram_bank_base == nullptr) {
 				LOG_WARN("Attempted read from unimplemented RTC registers, read 0x00 instead");
 				return 0x00;
 			}
-			return  RAM[get_ram_addr(addr)];
+			return ram_bank_base[addr - 0xA000];
 		}
 	}
 	//LOG_WARN("Invalid ExternalRAM read at addr: %X", addr);
@@ -355,7 +265,11 @@ uint8_t Cartridge::read_RAM(uint16_t addr) {
 
 void Cartridge::write_RAM(uint16_t addr, uint8_t byte) {
 	if (RAM_enabled && addr - 0xA000 < ram_size) {
-		RAM[get_ram_addr(addr)] = byte;
+		if (ram_bank_base == nullptr) {
+			//RTC registers unimplemented
+			return;
+		}
+		ram_bank_base[addr - 0xA000] = byte;
 	}
 	else {
 		//LOG_WARN("Invalid ExternalRAM write at addr: %X", addr);
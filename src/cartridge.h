@@ -1,4 +1,5 @@
 #include "common.h"
+#include "mapper.h"
 #include <vector>
 #include <string>
 
@@ -8,15 +9,24 @@ class Cartridge {
 
 public:
 	friend class MMU;
+	friend class BlockCache;
+	template<int MBC> friend struct Mapper;
 
 	Cartridge();
 
+	//The bank base pointers point into this cartridge's own vectors so copies have to rebind them
+	Cartridge(const Cartridge& other);
+	Cartridge& operator=(const Cartridge& other);
+
 	//Load ROM from file
 	bool load_rom(char* filename);
 
 	//Save RAM to file
 	void save();
 
+	//Title from the header, used to look up per ROM settings
+	std::string get_title();
+
 	uint8_t read_ROM(uint16_t addr);
 
 	//Writing to ROM doesnt actually write but it changes cartridge registers
@@ -26,23 +36,31 @@ public:
 	void write_RAM(uint16_t addr, uint8_t byte);
 private:	
 	int mbc_num;
+	//Bank controller for mbc_num, bound in load_rom
+	const MapperFuncs* mapper;
 	bool banking_mode;
 
 	//Vector holding the entire ROM
 	std::vector<uint8_t> ROM;
 	int rom_size;
+	//Number of 16KB banks in the ROM file
+	int rom_bank_count;
 	uint8_t rom_bank_num;
 	uint8_t rom_bank_extra_bit;
-	//Map address to rom address
-	int get_rom_addr(uint16_t addr);
 
 	//Vector for external RAM
 	std::vector<uint8_t> RAM;
 	int ram_size;
 	uint8_t ram_bank_num;
 	bool RAM_enabled;
-	//Map address to ram address
-	int get_ram_addr(uint16_t addr);
+
+	//Host pointers to the start of the currently selected banks so reads don't have to resolve the bank every access.
+	//0000-3FFF reads rom_bank0_base, 4000-7FFF reads rom_bankN_base and A000-BFFF uses ram_bank_base
+	uint8_t* rom_bank0_base;
+	uint8_t* rom_bankN_base;
+	uint8_t* ram_bank_base;
+	//Recompute the bank base pointers, called whenever a bank register or banking mode changes
+	void update_banks();
 
 	bool has_battery;
 	std::string save_path;
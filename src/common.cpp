@@ -1,27 +1,34 @@
 #include "common.h"
 
+//Where LOG, LOG_WARN and LOG_ERROR write to
+static FILE* log_stream = stdout;
+
+void set_log_stream(FILE* stream) {
+    log_stream = stream;
+}
+
 void LOG(const char* txt, ...) {
     va_list args;
     va_start(args, txt);
-    vprintf(txt, args);
+    vfprintf(log_stream, txt, args);
     va_end(args);
-    printf("\n");
+    fprintf(log_stream, "\n");
 }
 
 void LOG_WARN(const char* txt, ...) {
-    printf("WARNING: ");
+    fprintf(log_stream, "WARNING: ");
     va_list args;
     va_start(args, txt);
-    vprintf(txt, args);
+    vfprintf(log_stream, txt, args);
     va_end(args);
-    printf("\n");
+    fprintf(log_stream, "\n");
 }
 
 void LOG_ERROR(const char* txt, ...) {
-    printf("ERROR: ");
+    fprintf(log_stream, "ERROR: ");
     va_list args;
     va_start(args, txt);
-    vprintf(txt, args);
+    vfprintf(log_stream, txt, args);
     va_end(args);
-    printf("\n");
+    fprintf(log_stream, "\n");
 }
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include <cstdint>
 #include <stdarg.h>
 
+//Send log output to stream instead of stdout
+void set_log_stream(FILE* stream);
+
 void LOG(const char* txt, ...);
 
 void LOG_WARN(const char* txt, ...);
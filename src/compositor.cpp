@@ -0,0 +1,215 @@
+#include "compositor.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define COMPOSITOR_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define COMPOSITOR_X86 0
+#endif
+
+//MSVC can use any intrinsic anywhere, GCC and Clang need the functions using them marked with the instruction set
+#if COMPOSITOR_X86 && defined(__GNUC__)
+#define TARGET(isa) __attribute__((target(isa)))
+#else
+#define TARGET(isa)
+#endif
+
+static const int LINE_WIDTH = 160;
+
+//Offsets of the tables passed to the expand functions
+static const int SHADE_TABLE = 0;
+static const int RED_TABLE = 16;
+static const int GREEN_TABLE = 32;
+static const int BLUE_TABLE = 48;
+
+static void expand_scalar(const uint8_t* indices, const uint8_t* tables, uint8_t* out) {
+	for (int x = 0; x < LINE_WIDTH; x++) {
+		uint8_t shade = tables[SHADE_TABLE + indices[x]];
+		out[x * 4 + 0] = tables[RED_TABLE + shade];
+		out[x * 4 + 1] = tables[GREEN_TABLE + shade];
+		out[x * 4 + 2] = tables[BLUE_TABLE + shade];
+		out[x * 4 + 3] = 255;
+	}
+}
+
+static void index_scalar(const uint8_t* indices, const uint8_t* table, uint8_t* out) {
+	for (int x = 0; x < LINE_WIDTH; x++) {
+		out[x] = table[indices[x]];
+	}
+}
+
+#if COMPOSITOR_X86
+
+TARGET("ssse3")
+static void index_ssse3(const uint8_t* indices, const uint8_t* table, uint8_t* out) {
+	__m128i lookup = _mm_loadu_si128((const __m128i*)table);
+	for (int x = 0; x < LINE_WIDTH; x += 16) {
+		__m128i line = _mm_loadu_si128((const __m128i*)(indices + x));
+		_mm_storeu_si128((__m128i*)(out + x), _mm_shuffle_epi8(lookup, line));
+	}
+}
+
+TARGET("avx2")
+static void index_avx2(const uint8_t* indices, const uint8_t* table, uint8_t* out) {
+	__m256i lookup = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)table));
+	for (int x = 0; x < LINE_WIDTH; x += 32) {
+		__m256i line = _mm256_loadu_si256((const __m256i*)(indices + x));
+		_mm256_storeu_si256((__m256i*)(out + x), _mm256_shuffle_epi8(lookup, line));
+	}
+}
+
+TARGET("ssse3")
+static void expand_ssse3(const uint8_t* indices, const uint8_t* tables, uint8_t* out) {
+	__m128i shades = _mm_loadu_si128((const __m128i*)(tables + SHADE_TABLE));
+	__m128i reds = _mm_loadu_si128((const __m128i*)(tables + RED_TABLE));
+	__m128i greens = _mm_loadu_si128((const __m128i*)(tables + GREEN_TABLE));
+	__m128i blues = _mm_loadu_si128((const __m128i*)(tables + BLUE_TABLE));
+	__m128i alpha = _mm_set1_epi8((char)255);
+
+	for (int x = 0; x < LINE_WIDTH; x += 16) {
+		__m128i shade = _mm_shuffle_epi8(shades, _mm_loadu_si128((const __m128i*)(indices + x)));
+		__m128i r = _mm_shuffle_epi8(reds, shade);
+		__m128i g = _mm_shuffle_epi8(greens, shade);
+		__m128i b = _mm_shuffle_epi8(blues, shade);
+
+		//RGRG.. and BABA.. then RGBA, 4 pixels per store
+		__m128i rg_low = _mm_unpacklo_epi8(r, g);
+		__m128i rg_high = _mm_unpackhi_epi8(r, g);
+		__m128i ba_low = _mm_unpacklo_epi8(b, alpha);
+		__m128i ba_high = _mm_unpackhi_epi8(b, alpha);
+		__m128i* pixels = (__m128i*)(out + x * 4);
+		_mm_storeu_si128(pixels + 0, _mm_unpacklo_epi16(rg_low, ba_low));
+		_mm_storeu_si128(pixels + 1, _mm_unpackhi_epi16(rg_low, ba_low));
+		_mm_storeu_si128(pixels + 2, _mm_unpacklo_epi16(rg_high, ba_high));
+		_mm_storeu_si128(pixels + 3, _mm_unpackhi_epi16(rg_high, ba_high));
+	}
+}
+
+TARGET("avx2")
+static void expand_avx2(const uint8_t* indices, const uint8_t* tables, uint8_t* out) {
+	//Shuffles only look up within each 128 bit lane, so both lanes get a copy of every table
+	__m256i shades = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(tables + SHADE_TABLE)));
+	__m256i reds = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(tables + RED_TABLE)));
+	__m256i greens = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(tables + GREEN_TABLE)));
+	__m256i blues = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(tables + BLUE_TABLE)));
+	__m256i alpha = _mm256_set1_epi8((char)255);
+
+	for (int x = 0; x < LINE_WIDTH; x += 32) {
+		__m256i shade = _mm256_shuffle_epi8(shades, _mm256_loadu_si256((const __m256i*)(indices + x)));
+		__m256i r = _mm256_shuffle_epi8(reds, shade);
+		__m256i g = _mm256_shuffle_epi8(greens, shade);
+		__m256i b = _mm256_shuffle_epi8(blues, shade);
+
+		//Unpacks also stay within lanes, the low lane has pixels 0-15 and the high lane 16-31
+		__m256i rg_low = _mm256_unpacklo_epi8(r, g);
+		__m256i rg_high = _mm256_unpackhi_epi8(r, g);
+		__m256i ba_low = _mm256_unpacklo_epi8(b, alpha);
+		__m256i ba_high = _mm256_unpackhi_epi8(b, alpha);
+		__m256i pixels0 = _mm256_unpacklo_epi16(rg_low, ba_low);
+		__m256i pixels4 = _mm256_unpackhi_epi16(rg_low, ba_low);
+		__m256i pixels8 = _mm256_unpacklo_epi16(rg_high, ba_high);
+		__m256i pixels12 = _mm256_unpackhi_epi16(rg_high, ba_high);
+
+		//Put the lanes back in pixel order, 8 pixels per store
+		__m256i* pixels = (__m256i*)(out + x * 4);
+		_mm256_storeu_si256(pixels + 0, _mm256_permute2x128_si256(pixels0, pixels4, 0x20));
+		_mm256_storeu_si256(pixels + 1, _mm256_permute2x128_si256(pixels8, pixels12, 0x20));
+		_mm256_storeu_si256(pixels + 2, _mm256_permute2x128_si256(pixels0, pixels4, 0x31));
+		_mm256_storeu_si256(pixels + 3, _mm256_permute2x128_si256(pixels8, pixels12, 0x31));
+	}
+}
+
+#endif
+
+Compositor::Compositor() {
+	level = Level::Scalar;
+	expand = expand_scalar;
+	index = index_scalar;
+	set_level(detect());
+}
+
+Compositor::Level Compositor::detect() {
+#if COMPOSITOR_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+	__cpuid(info, 1);
+	bool ssse3 = (info[2] >> 9) & 1;
+	//AVX state has to be enabled by the OS as well as supported by the CPU
+	bool os_avx = ((info[2] >> 27) & 1) && ((info[2] >> 28) & 1) && (_xgetbv(0) & 0x6) == 0x6;
+	bool avx2 = false;
+	if (max_leaf >= 7 && os_avx) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] >> 5) & 1;
+	}
+#else
+	__builtin_cpu_init();
+	bool ssse3 = __builtin_cpu_supports("ssse3");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+	if (avx2) {
+		return Level::AVX2;
+	}
+	if (ssse3) {
+		return Level::SSSE3;
+	}
+#endif
+	return Level::Scalar;
+}
+
+bool Compositor::set_level(Level in_level) {
+	if ((int)in_level > (int)detect()) {
+		return false;
+	}
+
+	level = in_level;
+	switch (level) {
+#if COMPOSITOR_X86
+	case Level::AVX2:
+		expand = expand_avx2;
+		index = index_avx2;
+		break;
+	case Level::SSSE3:
+		expand = expand_ssse3;
+		index = index_ssse3;
+		break;
+#endif
+	default:
+		expand = expand_scalar;
+		index = index_scalar;
+		break;
+	}
+	return true;
+}
+
+void Compositor::shade_table(uint8_t bg_palette, uint8_t obj_palette0, uint8_t obj_palette1, uint8_t* table) {
+	//LINE_RAW goes through the identity palette
+	const uint8_t palettes[4] = { bg_palette, obj_palette0, obj_palette1, 0b11100100 };
+	for (int i = 0; i < 16; i++) {
+		table[i] = (palettes[i >> 2] >> ((i & 3) * 2)) & 0b11;
+	}
+}
+
+void Compositor::expand_line(const uint8_t* indices, uint8_t bg_palette, uint8_t obj_palette0, uint8_t obj_palette1, uint8_t* out) {
+	alignas(16) uint8_t tables[64] = {};
+	shade_table(bg_palette, obj_palette0, obj_palette1, tables + SHADE_TABLE);
+	for (int shade = 0; shade < 4; shade++) {
+		tables[RED_TABLE + shade] = SHADE_COLORS[shade][0];
+		tables[GREEN_TABLE + shade] = SHADE_COLORS[shade][1];
+		tables[BLUE_TABLE + shade] = SHADE_COLORS[shade][2];
+	}
+	expand(indices, tables, out);
+}
+
+void Compositor::index_line(const uint8_t* indices, uint8_t bg_palette, uint8_t obj_palette0, uint8_t obj_palette1, uint8_t* out) {
+	alignas(16) uint8_t table[16];
+	shade_table(bg_palette, obj_palette0, obj_palette1, table);
+	for (int i = 0; i < 16; i++) {
+		table[i] |= i & 0b1100;
+	}
+	index(indices, table, out);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "common.h"
+
+//Pixels on a composed scanline are a palette index: the color id in bits 0-1 and the palette it goes through in bits 2-3
+const uint8_t LINE_BG = 0 << 2;
+const uint8_t LINE_OBP0 = 1 << 2;
+const uint8_t LINE_OBP1 = 2 << 2;
+//Color id is the shade, for pixels no palette applies to such as the background while it's disabled
+const uint8_t LINE_RAW = 3 << 2;
+
+//RGB of the 4 shades, lightest first
+const uint8_t SHADE_COLORS[4][3] = {
+	{ 155, 188, 15 },
+	{ 139, 172, 15 },
+	{ 48, 98, 48 },
+	{ 15, 56, 15 }
+};
+
+//Expands a composed scanline of palette indices into RGBA pixels.
+//Each line builds a 16 entry table from BGP, OBP0 and OBP1 that maps a palette index to its shade. The SIMD versions
+// look up 16 or 32 pixels at once with byte shuffles, first the shade and then each color channel of it, and
+// interleave the channels into RGBA. SSE2 has no byte shuffle so the SSE version needs SSSE3.
+//index_line() is the same lookup for indexed output, it only replaces the color id with the shade and keeps the palette bits.
+//The fastest version the host supports is picked when the Compositor is created.
+class Compositor {
+public:
+	enum class Level {
+		Scalar,
+		SSSE3,
+		AVX2
+	};
+
+	Compositor();
+
+	//Best level this host supports
+	static Level detect();
+
+	//Switch to level, returns false and keeps the current one if the host doesn't support it
+	bool set_level(Level in_level);
+
+	Level get_level() { return level; }
+
+	//Map 160 palette indices through the palettes into 160 RGBA pixels at out
+	void expand_line(const uint8_t* indices, uint8_t bg_palette, uint8_t obj_palette0, uint8_t obj_palette1, uint8_t* out);
+
+	//Map 160 palette indices to 160 bytes of PixelFormat::Indexed8, the shade with the palette bits kept
+	void index_line(const uint8_t* indices, uint8_t bg_palette, uint8_t obj_palette0, uint8_t obj_palette1, uint8_t* out);
+
+private:
+	Level level;
+
+	//Shade of every palette index followed by 16 bytes each of the red, green and blue of the 4 shades
+	typedef void (*ExpandFunction)(const uint8_t* indices, const uint8_t* tables, uint8_t* out);
+	ExpandFunction expand;
+
+	//Looks up each palette index in a 16 byte table
+	typedef void (*IndexFunction)(const uint8_t* indices, const uint8_t* table, uint8_t* out);
+	IndexFunction index;
+
+	//Shade of every palette index, for the 4 palettes in the index's bits 2-3
+	static void shade_table(uint8_t bg_palette, uint8_t obj_palette0, uint8_t obj_palette1, uint8_t* table);
+};
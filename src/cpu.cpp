@@ -1,44 +1,39 @@
 #include "cpu.h"
 #include "gb.h"
 
-uint16_t ByteRegisterPair::get_word() {
-	return (high << 8) | low;
-}
-
-void ByteRegisterPair::set_word(uint16_t value) {
-	low = value & 0xFF;
-	high = (value >> 8) & 0xFF;
-}
-
-uint16_t WordRegister::get_word() {
-	return word;
-}
-
-void WordRegister::set_word(uint16_t value) {
-	word = value;
-}
-
 CPU::CPU(GB* in_gb) :
 	gb(in_gb)
 {
-    AF.high = 1;
-	AF.low = 0;
+	flag_op = FlagOp::None;
+	flag_a = 0;
+	flag_b = 0;
+	flag_result = 0;
+	flag_carry = false;
+    regs.AF.high = 1;
+	regs.AF.low = 0;
     set_flag(Z, 1);
     set_flag(H, 1);
     set_flag(C, 1);
-	BC.high = 0;
-	BC.low = 0x13;
-	DE.high = 0;
-	DE.low = 0xD8;
-	HL.high = 1;
-	HL.low = 0x4D;
-	SP.word = 0xFFFE;
-	PC = 0x100;
+	regs.BC.high = 0;
+	regs.BC.low = 0x13;
+	regs.DE.high = 0;
+	regs.DE.low = 0xD8;
+	regs.HL.high = 1;
+	regs.HL.low = 0x4D;
+	regs.SP.word = 0xFFFE;
+	regs.PC = 0x100;
 	ei_scheduled = 0;
 	interrupt_master_enable = 0;
 	interrupt_enable = 0;
 	interrupt_flag = 0xE1;
 	halted = false;
+	halt_bug = false;
+	use_block_cache = true;
+	use_jit = false;
+	current_op = nullptr;
+	block_generation = 0;
+	instructions = 0;
+	halted_cycles = 0;
 }
 
 void CPU::tick() {
@@ -89,64 +84,229 @@ void CPU::tick() {
     }
 
 	if (!halted) {
-		//Read the byte at PC, Increment PC, then exectute the opcode it refers to
-		execute_opcode(gb->mmu.read(PC++));
+		if (halt_bug) {
+			//Byte after HALT is read without incrementing PC so it runs twice
+			halt_bug = false;
+			dispatch_opcode(gb->mmu.read(regs.PC));
+		}
+		else if (use_block_cache) {
+			run_block();
+		}
+		else {
+			//Read the byte at PC, Increment PC, then exectute the opcode it refers to
+			dispatch_opcode(gb->mmu.read(regs.PC++));
+		}
 	}
 	else {
+		//Only scheduled events can request an interrupt while halted,
+		// so jump to the M-cycle where the next one runs instead of ticking up to it
+		uint64_t halt_start = gb->t_cycle_count;
+		gb->skip_to_next_event();
         gb->tick_other_components();
-        if ((interrupt_enable & interrupt_flag) != 0) {
+		halted_cycles += gb->t_cycle_count - halt_start;
+        if ((interrupt_enable & interrupt_flag & 0x1F) != 0) {
             halted = false;
-            //TODO: Implement the halt bug https://gbdev.io/pandocs/halt.html#halt-bug
         }
 	}
+
+	//Anything outside the CPU can read F once the tick is done
+	if (flag_op != FlagOp::None) {
+		materialize_flags();
+	}
+}
+
+void CPU::run_block() {
+	BlockCache& cache = gb->block_cache;
+	Block* block = cache.get_block(regs.PC);
+	if (block == nullptr) {
+		dispatch_opcode(gb->mmu.read(regs.PC++));
+		return;
+	}
+
+	uint64_t start_time = gb->t_cycle_count;
+	//A write in the block can invalidate it, which frees the Block. Its ops stay alive until the next get_block()
+	// but the Block itself is only used again after running if the cache generation shows it wasn't touched
+	bool idle_loop = block->idle_loop;
+	block_generation = cache.generation;
+	if (use_jit && gb->jit.run(*this, block)) {
+		cache.blocks_executed++;
+		if (idle_loop && cache.generation == block_generation) {
+			gb->idle_skip.after_block(*this, block, start_time);
+		}
+		return;
+	}
+
+	const MicroOp* begin = block->ops.data();
+	const MicroOp* op = begin;
+	const MicroOp* end = op + block->ops.size();
+
+	for (; op != end; op++) {
+		if (cache.count_pairs && op != begin) {
+			cache.count_pair(op[-1].opcode, op->opcode);
+		}
+
+		//Opcode fetch, the bytes were already decoded so only the cycles are spent
+		for (int i = 0; i < op->fetch_length; i++) {
+			gb->tick_other_components();
+		}
+		regs.PC += op->fetch_length;
+
+		current_op = op;
+		op->handler(*this);
+
+		//A fused handler leaves current_op at the last op it ran
+		cache.ops_executed += current_op - op + 1;
+		op = current_op;
+
+		//Hand control back to tick() whenever it has work between instructions
+		if (block_exit_pending()) {
+			break;
+		}
+	}
+
+	current_op = nullptr;
+	cache.blocks_executed++;
+
+	if (idle_loop && cache.generation == block_generation) {
+		gb->idle_skip.after_block(*this, block, start_time);
+	}
+}
+
+bool CPU::block_exit_pending() {
+	if (halted || ei_scheduled || gb->ppu.frame_done || gb->block_cache.generation != block_generation) {
+		return true;
+	}
+	return interrupt_master_enable && (interrupt_enable & interrupt_flag & 0x1F) != 0;
 }
 
 void CPU::set_flag(Flag flag, bool value) {
+	//The other flags have to be in F before one of them is changed
+	if (flag_op != FlagOp::None) {
+		materialize_flags();
+	}
 	if (value) {
-		AF.low |= flag;
+		regs.AF.low |= flag;
 	}
 	else {
-		AF.low &= ~flag;
+		regs.AF.low &= ~flag;
 	}
 }
 
 bool CPU::get_flag(Flag flag) {
-	return AF.low & flag;
+	if (flag_op != FlagOp::None) {
+		materialize_flags();
+	}
+	return regs.AF.low & flag;
+}
+
+void CPU::materialize_flags() {
+	uint8_t result = flag_result & 0xFF;
+	uint8_t flags = result == 0 ? Z : 0;
+
+	switch (flag_op) {
+	case FlagOp::None:
+		return;
+	case FlagOp::Add:
+	case FlagOp::Sub:
+		//Half carry is the carry into bit 4, bit 4 of a ^ b ^ result. Carry is bit 8 of the result
+		if ((flag_a ^ flag_b ^ flag_result) & 0x10) {
+			flags |= H;
+		}
+		if (flag_result & 0x100) {
+			flags |= C;
+		}
+		if (flag_op == FlagOp::Sub) {
+			flags |= N;
+		}
+		break;
+	case FlagOp::And:
+		flags |= H;
+		break;
+	case FlagOp::Or:
+		break;
+	case FlagOp::Inc:
+		if ((result & 0xF) == 0) {
+			flags |= H;
+		}
+		if (flag_carry) {
+			flags |= C;
+		}
+		break;
+	case FlagOp::Dec:
+		flags |= N;
+		if ((result & 0xF) == 0xF) {
+			flags |= H;
+		}
+		if (flag_carry) {
+			flags |= C;
+		}
+		break;
+	case FlagOp::Shift:
+		if (flag_result & 0x100) {
+			flags |= C;
+		}
+		break;
+	case FlagOp::ShiftA:
+		flags = (flag_result & 0x100) ? C : 0;
+		break;
+	case FlagOp::Bit:
+		flags |= H;
+		if (flag_carry) {
+			flags |= C;
+		}
+		break;
+	}
+
+	regs.AF.low = flags | (regs.AF.low & 0x0F);
+	flag_op = FlagOp::None;
+}
+
+bool CPU::carry_flag() {
+	switch (flag_op) {
+	case FlagOp::Add:
+	case FlagOp::Sub:
+	case FlagOp::Shift:
+	case FlagOp::ShiftA:
+		return flag_result & 0x100;
+	case FlagOp::And:
+	case FlagOp::Or:
+		return false;
+	case FlagOp::Inc:
+	case FlagOp::Dec:
+	case FlagOp::Bit:
+		return flag_carry;
+	default:
+		return regs.AF.low & C;
+	}
 }
 
 void CPU::ADC(uint8_t operand) {
-	uint16_t result = AF.high + operand + get_flag(C);
+	uint16_t result = regs.AF.high + operand + carry_flag();
 
-	set_flag(Z, (result & 0xFF) == 0);
-	set_flag(N,0);
-	set_flag(H, (((AF.high & 0xF) + (operand & 0xF) + get_flag(C)) & 0x10) == 0x10);
-	set_flag(C, result > 0xFF);
+	lazy_flags(FlagOp::Add, regs.AF.high, operand, result);
 
-	AF.high = result & 0xFF;
+	regs.AF.high = result & 0xFF;
 }
 
 void CPU::ADD(uint8_t operand) {
-	uint16_t result = AF.high + operand;
+	uint16_t result = regs.AF.high + operand;
 	
-	set_flag(Z, (result & 0xFF) == 0);
-	set_flag(N, 0);
-	set_flag(H, (((AF.high & 0xF) + (operand & 0xF)) & 0x10) == 0x10);
-	set_flag(C, result > 0xFF);
+	lazy_flags(FlagOp::Add, regs.AF.high, operand, result);
 
-	AF.high = result & 0xFF;
+	regs.AF.high = result & 0xFF;
 }
 
-void CPU::ADD(Register& dest, uint16_t operand) {
+void CPU::ADD(RegisterPair& dest, uint16_t operand) {
 	//Extra Cycle
 	gb->tick_other_components();
 
-	uint32_t result = dest.get_word() + operand;
+	uint32_t result = dest.word + operand;
 	
 	set_flag(N, 0);
-	set_flag(H, (((dest.get_word() & 0xFFF) + (operand & 0xFFF)) & 0x1000) == 0x1000);
+	set_flag(H, (((dest.word & 0xFFF) + (operand & 0xFFF)) & 0x1000) == 0x1000);
 	set_flag(C, result > 0xFFFF);
 
-	dest.set_word(result & 0xFFFF);
+	dest.word = result & 0xFFFF;
 }
 
 void CPU::ADD_SP_E8(int8_t operand) {
@@ -155,43 +315,39 @@ void CPU::ADD_SP_E8(int8_t operand) {
 	//Extra Cycle
 	gb->tick_other_components();
 
-    int result = SP.get_word() + operand;
+    int result = regs.SP.word + operand;
 
     set_flag(Z, 0);
     set_flag(N, 0);
-    set_flag(H,((SP.get_word() ^ operand ^ (result & 0xFFFF)) & 0x10) == 0x10);
-    set_flag(C,((SP.get_word() ^ operand ^ (result & 0xFFFF)) & 0x100) == 0x100);
+    set_flag(H,((regs.SP.word ^ operand ^ (result & 0xFFFF)) & 0x10) == 0x10);
+    set_flag(C,((regs.SP.word ^ operand ^ (result & 0xFFFF)) & 0x100) == 0x100);
 
-    SP.set_word((uint16_t)result);
+    regs.SP.word = (uint16_t)result;
 }
 
 void CPU::AND(uint8_t operand) {
-	AF.high &= operand;
+	regs.AF.high &= operand;
 
-	set_flag(Z, AF.high == 0);
-	set_flag(N, 0);
-	set_flag(H, 1);
-	set_flag(C, 0);
+	lazy_flags(FlagOp::And, 0, 0, regs.AF.high);
 }
 
 void CPU::BIT(uint8_t bit_idx, uint8_t operand) {
-    set_flag(Z, ((operand >> bit_idx) & 1) == 0);
-	set_flag(N, 0);
-	set_flag(H, 1);
+	flag_carry = carry_flag();
+	lazy_flags(FlagOp::Bit, 0, 0, operand & (1 << bit_idx));
 }
 
 void CPU::CALL(uint16_t addr) {
 	//Extra cycle
 	gb->tick_other_components();
 	//Push high byte of addr
-	gb->mmu.write(SP.word - 1, (PC >> 8) & 0xFF);
+	gb->mmu.write(regs.SP.word - 1, (regs.PC >> 8) & 0xFF);
 	//Push low byte of addr
-	gb->mmu.write(SP.word - 2, PC & 0xFF);
+	gb->mmu.write(regs.SP.word - 2, regs.PC & 0xFF);
 	//Decrement SP
-	SP.word -= 2;
+	regs.SP.word -= 2;
 	
 	//JP addr
-	PC = addr;
+	regs.PC = addr;
 }
 
 void CPU::CCF() {
@@ -201,16 +357,14 @@ void CPU::CCF() {
 }
 
 void CPU::CP(uint8_t operand) {
-	uint8_t result = AF.high - operand;
+	//A borrow sets bit 8 of the result
+	uint16_t result = regs.AF.high - operand;
 
-	set_flag(Z, result == 0);
-	set_flag(N, 1);
-	set_flag(H, (((AF.high & 0xF) - (operand & 0xF)) & 0x10) == 0x10);
-	set_flag(C, operand > AF.high);
+	lazy_flags(FlagOp::Sub, regs.AF.high, operand, result);
 }
 
 void CPU::CPL() {
-	AF.high = ~AF.high;
+	regs.AF.high = ~regs.AF.high;
 	set_flag(N, 1);
 	set_flag(H, 1);
 }
@@ -225,43 +379,41 @@ void CPU::DAA() {
 		if (get_flag(C)) {
 			adjustment += 0x60;
 		}
-		AF.high -= adjustment;
+		regs.AF.high -= adjustment;
 	}
 	else {
-		if (get_flag(H) || ((AF.high & 0xF) > 0x9)) {
+		if (get_flag(H) || ((regs.AF.high & 0xF) > 0x9)) {
 			adjustment += 0x6;
 		}
 
-		if (get_flag(C) || (AF.high > 0x99)) {
+		if (get_flag(C) || (regs.AF.high > 0x99)) {
 			adjustment += 0x60;
 			set_flag(C, 1);
 		}
-		AF.high += adjustment;
+		regs.AF.high += adjustment;
 	}
-	set_flag(Z, AF.high == 0);
+	set_flag(Z, regs.AF.high == 0);
 	set_flag(H, 0);
 }
 
 void CPU::DEC(uint8_t& dest) {
+	flag_carry = carry_flag();
 	dest--;
-	set_flag(Z, dest == 0);
-	set_flag(N, 1);
-    set_flag(H, ((((dest + 1) & 0xF) - 1) & 0x10) == 0x10);
+	lazy_flags(FlagOp::Dec, 0, 0, dest);
 }
 
-void CPU::DEC(Register& dest) {
+void CPU::DEC(RegisterPair& dest) {
 	//Extra cycle
 	gb->tick_other_components();
 
-	dest.set_word(dest.get_word() - 1);
+	dest.word--;
 }
 
 void CPU::DEC_mem(uint16_t addr) {
     uint8_t new_val = gb->mmu.read(addr) - 1;
     gb->mmu.write(addr, new_val);
-    set_flag(Z, new_val == 0);
-    set_flag(N, 1);
-    set_flag(H, ((((new_val + 1) & 0xF) - 1) & 0x10) == 0x10);
+    flag_carry = carry_flag();
+    lazy_flags(FlagOp::Dec, 0, 0, new_val);
 }
 
 void CPU::DI() {
@@ -273,69 +425,74 @@ void CPU::EI() {
 }
 
 void CPU::HALT() {
-	halted = true;
+	//With IME off and an interrupt already pending the CPU doesn't halt and hits the halt bug instead
+	// https://gbdev.io/pandocs/halt.html#halt-bug
+	if (!interrupt_master_enable && (interrupt_enable & interrupt_flag & 0x1F) != 0) {
+		halt_bug = true;
+	}
+	else {
+		halted = true;
+	}
 }
 
 void CPU::INC(uint8_t& dest) {
+	flag_carry = carry_flag();
 	dest++;
-	set_flag(Z, dest == 0);
-	set_flag(N, 0);
-    set_flag(H, ((((dest - 1) & 0xF) + 1) & 0x10) == 0x10);
+	lazy_flags(FlagOp::Inc, 0, 0, dest);
 }
 
-void CPU::INC(Register& dest) {
+void CPU::INC(RegisterPair& dest) {
 	//Extra cycle
 	gb->tick_other_components();
 
-	dest.set_word(dest.get_word() + 1);
+	dest.word++;
 }
 
 void CPU::INC_mem(uint16_t addr) {
     uint8_t new_val = gb->mmu.read(addr) + 1;
     gb->mmu.write(addr, new_val);
-    set_flag(Z, new_val == 0);
-    set_flag(N, 0);
-    set_flag(H, ((((new_val - 1) & 0xF) + 1) & 0x10) == 0x10);
+    flag_carry = carry_flag();
+    lazy_flags(FlagOp::Inc, 0, 0, new_val);
 }
 
 void CPU::JP(uint16_t addr) {
 	//Extra cycle
 	gb->tick_other_components();
 
-	PC = addr;
+	regs.PC = addr;
 }
 
 void CPU::JP_HL() {
-	PC = HL.get_word();
+	regs.PC = regs.HL.word;
 }
 
 void CPU::JR(int8_t offset) {
 	//Extra Cycles
 	gb->tick_other_components();
 
-	PC = PC + offset;
+	regs.PC = regs.PC + offset;
 }
 
 void CPU::LD(uint8_t& dest, uint8_t operand) {
 	dest = operand;
 }
 
-void CPU::LD(Register& dest, uint16_t operand) {
-	dest.set_word(operand);
+void CPU::LD(RegisterPair& dest, uint16_t operand) {
+	dest.word = operand;
 }
 
 void CPU::LD_HL_SP_E8(int8_t operand) {
     //Extra Cycle
     gb->tick_other_components();
 
-    int result = SP.get_word() + operand;
+    int result = regs.SP.word + operand;
 
     set_flag(Z, 0);
     set_flag(N, 0);
-    set_flag(H, ((SP.get_word() ^ operand ^ (result & 0xFFFF)) & 0x10) == 0x10);
-    set_flag(C, ((SP.get_word() ^ operand ^ (result & 0xFFFF)) & 0x100) == 0x100);
+    set_flag(H, ((regs.SP.word ^ operand ^ (result & 0xFFFF)) & 0x10) == 0x10);
+    set_flag(C, ((regs.SP.word ^ operand ^ (result & 0xFFFF)) & 0x100) == 0x100);
 
-    HL.set_word((uint16_t)result);
+    regs.HL.word = (uint16_t)result;
 }
 
 void CPU::LD_mem(uint16_t addr, uint8_t operand) {
@@ -343,61 +500,63 @@ void CPU::LD_mem(uint16_t addr, uint8_t operand) {
 }
 
 void CPU::LD_n16_SP(uint16_t addr) {
-	gb->mmu.write(addr, SP.word & 0xFF);
-	gb->mmu.write(addr + 1, SP.word >> 8);
+	gb->mmu.write(addr, regs.SP.word & 0xFF);
+	gb->mmu.write(addr + 1, regs.SP.word >> 8);
 }
 
 void CPU::LD_HLI(uint8_t& dest, uint8_t operand) {
 	dest = operand;
-	HL.set_word(HL.get_word() + 1);
+	regs.HL.word++;
 }
 
 void CPU::LD_HLI_mem(uint16_t addr, uint8_t operand) {
     gb->mmu.write(addr, operand);
-    HL.set_word(HL.get_word() + 1);
+    regs.HL.word++;
 }
 
 void CPU::LD_HLD(uint8_t& dest, uint8_t operand) {
 	dest = operand;
-	HL.set_word(HL.get_word() - 1);
+	regs.HL.word--;
 }
 
 void CPU::LD_HLD_mem(uint16_t addr, uint8_t operand) {
     gb->mmu.write(addr, operand);
-    HL.set_word(HL.get_word() - 1);
+    regs.HL.word--;
 }
 
 void CPU::NOP() {}
 
 void CPU::OR(uint8_t operand) {
-	AF.high = AF.high | operand;
+	regs.AF.high = regs.AF.high | operand;
 
-	set_flag(Z, AF.high == 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
-	set_flag(C, 0);
+	lazy_flags(FlagOp::Or, 0, 0, regs.AF.high);
 }
 
-void CPU::POP(Register& dest) {
+void CPU::POP(RegisterPair& dest) {
 	uint16_t popped_addr = 0;
-	popped_addr =  (gb->mmu.read(SP.word + 1) << 8) | gb->mmu.read(SP.word);
-	dest.set_word(popped_addr);
-	SP.word += 2;
-
-	if (&dest == &AF) {
-        AF.low &= 0b11110000;
+	popped_addr =  (gb->mmu.read(regs.SP.word + 1) << 8) | gb->mmu.read(regs.SP.word);
+	dest.word = popped_addr;
+	regs.SP.word += 2;
+
+	if (&dest == &regs.AF) {
+        regs.AF.low &= 0b11110000;
+		//The popped F replaces the flags of the last op
+		flag_op = FlagOp::None;
     }
 }
 
-void CPU::PUSH(ByteRegisterPair& reg) {
+void CPU::PUSH(RegisterPair& reg) {
+	if (&reg == &regs.AF && flag_op != FlagOp::None) {
+		materialize_flags();
+	}
 	//Extra cycle
 	gb->tick_other_components();
 	//Push high byte
-	gb->mmu.write(SP.word - 1, reg.high);
+	gb->mmu.write(regs.SP.word - 1, reg.high);
 	//Push low byte
-	gb->mmu.write(SP.word - 2, reg.low);
+	gb->mmu.write(regs.SP.word - 2, reg.low);
 	//Decrement SP
-	SP.word -= 2;
+	regs.SP.word -= 2;
 }
 
 void CPU::RES(uint8_t bit_idx, uint8_t& dest) {
@@ -414,8 +573,8 @@ void CPU::RET() {
 	//Extra Cycle
 	gb->tick_other_components();
 
-	PC = (gb->mmu.read(SP.word + 1) << 8) | gb->mmu.read(SP.word);
-	SP.word += 2;
+	regs.PC = (gb->mmu.read(regs.SP.word + 1) << 8) | gb->mmu.read(regs.SP.word);
+	regs.SP.word += 2;
 }
 
 void CPU::RETI() {
@@ -424,125 +583,91 @@ void CPU::RETI() {
 }
 
 void CPU::RL(uint8_t& operand) {
-	bool temp_C = get_flag(C);
-	set_flag(C, operand >> 7);
-	operand = (operand << 1) | temp_C;
+	uint16_t result = (operand << 1) | carry_flag();
+	operand = result & 0xFF;
 
-	set_flag(Z, operand == 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
+	lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::RL_mem(uint16_t addr) {
     uint8_t operand = gb->mmu.read(addr);
-    bool temp_C = get_flag(C);
-    set_flag(C, operand >> 7);
-    operand = (operand << 1) | temp_C;
-    gb->mmu.write(addr, operand);
+    uint16_t result = (operand << 1) | carry_flag();
+    gb->mmu.write(addr, result & 0xFF);
 
-    set_flag(Z, operand == 0);
-    set_flag(N, 0);
-    set_flag(H, 0);
+    lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::RLA() {
-	bool temp_C = get_flag(C);
-	set_flag(C, AF.high >> 7);
-	AF.high = (AF.high << 1) | temp_C;
+	uint16_t result = (regs.AF.high << 1) | carry_flag();
+	regs.AF.high = result & 0xFF;
 
-	set_flag(Z, 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
+	lazy_flags(FlagOp::ShiftA, 0, 0, result);
 }
 
 void CPU::RLC(uint8_t& operand) {
-	set_flag(C, operand >> 7);
-	operand = (operand << 1) | get_flag(C);
+	uint16_t result = (operand << 1) | (operand >> 7);
+	operand = result & 0xFF;
 
-	set_flag(Z, operand == 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
+	lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::RLC_mem(uint16_t addr) {
     uint8_t operand = gb->mmu.read(addr);
-    set_flag(C, operand >> 7);
-    operand = (operand << 1) | get_flag(C);
-    gb->mmu.write(addr, operand);
+    uint16_t result = (operand << 1) | (operand >> 7);
+    gb->mmu.write(addr, result & 0xFF);
 
-    set_flag(Z, operand == 0);
-    set_flag(N, 0);
-    set_flag(H, 0);
+    lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::RLCA() {
-	set_flag(C, AF.high >> 7);
-	AF.high = (AF.high << 1) | get_flag(C);
+	uint16_t result = (regs.AF.high << 1) | (regs.AF.high >> 7);
+	regs.AF.high = result & 0xFF;
 
-	set_flag(Z, 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
+	lazy_flags(FlagOp::ShiftA, 0, 0, result);
 }
 
 void CPU::RR(uint8_t& operand) {
-	bool temp_C = get_flag(C);
-	set_flag(C, operand & 1);
-	operand = (operand >> 1) | (temp_C << 7);
+	uint16_t result = (operand >> 1) | (carry_flag() << 7) | ((operand & 1) << 8);
+	operand = result & 0xFF;
 
-	set_flag(Z, operand == 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
+	lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::RR_mem(uint16_t addr) {
     uint8_t operand = gb->mmu.read(addr);
-    bool temp_C = get_flag(C);
-    set_flag(C, operand & 1);
-    operand = (operand >> 1) | (temp_C << 7);
-    gb->mmu.write(addr, operand);
+    uint16_t result = (operand >> 1) | (carry_flag() << 7) | ((operand & 1) << 8);
+    gb->mmu.write(addr, result & 0xFF);
 
-    set_flag(Z, operand == 0);
-    set_flag(N, 0);
-    set_flag(H, 0);
+    lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::RRA() {
-	bool temp_C = get_flag(C);
-	set_flag(C, AF.high & 1);
-	AF.high = (AF.high >> 1) | (temp_C << 7);
+	uint16_t result = (regs.AF.high >> 1) | (carry_flag() << 7) | ((regs.AF.high & 1) << 8);
+	regs.AF.high = result & 0xFF;
 
-	set_flag(Z, 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
+	lazy_flags(FlagOp::ShiftA, 0, 0, result);
 }
 
 void CPU::RRC(uint8_t& operand) {
-	set_flag(C, operand & 1);
-	operand = (operand >> 1) | (get_flag(C) << 7);
+	uint16_t result = (operand >> 1) | ((operand & 1) << 7) | ((operand & 1) << 8);
+	operand = result & 0xFF;
 
-	set_flag(Z, operand == 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
+	lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::RRC_mem(uint16_t addr) {
     uint8_t operand = gb->mmu.read(addr);
-    set_flag(C, operand & 1);
-    operand = (operand >> 1) | (get_flag(C) << 7);
-    gb->mmu.write(addr, operand);
+    uint16_t result = (operand >> 1) | ((operand & 1) << 7) | ((operand & 1) << 8);
+    gb->mmu.write(addr, result & 0xFF);
 
-    set_flag(Z, operand == 0);
-    set_flag(N, 0);
-    set_flag(H, 0);
+    lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::RRCA() {
-	set_flag(C, AF.high & 1);
-	AF.high = (AF.high >> 1) | (get_flag(C) << 7);
+	uint16_t result = (regs.AF.high >> 1) | ((regs.AF.high & 1) << 7) | ((regs.AF.high & 1) << 8);
+	regs.AF.high = result & 0xFF;
 
-	set_flag(Z, 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
+	lazy_flags(FlagOp::ShiftA, 0, 0, result);
 }
 
 void CPU::RST(uint8_t tgt) {
@@ -550,16 +675,13 @@ void CPU::RST(uint8_t tgt) {
 }
 
 void CPU::SBC(uint8_t operand) {
-    uint8_t carry = get_flag(C);
+    uint8_t carry = carry_flag();
 
-    int result = AF.high - operand - carry;
+    uint16_t result = regs.AF.high - operand - carry;
 
-    set_flag(Z, (uint8_t)result == 0);
-    set_flag(N, 1);
-    set_flag(H, ((AF.high & 0xF) - (operand & 0xF) - carry) < 0);
-    set_flag(C, result < 0);
+    lazy_flags(FlagOp::Sub, regs.AF.high, operand, result);
 
-    AF.high = (uint8_t)result;
+    regs.AF.high = (uint8_t)result;
 }
 
 void CPU::SCF() {
@@ -579,65 +701,48 @@ void CPU::SET_mem(uint8_t bit_idx, uint16_t addr) {
 }
 
 void CPU::SLA(uint8_t& dest) {
-	set_flag(C, dest >> 7);
-	dest = dest << 1;
+	uint16_t result = dest << 1;
+	dest = result & 0xFF;
 
-	set_flag(Z, dest == 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
+	lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::SLA_mem(uint16_t addr) {
     uint8_t dest = gb->mmu.read(addr);
-    set_flag(C, dest >> 7);
-    dest = dest << 1;
-    gb->mmu.write(addr, dest);
+    uint16_t result = dest << 1;
+    gb->mmu.write(addr, result & 0xFF);
 
-    set_flag(Z, dest == 0);
-    set_flag(N, 0);
-    set_flag(H, 0);
+    lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::SRA(uint8_t& dest) {
-	set_flag(C, dest & 1);
-	dest = dest >> 1;
-	dest |= ((dest << 1) & 0b10000000);
+	uint16_t result = (dest >> 1) | (dest & 0x80) | ((dest & 1) << 8);
+	dest = result & 0xFF;
 
-	set_flag(Z, dest == 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
+	lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::SRA_mem(uint16_t addr) {
     uint8_t dest = gb->mmu.read(addr);
-    set_flag(C, dest & 1);
-    dest = dest >> 1;
-    dest |= ((dest << 1) & 0b10000000);
-    gb->mmu.write(addr, dest);
+    uint16_t result = (dest >> 1) | (dest & 0x80) | ((dest & 1) << 8);
+    gb->mmu.write(addr, result & 0xFF);
 
-    set_flag(Z, dest == 0);
-    set_flag(N, 0);
-    set_flag(H, 0);
+    lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::SRL(uint8_t& dest) {
-	set_flag(C, dest & 1);
-	dest = dest >> 1;
+	uint16_t result = (dest >> 1) | ((dest & 1) << 8);
+	dest = result & 0xFF;
 
-	set_flag(Z, dest == 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
+	lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::SRL_mem(uint16_t addr) {
     uint8_t dest = gb->mmu.read(addr);
-    set_flag(C, dest & 1);
-    dest = dest >> 1;
-    gb->mmu.write(addr, dest);
+    uint16_t result = (dest >> 1) | ((dest & 1) << 8);
+    gb->mmu.write(addr, result & 0xFF);
 
-    set_flag(Z, dest == 0);
-    set_flag(N, 0);
-    set_flag(H, 0);
+    lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::STOP() {
@@ -645,47 +750,32 @@ void CPU::STOP() {
 }
 
 void CPU::SUB(uint8_t operand) {
-    int result = AF.high - operand;
+    uint16_t result = regs.AF.high - operand;
 
-    set_flag(Z, (uint8_t)result == 0);
-    set_flag(N, 1);
-    set_flag(H, ((AF.high & 0xF) - (operand & 0xF)) < 0);
-    set_flag(C, result < 0);
+    lazy_flags(FlagOp::Sub, regs.AF.high, operand, result);
 
-    AF.high = (uint8_t)result;
+    regs.AF.high = (uint8_t)result;
 }
 
 void CPU::SWAP(uint8_t& dest) {
-	uint8_t temp = dest << 4;
-	dest = dest >> 4;
-	dest |= temp;
+	uint16_t result = (uint8_t)((dest << 4) | (dest >> 4));
+	dest = result & 0xFF;
 
-	set_flag(Z, dest == 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
-	set_flag(C, 0);
+	lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::SWAP_mem(uint16_t addr) {
     uint8_t dest = gb->mmu.read(addr);
-    uint8_t temp = dest << 4;
-    dest = dest >> 4;
-    dest |= temp;
-    gb->mmu.write(addr, dest);
+    uint16_t result = (uint8_t)((dest << 4) | (dest >> 4));
+    gb->mmu.write(addr, result & 0xFF);
 
-    set_flag(Z, dest == 0);
-    set_flag(N, 0);
-    set_flag(H, 0);
-    set_flag(C, 0);
+    lazy_flags(FlagOp::Shift, 0, 0, result);
 }
 
 void CPU::XOR(uint8_t operand) {
-	AF.high = AF.high ^ operand;
+	regs.AF.high = regs.AF.high ^ operand;
 
-	set_flag(Z, AF.high == 0);
-	set_flag(N, 0);
-	set_flag(H, 0);
-	set_flag(C, 0);
+	lazy_flags(FlagOp::Or, 0, 0, regs.AF.high);
 }
 
 /*
@@ -695,585 +785,286 @@ void CPU::XOR(uint8_t operand) {
 */
 
 uint8_t CPU::n8() {
-    return gb->mmu.read(PC++);
+    if (current_op != nullptr) {
+        gb->tick_other_components();
+        regs.PC++;
+        return (uint8_t)current_op->immediate;
+    }
+    return gb->mmu.read(regs.PC++);
 }
 
 uint16_t CPU::n16() {
-    //Immediate stored little-endian
-    PC += 2;
-    return (gb->mmu.read(PC - 1) << 8) | gb->mmu.read(PC - 2);
-}
-
-void CPU::execute_opcode(uint8_t opcode) {
-    switch (opcode) {
-    case 0xCB: execute_CB_opcode(gb->mmu.read(PC++)); break;
-
-    case 0x00: NOP(); break;
-    case 0x01: LD(BC, n16()); break;
-    case 0x02: LD_mem(BC.get_word(), AF.high); break;
-    case 0x03: INC(BC); break;
-    case 0x04: INC(BC.high); break;
-    case 0x05: DEC(BC.high); break;
-    case 0x06: LD(BC.high, n8()); break;
-    case 0x07: RLCA();  break;
-    case 0x08: LD_n16_SP(n16()); break;
-    case 0x09: ADD(HL, BC.get_word()); break;
-    case 0x0A: LD(AF.high, gb->mmu.read(BC.get_word())); break;
-    case 0x0B: DEC(BC); break;
-    case 0x0C: INC(BC.low); break;
-    case 0x0D: DEC(BC.low); break;
-    case 0x0E: LD(BC.low, n8()); break;
-    case 0x0F: RRCA(); break;
-
-    case 0x10: STOP(); break;
-    case 0x11: LD(DE, n16()); break;
-    case 0x12: LD_mem(DE.get_word(), AF.high); break;
-    case 0x13: INC(DE); break;
-    case 0x14: INC(DE.high); break;
-    case 0x15: DEC(DE.high); break;
-    case 0x16: LD(DE.high, n8()); break;
-    case 0x17: RLA();  break;
-    case 0x18: JR(n8()); break;
-    case 0x19: ADD(HL, DE.get_word()); break;
-    case 0x1A: LD(AF.high, gb->mmu.read(DE.get_word())); break;
-    case 0x1B: DEC(DE); break;
-    case 0x1C: INC(DE.low); break;
-    case 0x1D: DEC(DE.low); break;
-    case 0x1E: LD(DE.low, n8()); break;
-    case 0x1F: RRA(); break;
-
-    case 0x20: if (!get_flag(Z)) JR(n8()); else n8(); break;
-    case 0x21: LD(HL, n16()); break;
-    case 0x22: LD_HLI_mem(HL.get_word(), AF.high); break;
-    case 0x23: INC(HL); break;
-    case 0x24: INC(HL.high); break;
-    case 0x25: DEC(HL.high); break;
-    case 0x26: LD(HL.high, n8()); break;
-    case 0x27: DAA();  break;
-    case 0x28: if (get_flag(Z)) JR(n8()); else n8(); break;
-    case 0x29: ADD(HL, HL.get_word()); break;
-    case 0x2A: LD_HLI(AF.high, gb->mmu.read(HL.get_word())); break;
-    case 0x2B: DEC(HL); break;
-    case 0x2C: INC(HL.low); break;
-    case 0x2D: DEC(HL.low); break;
-    case 0x2E: LD(HL.low, n8()); break;
-    case 0x2F: CPL(); break;
-
-    case 0x30: if (!get_flag(C)) JR(n8()); else n8(); break;
-    case 0x31: LD(SP, n16()); break;
-    case 0x32: LD_HLD_mem(HL.get_word(), AF.high); break;
-    case 0x33: INC(SP); break;
-    case 0x34: INC_mem(HL.get_word()); break;
-    case 0x35: DEC_mem(HL.get_word()); break;
-    case 0x36: LD_mem(HL.get_word(), n8()); break;
-    case 0x37: SCF();  break;
-    case 0x38: if (get_flag(C)) JR(n8()); else n8(); break;
-    case 0x39: ADD(HL, SP.get_word()); break;
-    case 0x3A: LD_HLD(AF.high, gb->mmu.read(HL.get_word())); break;
-    case 0x3B: DEC(SP); break;
-    case 0x3C: INC(AF.high); break;
-    case 0x3D: DEC(AF.high); break;
-    case 0x3E: LD(AF.high, n8()); break;
-    case 0x3F: CCF(); break;
-
-    case 0x40: LD(BC.high, BC.high); break;
-    case 0x41: LD(BC.high, BC.low); break;
-    case 0x42: LD(BC.high, DE.high); break;
-    case 0x43: LD(BC.high, DE.low); break;
-    case 0x44: LD(BC.high, HL.high); break;
-    case 0x45: LD(BC.high, HL.low); break;
-    case 0x46: LD(BC.high, gb->mmu.read(HL.get_word())); break;
-    case 0x47: LD(BC.high, AF.high); break;
-    case 0x48: LD(BC.low, BC.high); break;
-    case 0x49: LD(BC.low, BC.low); break;
-    case 0x4A: LD(BC.low, DE.high); break;
-    case 0x4B: LD(BC.low, DE.low); break;
-    case 0x4C: LD(BC.low, HL.high); break;
-    case 0x4D: LD(BC.low, HL.low); break;
-    case 0x4E: LD(BC.low, gb->mmu.read(HL.get_word())); break;
-    case 0x4F: LD(BC.low, AF.high); break;
-
-    case 0x50: LD(DE.high, BC.high); break;
-    case 0x51: LD(DE.high, BC.low); break;
-    case 0x52: LD(DE.high, DE.high); break;
-    case 0x53: LD(DE.high, DE.low); break;
-    case 0x54: LD(DE.high, HL.high); break;
-    case 0x55: LD(DE.high, HL.low); break;
-    case 0x56: LD(DE.high, gb->mmu.read(HL.get_word())); break;
-    case 0x57: LD(DE.high, AF.high); break;
-    case 0x58: LD(DE.low, BC.high); break;
-    case 0x59: LD(DE.low, BC.low); break;
-    case 0x5A: LD(DE.low, DE.high); break;
-    case 0x5B: LD(DE.low, DE.low); break;
-    case 0x5C: LD(DE.low, HL.high); break;
-    case 0x5D: LD(DE.low, HL.low); break;
-    case 0x5E: LD(DE.low, gb->mmu.read(HL.get_word())); break;
-    case 0x5F: LD(DE.low, AF.high); break;
-
-    case 0x60: LD(HL.high, BC.high); break;
-    case 0x61: LD(HL.high, BC.low); break;
-    case 0x62: LD(HL.high, DE.high); break;
-    case 0x63: LD(HL.high, DE.low); break;
-    case 0x64: LD(HL.high, HL.high); break;
-    case 0x65: LD(HL.high, HL.low); break;
-    case 0x66: LD(HL.high, gb->mmu.read(HL.get_word())); break;
-    case 0x67: LD(HL.high, AF.high); break;
-    case 0x68: LD(HL.low, BC.high); break;
-    case 0x69: LD(HL.low, BC.low); break;
-    case 0x6A: LD(HL.low, DE.high); break;
-    case 0x6B: LD(HL.low, DE.low); break;
-    case 0x6C: LD(HL.low, HL.high); break;
-    case 0x6D: LD(HL.low, HL.low); break;
-    case 0x6E: LD(HL.low, gb->mmu.read(HL.get_word())); break;
-    case 0x6F: LD(HL.low, AF.high); break;
-
-    case 0x70: LD_mem(HL.get_word(), BC.high); break;
-    case 0x71: LD_mem(HL.get_word(), BC.low); break;
-    case 0x72: LD_mem(HL.get_word(), DE.high); break;
-    case 0x73: LD_mem(HL.get_word(), DE.low); break;
-    case 0x74: LD_mem(HL.get_word(), HL.high); break;
-    case 0x75: LD_mem(HL.get_word(), HL.low); break;
-    case 0x76: HALT(); break;
-    case 0x77: LD_mem(HL.get_word(), AF.high); break;
-    case 0x78: LD(AF.high, BC.high); break;
-    case 0x79: LD(AF.high, BC.low); break;
-    case 0x7A: LD(AF.high, DE.high); break;
-    case 0x7B: LD(AF.high, DE.low); break;
-    case 0x7C: LD(AF.high, HL.high); break;
-    case 0x7D: LD(AF.high, HL.low); break;
-    case 0x7E: LD(AF.high, gb->mmu.read(HL.get_word())); break;
-    case 0x7F: LD(AF.high, AF.high); break;
-
-    case 0x80: ADD(BC.high); break;
-    case 0x81: ADD(BC.low); break;
-    case 0x82: ADD(DE.high); break;
-    case 0x83: ADD(DE.low); break;
-    case 0x84: ADD(HL.high); break;
-    case 0x85: ADD(HL.low); break;
-    case 0x86: ADD(gb->mmu.read(HL.get_word())); break;
-    case 0x87: ADD(AF.high); break;
-    case 0x88: ADC(BC.high); break;
-    case 0x89: ADC(BC.low); break;
-    case 0x8A: ADC(DE.high); break;
-    case 0x8B: ADC(DE.low); break;
-    case 0x8C: ADC(HL.high); break;
-    case 0x8D: ADC(HL.low); break;
-    case 0x8E: ADC(gb->mmu.read(HL.get_word())); break;
-    case 0x8F: ADC(AF.high); break;
-
-    case 0x90: SUB(BC.high); break;
-    case 0x91: SUB(BC.low); break;
-    case 0x92: SUB(DE.high); break;
-    case 0x93: SUB(DE.low); break;
-    case 0x94: SUB(HL.high); break;
-    case 0x95: SUB(HL.low); break;
-    case 0x96: SUB(gb->mmu.read(HL.get_word())); break;
-    case 0x97: SUB(AF.high); break;
-    case 0x98: SBC(BC.high); break;
-    case 0x99: SBC(BC.low); break;
-    case 0x9A: SBC(DE.high); break;
-    case 0x9B: SBC(DE.low); break;
-    case 0x9C: SBC(HL.high); break;
-    case 0x9D: SBC(HL.low); break;
-    case 0x9E: SBC(gb->mmu.read(HL.get_word())); break;
-    case 0x9F: SBC(AF.high); break;
-
-    case 0xA0: AND(BC.high); break;
-    case 0xA1: AND(BC.low); break;
-    case 0xA2: AND(DE.high); break;
-    case 0xA3: AND(DE.low); break;
-    case 0xA4: AND(HL.high); break;
-    case 0xA5: AND(HL.low); break;
-    case 0xA6: AND(gb->mmu.read(HL.get_word())); break;
-    case 0xA7: AND(AF.high); break;
-    case 0xA8: XOR(BC.high); break;
-    case 0xA9: XOR(BC.low); break;
-    case 0xAA: XOR(DE.high); break;
-    case 0xAB: XOR(DE.low); break;
-    case 0xAC: XOR(HL.high); break;
-    case 0xAD: XOR(HL.low); break;
-    case 0xAE: XOR(gb->mmu.read(HL.get_word())); break;
-    case 0xAF: XOR(AF.high); break;
-
-    case 0xB0: OR(BC.high); break;
-    case 0xB1: OR(BC.low); break;
-    case 0xB2: OR(DE.high); break;
-    case 0xB3: OR(DE.low); break;
-    case 0xB4: OR(HL.high); break;
-    case 0xB5: OR(HL.low); break;
-    case 0xB6: OR(gb->mmu.read(HL.get_word())); break;
-    case 0xB7: OR(AF.high); break;
-    case 0xB8: CP(BC.high); break;
-    case 0xB9: CP(BC.low); break;
-    case 0xBA: CP(DE.high); break;
-    case 0xBB: CP(DE.low); break;
-    case 0xBC: CP(HL.high); break;
-    case 0xBD: CP(HL.low); break;
-    case 0xBE: CP(gb->mmu.read(HL.get_word())); break;
-    case 0xBF: CP(AF.high); break;
-
-    case 0xC0: gb->tick_other_components(); if (!get_flag(Z)) RET(); break;
-    case 0xC1: POP(BC); break;
-    case 0xC2: if (!get_flag(Z)) JP(n16()); else n16(); break;
-    case 0xC3: JP(n16());  break;
-    case 0xC4: if (!get_flag(Z)) CALL(n16()); else n16(); break;
-    case 0xC5: PUSH(BC); break;
-    case 0xC6: ADD(n8()); break;
-    case 0xC7: RST(0x00);  break;
-    case 0xC8: gb->tick_other_components(); if (get_flag(Z)) RET(); break;
-    case 0xC9: RET(); break;
-    case 0xCA: if (get_flag(Z)) JP(n16()); else n16(); break;
-    //case 0xCB: Prefix, case defined at start of switch
-    case 0xCC: if (get_flag(Z)) CALL(n16()); else n16(); break;
-    case 0xCD: CALL(n16()); break;
-    case 0xCE: ADC(n8()); break;
-    case 0xCF: RST(0x08); break;
-
-    case 0xD0: gb->tick_other_components(); if (!get_flag(C)) RET(); break;
-    case 0xD1: POP(DE); break;
-    case 0xD2: if (!get_flag(C)) JP(n16()); else n16(); break;
-    //case 0xD3:
-    case 0xD4: if (!get_flag(C)) CALL(n16()); else n16(); break;
-    case 0xD5: PUSH(DE); break;
-    case 0xD6: SUB(n8()); break;
-    case 0xD7: RST(0x10);  break;
-    case 0xD8: gb->tick_other_components(); if (get_flag(C)) RET(); break;
-    case 0xD9: RETI(); break;
-    case 0xDA: if (get_flag(C)) JP(n16()); else n16(); break;
-    //case 0xDB: 
-    case 0xDC: if (get_flag(C)) CALL(n16()); else n16(); break;
-    //case 0xDD:
-    case 0xDE: SBC(n8()); break;
-    case 0xDF: RST(0x18); break;
-
-    case 0xE0: LD_mem(0xFF00 + n8(), AF.high);  break;
-    case 0xE1: POP(HL); break;
-    case 0xE2: LD_mem(0xFF00 + BC.low, AF.high); break;
-    //case 0xE3: 
-    //case 0xE4:
-    case 0xE5: PUSH(HL); break;
-    case 0xE6: AND(n8()); break;
-    case 0xE7: RST(0x20); break;
-    case 0xE8: ADD_SP_E8(n8()); break;
-    case 0xE9: JP_HL();  break;
-    case 0xEA: LD_mem(n16(), AF.high); break;
-    //case 0xEB:
-    //case 0xEC: 
-    //case 0xED: 
-    case 0xEE: XOR(n8()); break;
-    case 0xEF: RST(0x28); break;
-
-    case 0xF0: LD(AF.high, gb->mmu.read(0xFF00 + n8()));  break;
-    case 0xF1: POP(AF); break;
-    case 0xF2: LD(AF.high, gb->mmu.read(0xFF00 + BC.low)); break;
-    case 0xF3: DI(); break;
-    //case 0xF4:
-    case 0xF5: PUSH(AF); break;
-    case 0xF6: OR(n8()); break;
-    case 0xF7: RST(0x30); break;
-    case 0xF8: LD_HL_SP_E8(n8()); break;
-    case 0xF9: gb->tick_other_components(); LD(SP, HL.get_word());  break;
-    case 0xFA: LD(AF.high, gb->mmu.read(n16())); break;
-    case 0xFB: EI(); break;
-    //case 0xFC: 
-    //case 0xFD: 
-    case 0xFE: CP(n8()); break;
-    case 0xFF: RST(0x38); break;
-
-    default: LOG_WARN("Invalid opcode 0x%X", opcode);
+    if (current_op != nullptr) {
+        gb->tick_other_components();
+        gb->tick_other_components();
+        regs.PC += 2;
+        return current_op->immediate;
     }
+
+    //Immediate stored little-endian
+    regs.PC += 2;
+    return (gb->mmu.read(regs.PC - 1) << 8) | gb->mmu.read(regs.PC - 2);
 }
 
-void CPU::execute_CB_opcode(uint8_t opcode) {
-    switch (opcode) {
-    case 0x00: RLC(BC.high);  break;
-    case 0x01: RLC(BC.low);  break;
-    case 0x02: RLC(DE.high);  break;
-    case 0x03: RLC(DE.low); break;
-    case 0x04: RLC(HL.high);  break;
-    case 0x05: RLC(HL.low); break;
-    case 0x06: RLC_mem(HL.get_word()); break;
-    case 0x07: RLC(AF.high); break;
-
-    case 0x08: RRC(BC.high);  break;
-    case 0x09: RRC(BC.low);  break; 
-    case 0x0A: RRC(DE.high);  break;
-    case 0x0B: RRC(DE.low); break; 
-    case 0x0C: RRC(HL.high);  break; 
-    case 0x0D: RRC(HL.low); break; 
-    case 0x0E: RRC_mem(HL.get_word()); break;
-    case 0x0F: RRC(AF.high); break;
-
-    case 0x10: RL(BC.high);  break;
-    case 0x11: RL(BC.low);  break;
-    case 0x12: RL(DE.high);  break;
-    case 0x13: RL(DE.low); break;
-    case 0x14: RL(HL.high);  break;
-    case 0x15: RL(HL.low); break;
-    case 0x16: RL_mem(HL.get_word()); break;
-    case 0x17: RL(AF.high); break;
-
-    case 0x18: RR(BC.high);  break;
-    case 0x19: RR(BC.low);  break;
-    case 0x1A: RR(DE.high);  break;
-    case 0x1B: RR(DE.low); break;
-    case 0x1C: RR(HL.high);  break;
-    case 0x1D: RR(HL.low); break;
-    case 0x1E: RR_mem(HL.get_word()); break;
-    case 0x1F: RR(AF.high); break;
-
-    case 0x20: SLA(BC.high);  break;
-    case 0x21: SLA(BC.low);  break;
-    case 0x22: SLA(DE.high);  break;
-    case 0x23: SLA(DE.low); break;
-    case 0x24: SLA(HL.high);  break;
-    case 0x25: SLA(HL.low); break;
-    case 0x26: SLA_mem(HL.get_word()); break;
-    case 0x27: SLA(AF.high); break;
-
-    case 0x28: SRA(BC.high);  break;
-    case 0x29: SRA(BC.low);  break;
-    case 0x2A: SRA(DE.high);  break;
-    case 0x2B: SRA(DE.low); break;
-    case 0x2C: SRA(HL.high);  break;
-    case 0x2D: SRA(HL.low); break;
-    case 0x2E: SRA_mem(HL.get_word()); break;
-    case 0x2F: SRA(AF.high); break;
-
-    case 0x30: SWAP(BC.high);  break;
-    case 0x31: SWAP(BC.low);  break;
-    case 0x32: SWAP(DE.high);  break;
-    case 0x33: SWAP(DE.low); break;
-    case 0x34: SWAP(HL.high);  break;
-    case 0x35: SWAP(HL.low); break;
-    case 0x36: SWAP_mem(HL.get_word()); break;
-    case 0x37: SWAP(AF.high); break;
-
-    case 0x38: SRL(BC.high);  break;
-    case 0x39: SRL(BC.low);  break;
-    case 0x3A: SRL(DE.high);  break;
-    case 0x3B: SRL(DE.low); break;
-    case 0x3C: SRL(HL.high);  break;
-    case 0x3D: SRL(HL.low); break;
-    case 0x3E: SRL_mem(HL.get_word()); break;
-    case 0x3F: SRL(AF.high); break;
-
-    case 0x40: BIT(0, BC.high);  break;
-    case 0x41: BIT(0, BC.low);  break;
-    case 0x42: BIT(0, DE.high);  break;
-    case 0x43: BIT(0, DE.low); break;
-    case 0x44: BIT(0, HL.high);  break;
-    case 0x45: BIT(0, HL.low); break;
-    case 0x46: BIT(0, gb->mmu.read(HL.get_word())); break;
-    case 0x47: BIT(0, AF.high); break;
-
-    case 0x48: BIT(1, BC.high);  break;
-    case 0x49: BIT(1, BC.low);  break;
-    case 0x4A: BIT(1, DE.high);  break;
-    case 0x4B: BIT(1, DE.low); break;
-    case 0x4C: BIT(1, HL.high);  break;
-    case 0x4D: BIT(1, HL.low); break;
-    case 0x4E: BIT(1, gb->mmu.read(HL.get_word())); break;
-    case 0x4F: BIT(1, AF.high); break;
-
-    case 0x50: BIT(2, BC.high);  break;
-    case 0x51: BIT(2, BC.low);  break;
-    case 0x52: BIT(2, DE.high);  break;
-    case 0x53: BIT(2, DE.low); break;
-    case 0x54: BIT(2, HL.high);  break;
-    case 0x55: BIT(2, HL.low); break;
-    case 0x56: BIT(2, gb->mmu.read(HL.get_word())); break;
-    case 0x57: BIT(2, AF.high); break;
-
-    case 0x58: BIT(3, BC.high);  break;
-    case 0x59: BIT(3, BC.low);  break;
-    case 0x5A: BIT(3, DE.high);  break;
-    case 0x5B: BIT(3, DE.low); break;
-    case 0x5C: BIT(3, HL.high);  break;
-    case 0x5D: BIT(3, HL.low); break;
-    case 0x5E: BIT(3, gb->mmu.read(HL.get_word())); break;
-    case 0x5F: BIT(3, AF.high); break;
-
-    case 0x60: BIT(4, BC.high);  break;
-    case 0x61: BIT(4, BC.low);  break;
-    case 0x62: BIT(4, DE.high);  break;
-    case 0x63: BIT(4, DE.low); break;
-    case 0x64: BIT(4, HL.high);  break;
-    case 0x65: BIT(4, HL.low); break;
-    case 0x66: BIT(4, gb->mmu.read(HL.get_word())); break;
-    case 0x67: BIT(4, AF.high); break;
-
-    case 0x68: BIT(5, BC.high);  break;
-    case 0x69: BIT(5, BC.low);  break;
-    case 0x6A: BIT(5, DE.high);  break;
-    case 0x6B: BIT(5, DE.low); break;
-    case 0x6C: BIT(5, HL.high);  break;
-    case 0x6D: BIT(5, HL.low); break;
-    case 0x6E: BIT(5, gb->mmu.read(HL.get_word())); break;
-    case 0x6F: BIT(5, AF.high); break;
-
-    case 0x70: BIT(6, BC.high);  break;
-    case 0x71: BIT(6, BC.low);  break;
-    case 0x72: BIT(6, DE.high);  break;
-    case 0x73: BIT(6, DE.low); break;
-    case 0x74: BIT(6, HL.high);  break;
-    case 0x75: BIT(6, HL.low); break;
-    case 0x76: BIT(6, gb->mmu.read(HL.get_word())); break;
-    case 0x77: BIT(6, AF.high); break;
-
-    case 0x78: BIT(7, BC.high);  break;
-    case 0x79: BIT(7, BC.low);  break;
-    case 0x7A: BIT(7, DE.high);  break;
-    case 0x7B: BIT(7, DE.low); break;
-    case 0x7C: BIT(7, HL.high);  break;
-    case 0x7D: BIT(7, HL.low); break;
-    case 0x7E: BIT(7, gb->mmu.read(HL.get_word())); break;
-    case 0x7F: BIT(7, AF.high); break;
-
-    case 0x80: RES(0, BC.high);  break;
-    case 0x81: RES(0, BC.low);  break;
-    case 0x82: RES(0, DE.high);  break;
-    case 0x83: RES(0, DE.low); break;
-    case 0x84: RES(0, HL.high);  break;
-    case 0x85: RES(0, HL.low); break;
-    case 0x86: RES_mem(0, HL.get_word()); break;
-    case 0x87: RES(0, AF.high); break;
-
-    case 0x88: RES(1, BC.high);  break;
-    case 0x89: RES(1, BC.low);  break;
-    case 0x8A: RES(1, DE.high);  break;
-    case 0x8B: RES(1, DE.low); break;
-    case 0x8C: RES(1, HL.high);  break;
-    case 0x8D: RES(1, HL.low); break;
-    case 0x8E: RES_mem(1, HL.get_word()); break;
-    case 0x8F: RES(1, AF.high); break;
-
-    case 0x90: RES(2, BC.high);  break;
-    case 0x91: RES(2, BC.low);  break;
-    case 0x92: RES(2, DE.high);  break;
-    case 0x93: RES(2, DE.low); break;
-    case 0x94: RES(2, HL.high);  break;
-    case 0x95: RES(2, HL.low); break;
-    case 0x96: RES_mem(2, HL.get_word()); break;
-    case 0x97: RES(2, AF.high); break;
-
-    case 0x98: RES(3, BC.high);  break;
-    case 0x99: RES(3, BC.low);  break;
-    case 0x9A: RES(3, DE.high);  break;
-    case 0x9B: RES(3, DE.low); break;
-    case 0x9C: RES(3, HL.high);  break;
-    case 0x9D: RES(3, HL.low); break;
-    case 0x9E: RES_mem(3, HL.get_word()); break;
-    case 0x9F: RES(3, AF.high); break;
-
-    case 0xA0: RES(4, BC.high);  break;
-    case 0xA1: RES(4, BC.low);  break;
-    case 0xA2: RES(4, DE.high);  break;
-    case 0xA3: RES(4, DE.low); break;
-    case 0xA4: RES(4, HL.high);  break;
-    case 0xA5: RES(4, HL.low); break;
-    case 0xA6: RES_mem(4, HL.get_word()); break;
-    case 0xA7: RES(4, AF.high); break;
-
-    case 0xA8: RES(5, BC.high);  break;
-    case 0xA9: RES(5, BC.low);  break;
-    case 0xAA: RES(5, DE.high);  break;
-    case 0xAB: RES(5, DE.low); break;
-    case 0xAC: RES(5, HL.high);  break;
-    case 0xAD: RES(5, HL.low); break;
-    case 0xAE: RES_mem(5, HL.get_word()); break;
-    case 0xAF: RES(5, AF.high); break;
-
-    case 0xB0: RES(6, BC.high);  break;
-    case 0xB1: RES(6, BC.low);  break;
-    case 0xB2: RES(6, DE.high);  break;
-    case 0xB3: RES(6, DE.low); break;
-    case 0xB4: RES(6, HL.high);  break;
-    case 0xB5: RES(6, HL.low); break;
-    case 0xB6: RES_mem(6, HL.get_word()); break;
-    case 0xB7: RES(6, AF.high); break;
-
-    case 0xB8: RES(7, BC.high);  break;
-    case 0xB9: RES(7, BC.low);  break;
-    case 0xBA: RES(7, DE.high);  break;
-    case 0xBB: RES(7, DE.low); break;
-    case 0xBC: RES(7, HL.high);  break;
-    case 0xBD: RES(7, HL.low); break;
-    case 0xBE: RES_mem(7, HL.get_word()); break;
-    case 0xBF: RES(7, AF.high); break;
-
-    case 0xC0: SET(0, BC.high);  break;
-    case 0xC1: SET(0, BC.low);  break;
-    case 0xC2: SET(0, DE.high);  break;
-    case 0xC3: SET(0, DE.low); break;
-    case 0xC4: SET(0, HL.high);  break;
-    case 0xC5: SET(0, HL.low); break;
-    case 0xC6: SET_mem(0, HL.get_word()); break;
-    case 0xC7: SET(0, AF.high); break;
-
-    case 0xC8: SET(1, BC.high);  break;
-    case 0xC9: SET(1, BC.low);  break;
-    case 0xCA: SET(1, DE.high);  break;
-    case 0xCB: SET(1, DE.low); break;
-    case 0xCC: SET(1, HL.high);  break;
-    case 0xCD: SET(1, HL.low); break;
-    case 0xCE: SET_mem(1, HL.get_word()); break;
-    case 0xCF: SET(1, AF.high); break;
-
-    case 0xD0: SET(2, BC.high);  break;
-    case 0xD1: SET(2, BC.low);  break;
-    case 0xD2: SET(2, DE.high);  break;
-    case 0xD3: SET(2, DE.low); break;
-    case 0xD4: SET(2, HL.high);  break;
-    case 0xD5: SET(2, HL.low); break;
-    case 0xD6: SET_mem(2, HL.get_word()); break;
-    case 0xD7: SET(2, AF.high); break;
-
-    case 0xD8: SET(3, BC.high);  break;
-    case 0xD9: SET(3, BC.low);  break;
-    case 0xDA: SET(3, DE.high);  break;
-    case 0xDB: SET(3, DE.low); break;
-    case 0xDC: SET(3, HL.high);  break;
-    case 0xDD: SET(3, HL.low); break;
-    case 0xDE: SET_mem(3, HL.get_word()); break;
-    case 0xDF: SET(3, AF.high); break;
-
-    case 0xE0: SET(4, BC.high);  break;
-    case 0xE1: SET(4, BC.low);  break;
-    case 0xE2: SET(4, DE.high);  break;
-    case 0xE3: SET(4, DE.low); break;
-    case 0xE4: SET(4, HL.high);  break;
-    case 0xE5: SET(4, HL.low); break;
-    case 0xE6: SET_mem(4, HL.get_word()); break;
-    case 0xE7: SET(4, AF.high); break;
-
-    case 0xE8: SET(5, BC.high);  break;
-    case 0xE9: SET(5, BC.low);  break;
-    case 0xEA: SET(5, DE.high);  break;
-    case 0xEB: SET(5, DE.low); break;
-    case 0xEC: SET(5, HL.high);  break;
-    case 0xED: SET(5, HL.low); break;
-    case 0xEE: SET_mem(5, HL.get_word()); break;
-    case 0xEF: SET(5, AF.high); break;
-
-    case 0xF0: SET(6, BC.high);  break;
-    case 0xF1: SET(6, BC.low);  break;
-    case 0xF2: SET(6, DE.high);  break;
-    case 0xF3: SET(6, DE.low); break;
-    case 0xF4: SET(6, HL.high);  break;
-    case 0xF5: SET(6, HL.low); break;
-    case 0xF6: SET_mem(6, HL.get_word()); break;
-    case 0xF7: SET(6, AF.high); break;
-
-    case 0xF8: SET(7, BC.high);  break;
-    case 0xF9: SET(7, BC.low);  break;
-    case 0xFA: SET(7, DE.high);  break;
-    case 0xFB: SET(7, DE.low); break;
-    case 0xFC: SET(7, HL.high);  break;
-    case 0xFD: SET(7, HL.low); break;
-    case 0xFE: SET_mem(7, HL.get_word()); break;
-    case 0xFF: SET(7, AF.high); break;
-
-    default: LOG_WARN("Invalid opcode 0xCB%X", opcode);
-    }
-}
\ No newline at end of file
+/*
+============================================================================
+| Opcode table
+============================================================================
+*/
+
+template<int R>
+uint8_t& CPU::reg8() {
+	if constexpr (R == 0) return regs.BC.high;
+	else if constexpr (R == 1) return regs.BC.low;
+	else if constexpr (R == 2) return regs.DE.high;
+	else if constexpr (R == 3) return regs.DE.low;
+	else if constexpr (R == 4) return regs.HL.high;
+	else if constexpr (R == 5) return regs.HL.low;
+	else {
+		static_assert(R == 7, "(regs.HL) is not a register");
+		return regs.AF.high;
+	}
+}
+
+template<int RP>
+RegisterPair& CPU::reg16() {
+	if constexpr (RP == 0) return regs.BC;
+	else if constexpr (RP == 1) return regs.DE;
+	else if constexpr (RP == 2) return regs.HL;
+	else return regs.SP;
+}
+
+template<int RP>
+RegisterPair& CPU::reg16_stack() {
+	if constexpr (RP == 0) return regs.BC;
+	else if constexpr (RP == 1) return regs.DE;
+	else if constexpr (RP == 2) return regs.HL;
+	else return regs.AF;
+}
+
+template<int CC>
+bool CPU::condition() {
+	if constexpr (CC == 0) return !get_flag(Z);
+	else if constexpr (CC == 1) return get_flag(Z);
+	else if constexpr (CC == 2) return !get_flag(C);
+	else return get_flag(C);
+}
+
+template<int OP>
+void CPU::alu(uint8_t operand) {
+	if constexpr (OP == 0) ADD(operand);
+	else if constexpr (OP == 1) ADC(operand);
+	else if constexpr (OP == 2) SUB(operand);
+	else if constexpr (OP == 3) SBC(operand);
+	else if constexpr (OP == 4) AND(operand);
+	else if constexpr (OP == 5) XOR(operand);
+	else if constexpr (OP == 6) OR(operand);
+	else CP(operand);
+}
+
+template<int OP>
+void CPU::rotate_shift(uint8_t& dest) {
+	if constexpr (OP == 0) RLC(dest);
+	else if constexpr (OP == 1) RRC(dest);
+	else if constexpr (OP == 2) RL(dest);
+	else if constexpr (OP == 3) RR(dest);
+	else if constexpr (OP == 4) SLA(dest);
+	else if constexpr (OP == 5) SRA(dest);
+	else if constexpr (OP == 6) SWAP(dest);
+	else SRL(dest);
+}
+
+template<int OP>
+void CPU::rotate_shift_mem(uint16_t addr) {
+	if constexpr (OP == 0) RLC_mem(addr);
+	else if constexpr (OP == 1) RRC_mem(addr);
+	else if constexpr (OP == 2) RL_mem(addr);
+	else if constexpr (OP == 3) RR_mem(addr);
+	else if constexpr (OP == 4) SLA_mem(addr);
+	else if constexpr (OP == 5) SRA_mem(addr);
+	else if constexpr (OP == 6) SWAP_mem(addr);
+	else SRL_mem(addr);
+}
+
+//Opcodes are split into fields xx yyy zzz, with yyy also split into pp q
+//https://gb-archive.github.io/salvage/decoding_gbz80_opcodes/Decoding%20Gamboy%20Z80%20Opcodes.html
+template<int OPCODE>
+void CPU::opcode_handler(CPU& cpu) {
+	constexpr int x = OPCODE >> 6;
+	constexpr int y = (OPCODE >> 3) & 7;
+	constexpr int z = OPCODE & 7;
+	constexpr int p = y >> 1;
+	constexpr int q = y & 1;
+
+	if constexpr (x == 0) {
+		if constexpr (z == 0) {
+			if constexpr (y == 0) cpu.NOP();
+			else if constexpr (y == 1) cpu.LD_n16_SP(cpu.n16());
+			else if constexpr (y == 2) cpu.STOP();
+			else if constexpr (y == 3) cpu.JR(cpu.n8());
+			else if (cpu.condition<y - 4>()) cpu.JR(cpu.n8());
+			else cpu.n8();
+		}
+		else if constexpr (z == 1) {
+			if constexpr (q == 0) cpu.LD(cpu.reg16<p>(), cpu.n16());
+			else cpu.ADD(cpu.regs.HL, cpu.reg16<p>().word);
+		}
+		else if constexpr (z == 2) {
+			if constexpr (OPCODE == 0x02) cpu.LD_mem(cpu.regs.BC.word, cpu.regs.AF.high);
+			else if constexpr (OPCODE == 0x12) cpu.LD_mem(cpu.regs.DE.word, cpu.regs.AF.high);
+			else if constexpr (OPCODE == 0x22) cpu.LD_HLI_mem(cpu.regs.HL.word, cpu.regs.AF.high);
+			else if constexpr (OPCODE == 0x32) cpu.LD_HLD_mem(cpu.regs.HL.word, cpu.regs.AF.high);
+			else if constexpr (OPCODE == 0x0A) cpu.LD(cpu.regs.AF.high, cpu.gb->mmu.read(cpu.regs.BC.word));
+			else if constexpr (OPCODE == 0x1A) cpu.LD(cpu.regs.AF.high, cpu.gb->mmu.read(cpu.regs.DE.word));
+			else if constexpr (OPCODE == 0x2A) cpu.LD_HLI(cpu.regs.AF.high, cpu.gb->mmu.read(cpu.regs.HL.word));
+			else cpu.LD_HLD(cpu.regs.AF.high, cpu.gb->mmu.read(cpu.regs.HL.word));
+		}
+		else if constexpr (z == 3) {
+			if constexpr (q == 0) cpu.INC(cpu.reg16<p>());
+			else cpu.DEC(cpu.reg16<p>());
+		}
+		else if constexpr (z == 4) {
+			if constexpr (y == 6) cpu.INC_mem(cpu.regs.HL.word);
+			else cpu.INC(cpu.reg8<y>());
+		}
+		else if constexpr (z == 5) {
+			if constexpr (y == 6) cpu.DEC_mem(cpu.regs.HL.word);
+			else cpu.DEC(cpu.reg8<y>());
+		}
+		else if constexpr (z == 6) {
+			if constexpr (y == 6) cpu.LD_mem(cpu.regs.HL.word, cpu.n8());
+			else cpu.LD(cpu.reg8<y>(), cpu.n8());
+		}
+		else {
+			if constexpr (y == 0) cpu.RLCA();
+			else if constexpr (y == 1) cpu.RRCA();
+			else if constexpr (y == 2) cpu.RLA();
+			else if constexpr (y == 3) cpu.RRA();
+			else if constexpr (y == 4) cpu.DAA();
+			else if constexpr (y == 5) cpu.CPL();
+			else if constexpr (y == 6) cpu.SCF();
+			else cpu.CCF();
+		}
+	}
+	else if constexpr (x == 1) {
+		if constexpr (OPCODE == 0x76) cpu.HALT();
+		else if constexpr (z == 6) cpu.LD(cpu.reg8<y>(), cpu.gb->mmu.read(cpu.regs.HL.word));
+		else if constexpr (y == 6) cpu.LD_mem(cpu.regs.HL.word, cpu.reg8<z>());
+		else cpu.LD(cpu.reg8<y>(), cpu.reg8<z>());
+	}
+	else if constexpr (x == 2) {
+		if constexpr (z == 6) cpu.alu<y>(cpu.gb->mmu.read(cpu.regs.HL.word));
+		else cpu.alu<y>(cpu.reg8<z>());
+	}
+	else {
+		if constexpr (z == 0) {
+			if constexpr (y < 4) {
+				cpu.gb->tick_other_components();
+				if (cpu.condition<y>()) cpu.RET();
+			}
+			else if constexpr (y == 4) cpu.LD_mem(0xFF00 + cpu.n8(), cpu.regs.AF.high);
+			else if constexpr (y == 5) cpu.ADD_SP_E8(cpu.n8());
+			else if constexpr (y == 6) cpu.LD(cpu.regs.AF.high, cpu.gb->mmu.read(0xFF00 + cpu.n8()));
+			else cpu.LD_HL_SP_E8(cpu.n8());
+		}
+		else if constexpr (z == 1) {
+			if constexpr (q == 0) cpu.POP(cpu.reg16_stack<p>());
+			else if constexpr (p == 0) cpu.RET();
+			else if constexpr (p == 1) cpu.RETI();
+			else if constexpr (p == 2) cpu.JP_HL();
+			else {
+				cpu.gb->tick_other_components();
+				cpu.LD(cpu.regs.SP, cpu.regs.HL.word);
+			}
+		}
+		else if constexpr (z == 2) {
+			if constexpr (y < 4) {
+				if (cpu.condition<y>()) cpu.JP(cpu.n16());
+				else cpu.n16();
+			}
+			else if constexpr (y == 4) cpu.LD_mem(0xFF00 + cpu.regs.BC.low, cpu.regs.AF.high);
+			else if constexpr (y == 5) cpu.LD_mem(cpu.n16(), cpu.regs.AF.high);
+			else if constexpr (y == 6) cpu.LD(cpu.regs.AF.high, cpu.gb->mmu.read(0xFF00 + cpu.regs.BC.low));
+			else cpu.LD(cpu.regs.AF.high, cpu.gb->mmu.read(cpu.n16()));
+		}
+		else if constexpr (OPCODE == 0xC3) cpu.JP(cpu.n16());
+		else if constexpr (OPCODE == 0xCB) opcode_table[0x100 | cpu.gb->mmu.read(cpu.regs.PC++)](cpu);
+		else if constexpr (OPCODE == 0xF3) cpu.DI();
+		else if constexpr (OPCODE == 0xFB) cpu.EI();
+		else if constexpr (z == 4 && y < 4) {
+			if (cpu.condition<y>()) cpu.CALL(cpu.n16());
+			else cpu.n16();
+		}
+		else if constexpr (z == 5 && q == 0) cpu.PUSH(cpu.reg16_stack<p>());
+		else if constexpr (OPCODE == 0xCD) cpu.CALL(cpu.n16());
+		else if constexpr (z == 6) cpu.alu<y>(cpu.n8());
+		else if constexpr (z == 7) cpu.RST(y * 8);
+		else LOG_WARN("Invalid opcode 0x%X", OPCODE);
+	}
+}
+
+template<int OPCODE>
+void CPU::CB_opcode_handler(CPU& cpu) {
+	constexpr int x = OPCODE >> 6;
+	constexpr int y = (OPCODE >> 3) & 7;
+	constexpr int z = OPCODE & 7;
+
+	if constexpr (x == 0) {
+		if constexpr (z == 6) cpu.rotate_shift_mem<y>(cpu.regs.HL.word);
+		else cpu.rotate_shift<y>(cpu.reg8<z>());
+	}
+	else if constexpr (x == 1) {
+		if constexpr (z == 6) cpu.BIT(y, cpu.gb->mmu.read(cpu.regs.HL.word));
+		else cpu.BIT(y, cpu.reg8<z>());
+	}
+	else if constexpr (x == 2) {
+		if constexpr (z == 6) cpu.RES_mem(y, cpu.regs.HL.word);
+		else cpu.RES(y, cpu.reg8<z>());
+	}
+	else {
+		if constexpr (z == 6) cpu.SET_mem(y, cpu.regs.HL.word);
+		else cpu.SET(y, cpu.reg8<z>());
+	}
+}
+
+template<size_t... OPCODES>
+constexpr std::array<CPU::OpcodeHandler, 512> CPU::make_opcode_table(std::index_sequence<OPCODES...>) {
+	return { (OPCODES < 0x100 ? &opcode_handler<OPCODES & 0xFF> : &CB_opcode_handler<OPCODES & 0xFF>)... };
+}
+
+//The initializer is a constant expression, so the table is constant initialized before any dynamic initializer runs
+const std::array<CPU::OpcodeHandler, 512> CPU::opcode_table = make_opcode_table(std::make_index_sequence<512>());
+
+template<int OPCODE>
+void CPU::table_handler(CPU& cpu) {
+	if constexpr (OPCODE < 0x100) opcode_handler<OPCODE>(cpu);
+	else CB_opcode_handler<OPCODE & 0xFF>(cpu);
+}
+
+template<int FIRST, int SECOND>
+void CPU::fused_handler(CPU& cpu) {
+	table_handler<FIRST>(cpu);
+
+	//Stop between the two ops exactly where run_block() would, it stops too since the same check is true
+	if (cpu.block_exit_pending()) {
+		return;
+	}
+
+	//Fetch of the second op, which is the next MicroOp in the block
+	constexpr int fetch_length = SECOND < 0x100 ? 1 : 2;
+	for (int i = 0; i < fetch_length; i++) {
+		cpu.gb->tick_other_components();
+	}
+	cpu.regs.PC += fetch_length;
+	cpu.current_op++;
+
+	table_handler<SECOND>(cpu);
+}
+
+template<size_t... PAIRS>
+constexpr std::array<CPU::OpcodeHandler, FUSED_PAIR_COUNT> CPU::make_fused_table(std::index_sequence<PAIRS...>) {
+	return { &fused_handler<FUSED_PAIRS[PAIRS].first, FUSED_PAIRS[PAIRS].second>... };
+}
+
+//Constant initialized like opcode_table
+const std::array<CPU::OpcodeHandler, FUSED_PAIR_COUNT> CPU::fused_table = make_fused_table(std::make_index_sequence<FUSED_PAIR_COUNT>());
@@ -1,49 +1,103 @@
 #pragma once
 #include "common.h"
+#include "fused_pairs.h"
+#include <array>
+#include <utility>
+#include <type_traits>
 
 class GB;
-
-class Register {
-public:
-	virtual uint16_t get_word() = 0;
-	virtual void set_word(uint16_t set) = 0;
+struct MicroOp;
+
+//Byte order of the host, picks the layout of RegisterPair. MSVC only targets little endian hosts
+#if defined(__BYTE_ORDER__)
+#define REGISTER_PAIR_BIG_ENDIAN (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#elif defined(_MSC_VER)
+#define REGISTER_PAIR_BIG_ENDIAN 0
+#else
+#error "Unknown host byte order, RegisterPair needs REGISTER_PAIR_BIG_ENDIAN"
+#endif
+
+//16 bit register that can also be used as two 8 bit registers.
+//high and low alias the matching half of word so 16 bit access is a single load or store
+union RegisterPair {
+	uint16_t word;
+#if REGISTER_PAIR_BIG_ENDIAN
+	struct {
+		uint8_t high;
+		uint8_t low;
+	};
+#else
+	struct {
+		uint8_t low;
+		uint8_t high;
+	};
+#endif
 };
 
-class ByteRegisterPair : public Register {
-public:
-	uint8_t high;
-	uint8_t low;
-	uint16_t get_word();
-	void set_word(uint16_t set);
-};
+//Flat register file. Plain data so save states and tests can copy it with memcpy
+struct Registers {
+	//Accumulator register and Flags register, bits 0-3 are empty, 4:carry flag, 5:half carry flag, 6: subtraction flag, 7: zero flag
+	RegisterPair AF;
 
-class WordRegister : public Register {
-public:
-	uint16_t word;
-	uint16_t get_word();
-	void set_word(uint16_t set);
+	//Register B and C
+	RegisterPair BC;
+
+	//Register D and E
+	RegisterPair DE;
+
+	//Register H and L
+	RegisterPair HL;
+
+	//Stack pointer, only used as a word
+	RegisterPair SP;
+
+	//Program counter
+	uint16_t PC;
 };
+static_assert(std::is_trivially_copyable_v<Registers> && std::is_standard_layout_v<Registers>, "Registers must stay POD");
 
 class CPU {
 public:
 	friend class MMU;
+	friend class JIT;
+	friend class IdleSkip;
 
 	CPU(GB* in_gb);
 
 	//Execute one cycle
 	void tick();
 
-	//Execute opcode
+	//Handler for a single opcode
+	typedef void (*OpcodeHandler)(CPU& cpu);
+
+	//Pre-decoded opcode handlers, 0x000-0x0FF are unprefixed opcodes and 0x100-0x1FF are CB opcodes.
+	//An unprefixed handler is called after the 1 M cycle fetch step, a CB handler after the 2 M cycles of fetching 0xCB and the opcode
+	static const std::array<OpcodeHandler, 512> opcode_table;
+
+	//Execute opcode through opcode_table
 	// When this function is called 1 M cycle has happened for the fetch step
-	void execute_opcode(uint8_t opcode);
+	void dispatch_opcode(uint8_t opcode) { instructions++; opcode_table[opcode](*this); }
+
+	//Handlers for FUSED_PAIRS, only valid for a MicroOp directly followed by the pair's second op in a cached block.
+	//They run the first op, do the second op's fetch and then run it, stopping in between if run_block() would
+	static const std::array<OpcodeHandler, FUSED_PAIR_COUNT> fused_table;
+
+	//Run blocks from the block cache instead of interpreting one opcode per tick
+	bool use_block_cache;
+
+	//Run hot blocks as native code through GB's JIT, needs use_block_cache
+	bool use_jit;
 
-	//Execute CB opcode
-	// When this function is called 2 M cycles have happened for the fetch step
-	void execute_CB_opcode(uint8_t opcode);
+	//Statistics. Instructions only counts opcodes run outside of cached blocks, the block cache counts its own
+	uint64_t instructions;
+	uint64_t halted_cycles;
 
 	//Flag for what interrupts are requested
 	uint8_t interrupt_flag;
 
+	//AF, BC, DE, HL, SP and PC
+	Registers regs;
+
 	//Flag enum for accessing the correct bit of F for the corresponding flag
 	enum Flag {
 		Z = 1 << 7,
@@ -59,6 +113,59 @@ public:
 	bool get_flag(Flag flag);
 
 private:
+	/*
+	============================================================================
+	| Lazy flags
+	============================================================================
+	*/
+
+	//The 8 bit ALU, rotate, shift and BIT ops only record their operands and result, F is worked out from them once something reads it.
+	// F in regs is only up to date while flag_op is None. tick() always leaves it up to date
+	enum class FlagOp : uint8_t {
+		None,
+		//ADD ADC
+		Add,
+		//SUB SBC CP
+		Sub,
+		And,
+		//OR XOR
+		Or,
+		//8 bit INC and DEC, which keep C in flag_carry
+		Inc,
+		Dec,
+		//RLC RRC RL RR SLA SRA SRL SWAP, bit 8 of the result is the bit shifted out
+		Shift,
+		//RLCA RRCA RLA RRA, like Shift but Z is always 0
+		ShiftA,
+		//BIT, the result is the tested bit and C is kept in flag_carry
+		Bit
+	};
+
+	FlagOp flag_op;
+
+	//Operands of the last Add/Sub
+	uint8_t flag_a;
+	uint8_t flag_b;
+
+	//Full result of the last op, bit 8 is the carry or borrow for Add/Sub and the carry out for Shift/ShiftA
+	uint16_t flag_result;
+
+	//C from before the last Inc/Dec/Bit
+	bool flag_carry;
+
+	//Record the flags of op instead of writing them to F
+	void lazy_flags(FlagOp op, uint8_t a, uint8_t b, uint16_t result) {
+		flag_op = op;
+		flag_a = a;
+		flag_b = b;
+		flag_result = result;
+	}
+
+	//Write the flags of the last op to F
+	void materialize_flags();
+
+	//Carry flag without writing F
+	bool carry_flag();
 	
 	/*
 	============================================================================
@@ -66,6 +173,18 @@ private:
 	============================================================================
 	*/
 
+	//Run the cached block at PC until it ends or something outside the block needs attention
+	void run_block();
+
+	//Op being run from a cached block, its immediate is used instead of reading memory again
+	const MicroOp* current_op;
+
+	//Block cache generation when the running block started
+	uint32_t block_generation;
+
+	//True when the running block has to hand control back to tick() before its next op
+	bool block_exit_pending();
+
 	//Get immediate 8 bit data
 	// Ticks 1 M-Cycles
 	uint8_t n8();
@@ -74,6 +193,60 @@ private:
 	// Ticks 2 M-Cycles
 	uint16_t n16();
 
+	/*
+	============================================================================
+	| Opcode table
+	============================================================================
+	*/
+
+	//Handler templates instantiated for every entry of opcode_table.
+	//Operands are decoded from the opcode bits at compile time so each entry is straight-line code
+	template<int OPCODE>
+	static void opcode_handler(CPU& cpu);
+
+	template<int OPCODE>
+	static void CB_opcode_handler(CPU& cpu);
+
+	template<size_t... OPCODES>
+	static constexpr std::array<OpcodeHandler, 512> make_opcode_table(std::index_sequence<OPCODES...>);
+
+	//opcode_table entry for OPCODE without going through the table
+	template<int OPCODE>
+	static void table_handler(CPU& cpu);
+
+	template<int FIRST, int SECOND>
+	static void fused_handler(CPU& cpu);
+
+	template<size_t... PAIRS>
+	static constexpr std::array<OpcodeHandler, FUSED_PAIR_COUNT> make_fused_table(std::index_sequence<PAIRS...>);
+
+	//8 bit register encoded in an opcode, 0:B 1:C 2:D 3:E 4:H 5:L 7:A. 6 is (HL) which the handlers read from memory
+	template<int R>
+	uint8_t& reg8();
+
+	//16 bit register encoded in an opcode, 0:BC 1:DE 2:HL 3:SP
+	template<int RP>
+	RegisterPair& reg16();
+
+	//16 bit register encoded in PUSH/POP, 0:BC 1:DE 2:HL 3:AF
+	template<int RP>
+	RegisterPair& reg16_stack();
+
+	//Condition encoded in an opcode, 0:NZ 1:Z 2:NC 3:C
+	template<int CC>
+	bool condition();
+
+	//ALU operation on A encoded in an opcode, 0:ADD 1:ADC 2:SUB 3:SBC 4:AND 5:XOR 6:OR 7:CP
+	template<int OP>
+	void alu(uint8_t operand);
+
+	//Rotate/shift encoded in a CB opcode, 0:RLC 1:RRC 2:RL 3:RR 4:SLA 5:SRA 6:SWAP 7:SRL
+	template<int OP>
+	void rotate_shift(uint8_t& dest);
+
+	template<int OP>
+	void rotate_shift_mem(uint16_t addr);
+
 	/*
 	============================================================================
 	| CPU Instructions
@@ -88,7 +261,7 @@ private:
 
 	//Add operand to dest
 	// Tick 1 M-Cycles
-	void ADD(Register& dest, uint16_t operand);
+	void ADD(RegisterPair& dest, uint16_t operand);
 
 	//Add add signed operand to SP
 	// Tick 2 M-Cycles
@@ -122,7 +295,7 @@ private:
 
 	//Decrement dest
 	// Ticks 1 M-Cycles
-	void DEC(Register& dest);
+	void DEC(RegisterPair& dest);
 
 	//Decrement byte at addr
 	// Ticks 2 M-Cycles
@@ -143,7 +316,7 @@ private:
 
 	//Increment Dest
 	// Ticks 1 M-Cycles
-	void INC(Register& dest);
+	void INC(RegisterPair& dest);
 
 	//Increment byte at addr
 	// Ticks 2 M-Cycles
@@ -164,7 +337,7 @@ private:
 	void LD(uint8_t& dest, uint8_t operand);
 
 	//Copy value of operand to dest
-	void LD(Register& dest, uint16_t operand);
+	void LD(RegisterPair& dest, uint16_t operand);
 
 	//Copy value of SP+e8
 	// Ticks 1 M-Cycles
@@ -200,11 +373,11 @@ private:
 
 	//Pop from stack and store to dest
 	// Ticks 2 M-Cycles
-	void POP(Register& dest);
+	void POP(RegisterPair& dest);
 
 	//Push to stack from reg
 	// Tick 3 M-Cycles
-	void PUSH(ByteRegisterPair& reg);
+	void PUSH(RegisterPair& reg);
 
 	//Set bit bit_idx(0-7) to 0
 	void RES(uint8_t bit_idx, uint8_t& dest);
@@ -317,26 +490,6 @@ private:
 	//GB object, used to access memory
 	GB* gb;
 
-	//Registers AF, BC, DE, HL are 16bit registers that can also be two seperate 8bit registers
-
-	//Accumulator register and Flags register, bits 0-3 are empty, 4:carry flag, 5:half carry flag, 6: subtraction flag, 7: zero flag
-	ByteRegisterPair AF;
-
-	//Register B and C
-	ByteRegisterPair BC;
-
-	//Register D and E
-	ByteRegisterPair DE;
-
-	//Register H and L
-	ByteRegisterPair HL;
-
-	//Stack pointer
-	WordRegister SP;
-
-	//Program counter
-	uint16_t PC;
-
 	bool ei_scheduled;
 
 	bool interrupt_master_enable;
@@ -344,4 +497,7 @@ private:
 	uint8_t interrupt_enable;
 
 	bool halted;
+
+	//Set by HALT when it hits the halt bug, the next opcode fetch doesn't increment PC
+	bool halt_bug;
 };
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "frame_pacer.h"
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#include <errno.h>
+#endif
+
+using namespace std::chrono;
+
+//Margin the old pacer always used, also used until there are enough wakeups to pick one
+static const nanoseconds DEFAULT_MARGIN = milliseconds(2);
+static const nanoseconds MIN_MARGIN = microseconds(20);
+static const nanoseconds MAX_MARGIN = milliseconds(8);
+
+//Wakeups measured before the margin is picked from them
+static const int MIN_WAKEUPS = 16;
+
+FramePacer::FramePacer() {
+	mode = Mode::Sleep;
+	waits = 0;
+	late_wakeups = 0;
+	spin_time = nanoseconds(0);
+	margin = DEFAULT_MARGIN;
+	wakeup_count = 0;
+	wakeup_next = 0;
+}
+
+void FramePacer::sleep_until(steady_clock::time_point wake) {
+#ifdef __linux__
+	//steady_clock is CLOCK_MONOTONIC, an absolute deadline doesn't drift when the sleep is interrupted
+	int64_t ns = duration_cast<nanoseconds>(wake.time_since_epoch()).count();
+	timespec deadline;
+	deadline.tv_sec = ns / 1000000000;
+	deadline.tv_nsec = ns % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {
+	}
+#else
+	std::this_thread::sleep_until(wake);
+#endif
+}
+
+void FramePacer::wait_until(steady_clock::time_point deadline) {
+	waits++;
+
+	auto wake = deadline - margin;
+	if (steady_clock::now() < wake) {
+		sleep_until(wake);
+
+		auto woke = steady_clock::now();
+		wakeup_late[wakeup_next] = duration_cast<nanoseconds>(woke - wake).count();
+		wakeup_next = (wakeup_next + 1) % WAKEUP_HISTORY;
+		wakeup_count = std::min(wakeup_count + 1, WAKEUP_HISTORY);
+
+		if (woke > deadline) {
+			late_wakeups++;
+		}
+		if (mode == Mode::Sleep) {
+			update_margin();
+		}
+	}
+
+	//Spin the rest of the way
+	auto spin_start = steady_clock::now();
+	while (steady_clock::now() < deadline) {
+		// spin
+	}
+	spin_time += duration_cast<nanoseconds>(steady_clock::now() - spin_start);
+}
+
+int64_t FramePacer::wakeup_percentile(double p) {
+	if (wakeup_count == 0) {
+		return 0;
+	}
+	int64_t sorted[WAKEUP_HISTORY];
+	std::copy(wakeup_late, wakeup_late + wakeup_count, sorted);
+	int index = std::min((int)(p * wakeup_count), wakeup_count - 1);
+	std::nth_element(sorted, sorted + index, sorted + wakeup_count);
+	return sorted[index];
+}
+
+void FramePacer::update_margin() {
+	if (wakeup_count < MIN_WAKEUPS) {
+		return;
+	}
+
+	//Cover nearly every recent wakeup with some headroom, a wakeup past the margin makes the frame late
+	nanoseconds late(wakeup_percentile(0.99));
+	margin = std::clamp(late + late / 4 + MIN_MARGIN, MIN_MARGIN, MAX_MARGIN);
+}
+
+double FramePacer::thread_cpu_seconds() {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+		return 0;
+	}
+	//FILETIMEs count 100 ns intervals
+	uint64_t kernel_time = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+	uint64_t user_time = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+	return (kernel_time + user_time) * 1e-7;
+#else
+	timespec time;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0) {
+		return 0;
+	}
+	return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+void FramePacer::print_stats() {
+	if (waits == 0) {
+		return;
+	}
+	double spin_us = duration<double, std::micro>(spin_time).count() / waits;
+	LOG("Frame pacing: %s, margin %.0f us, wakeup jitter p50 %.0f us p99 %.0f us, %.0f us spun per frame, %llu late wakeups in %llu frames",
+		mode == Mode::Sleep ? "sleep" : "spin", duration<double, std::micro>(margin).count(),
+		wakeup_percentile(0.50) / 1000.0, wakeup_percentile(0.99) / 1000.0, spin_us,
+		(unsigned long long)late_wakeups, (unsigned long long)waits);
+}
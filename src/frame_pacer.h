@@ -0,0 +1,52 @@
+#pragma once
+#include "common.h"
+#include <chrono>
+
+//Waits for frame deadlines without keeping a core busy.
+//The thread sleeps on an absolute deadline until margin before the frame deadline and only spins for the rest.
+// The margin follows how late the OS woke the thread up over the last sleeps, so hosts with accurate timers barely spin.
+//Spin mode keeps the old fixed 2 ms margin, which spins for most of those 2 ms every frame.
+class FramePacer {
+public:
+	enum class Mode {
+		Sleep,
+		Spin
+	};
+
+	FramePacer();
+
+	//Return at deadline, or right away if it has already passed
+	void wait_until(std::chrono::steady_clock::time_point deadline);
+
+	//Log wakeup jitter, the current margin and how long was spent spinning
+	void print_stats();
+
+	//CPU time used by the calling thread in seconds
+	static double thread_cpu_seconds();
+
+	Mode mode;
+
+	//Statistics
+	uint64_t waits;
+	uint64_t late_wakeups;
+	std::chrono::nanoseconds spin_time;
+
+	//Time before the deadline the thread wakes up to spin
+	std::chrono::nanoseconds margin;
+
+private:
+	//How late the last WAKEUP_HISTORY sleeps woke up in ns, ring buffer
+	static constexpr int WAKEUP_HISTORY = 128;
+	int64_t wakeup_late[WAKEUP_HISTORY];
+	int wakeup_count;
+	int wakeup_next;
+
+	//Sleep until wake using the most precise absolute sleep the host has
+	static void sleep_until(std::chrono::steady_clock::time_point wake);
+
+	//Wakeup lateness at percentile p of the history
+	int64_t wakeup_percentile(double p);
+
+	//Pick the margin from the wakeup history
+	void update_margin();
+};
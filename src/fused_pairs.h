@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+//Two opcodes that follow each other in a block, CB opcodes are 0x100-0x1FF like in CPU::opcode_table
+struct OpcodePair {
+	uint16_t first;
+	uint16_t second;
+};
+
+//Opcode pairs the block cache runs as one fused handler instead of going around run_block() twice.
+//The first opcode can't be one that ends a block (jumps, calls, returns, RST and HALT) or the pair never shows up.
+//Run with --pair-stats to count which pairs the interpreter runs most and paste the top entries in here
+constexpr OpcodePair FUSED_PAIRS[] = {
+	{ 0x2A, 0x12 },		//LD A,(HL+)	LD (DE),A
+	{ 0x2A, 0x22 },		//LD A,(HL+)	LD (HL+),A
+	{ 0x1A, 0x22 },		//LD A,(DE)		LD (HL+),A
+	{ 0x22, 0x0B },		//LD (HL+),A	DEC BC
+	{ 0x0B, 0x78 },		//DEC BC		LD A,B
+	{ 0x78, 0xB1 },		//LD A,B		OR C
+	{ 0xB1, 0x20 },		//OR C			JR NZ,e8
+	{ 0x05, 0x20 },		//DEC B			JR NZ,e8
+	{ 0x0D, 0x20 },		//DEC C			JR NZ,e8
+	{ 0x3D, 0x20 },		//DEC A			JR NZ,e8
+	{ 0xFE, 0x20 },		//CP n8			JR NZ,e8
+	{ 0xFE, 0x28 },		//CP n8			JR Z,e8
+	{ 0xA7, 0x28 },		//AND A			JR Z,e8
+	{ 0xB7, 0x20 },		//OR A			JR NZ,e8
+	{ 0xF0, 0xE6 },		//LDH A,(n8)	AND n8
+	{ 0xF0, 0xFE },		//LDH A,(n8)	CP n8
+	{ 0xE0, 0xF0 },		//LDH (n8),A	LDH A,(n8)
+};
+
+constexpr size_t FUSED_PAIR_COUNT = sizeof(FUSED_PAIRS) / sizeof(FUSED_PAIRS[0]);
@@ -1,19 +1,34 @@
 #include "gb.h"
 #include <chrono>
-#include <thread>
 
 GB::GB(Cartridge in_cart, TextureBuffer* emuScreenTexBuffer, SharedBool* isPowerOn) :
 	cart(in_cart),
 	cpu(this),
 	ppu(this, emuScreenTexBuffer),
-	apu(),
+	apu(this),
 	mmu(this),
 	timer(this),
 	input(),
+	block_cache(this),
+	jit(this),
+	idle_skip(this),
+	benchmark(this),
 	isPowerOn(isPowerOn)
 {
 	OAM_DMA = 0xFF;
 	t_cycle_count = 0;
+	frame_limit = 0;
+	uncapped = false;
+	audio_sync = false;
+	audio_enabled = true;
+	audio_latency_ms = 60;
+	for (uint64_t& count : event_counts) {
+		count = 0;
+	}
+
+	mmu.map_cart();
+	ppu.schedule_next_event();
+	timer.schedule_events();
 }
 
 // Backwards-compatible constructor for tests that don't pass a SharedBool.
@@ -23,39 +38,166 @@ GB::GB(Cartridge in_cart, TextureBuffer* emuScreenTexBuffer) :
 }
 
 void GB::tick_other_components() {
-	//This is called after an M-Cycle so we need to tick ppu 4 T-cycles
-	for (int i = 0; i < 4; i++) {
-		t_cycle_count++;
-		ppu.tick();
+	//This is called after an M-Cycle so 4 T-cycles have passed
+	t_cycle_count += 4;
+	if (t_cycle_count >= scheduler.next_event_time()) {
+		run_events();
+	}
+}
+
+void GB::skip_to_next_event() {
+	uint64_t next_time = scheduler.next_event_time();
+	if (next_time != NEVER && next_time > t_cycle_count + 4) {
+		//Leave 1 M-cycle so the following tick_other_components() lands on or just after next_time
+		t_cycle_count += ((next_time - t_cycle_count - 1) / 4) * 4;
+	}
+}
+
+void GB::run_events() {
+	Event event;
+	uint64_t time;
+	//Handlers can schedule new events that are already due so keep popping until nothing is left
+	while (scheduler.pop_due(t_cycle_count, event, time)) {
+		event_counts[(int)event]++;
+		switch (event) {
+		case Event::PPU:
+			ppu.handle_event(time);
+			break;
+		case Event::TIMA:
+			timer.handle_tima_event(time);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+bool GB::set_jit_enabled(bool enabled) {
+	if (enabled && !jit.is_supported()) {
+		LOG_WARN("JIT is not supported on this host, using the interpreter");
+		cpu.use_jit = false;
+		return false;
 	}
-	apu.tick();
-	timer.tick();
+
+	cpu.use_jit = enabled;
+	return true;
+}
+
+uint64_t GB::get_jit_blocks_compiled() {
+	return jit.blocks_compiled;
+}
+
+uint64_t GB::get_jit_native_runs() {
+	return jit.native_runs;
+}
+
+void GB::set_idle_skip_enabled(bool enabled) {
+	idle_skip.enabled = enabled;
+}
+
+bool GB::load_idle_skip_list(const char* path) {
+	return idle_skip.load_list(path, cart.get_title());
+}
+
+void GB::set_pair_stats_enabled(bool enabled) {
+	block_cache.set_pair_counting(enabled);
+}
+
+void GB::set_frame_limit(uint64_t frames) {
+	frame_limit = frames;
+}
+
+void GB::set_uncapped(bool enabled) {
+	uncapped = enabled;
+}
+
+void GB::set_benchmark_enabled(bool enabled) {
+	benchmark.enabled = enabled;
+}
+
+void GB::set_pacing_mode(FramePacer::Mode mode) {
+	pacer.mode = mode;
 }
 
-int GB::get_t_cycle_count() {
+void GB::set_audio_sync(bool enabled, int latency_ms) {
+	audio_sync = enabled;
+	audio_latency_ms = latency_ms;
+}
+
+void GB::set_audio_enabled(bool enabled) {
+	audio_enabled = enabled;
+}
+
+void GB::set_resampler_mode(Resampler::Mode mode) {
+	resampler.set_mode(mode);
+}
+
+void GB::queue_audio() {
+	//The APU's output is read every frame even without a device so it doesn't pile up
+	apu.end_frame(t_cycle_count);
+	size_t frames = apu.samples_available();
+	apu_buffer.resize(frames * 2);
+	apu.read_samples(apu_buffer.data(), frames);
+
+	if (!audio_output.is_open()) {
+		return;
+	}
+	resampler.set_rate_adjust(audio_output.rate_control());
+	resampler.process(apu_buffer.data(), frames, audio_buffer);
+	audio_output.push(audio_buffer.data(), audio_buffer.size() / 2);
+}
+
+uint64_t GB::get_t_cycle_count() {
 	return t_cycle_count;
 }
 
+CPU& GB::get_cpu() {
+	return cpu;
+}
+
 void GB::run() {
 	const double TARGET_FPS = 59.737;
+	const uint64_t CYCLES_PER_FRAME = 70224;
+	const int AUDIO_SAMPLE_RATE = 48000;
 	auto target_ns = std::chrono::nanoseconds(static_cast<long long>(1e9 / TARGET_FPS));
-	//Sleep happen for duration - sleep_buffer to give time for OS sleep inconsistency
-	const auto sleep_buffer = std::chrono::milliseconds(2); 
 
 	auto last_frame_timestamp = std::chrono::steady_clock::now();
 	auto next_frame_time = last_frame_timestamp + target_ns;
 
 	double total_frametime = 0;
 	int frame_count = 0;
+	uint64_t frames_run = 0;
 	std::chrono::duration<double> frametime;
 
+	//Host CPU time used per emulated second is logged on exit
+	double cpu_time_start = FramePacer::thread_cpu_seconds();
+	uint64_t cycles_start = t_cycle_count;
+
+	if (audio_enabled && !uncapped && audio_output.open(AUDIO_SAMPLE_RATE, audio_latency_ms)) {
+		resampler.set_rates(APU_SAMPLE_RATE, audio_output.sample_rate);
+	}
+	//Audio sync needs a device to pace off
+	if (audio_sync && !audio_output.is_open()) {
+		LOG_WARN("No audio device for audio sync, pacing frames with the wall clock");
+		audio_sync = false;
+	}
+
+	if (benchmark.enabled) {
+		benchmark.start();
+	}
+
 	while (isPowerOn->value) {
-		//Run CPU until PPU finishes a frame
-		while (!ppu.frame_done) {
+		//Run CPU until PPU finishes a frame. With the LCD off the PPU never finishes one,
+		// so a frame also ends after as many T-cycles as the PPU takes to draw one
+		uint64_t frame_end = t_cycle_count + CYCLES_PER_FRAME;
+		while (!ppu.frame_done && t_cycle_count < frame_end) {
 			cpu.tick();
 		}
 
 		//Frame completed
+		if (benchmark.enabled) {
+			benchmark.frame_done();
+		}
 		auto now = std::chrono::steady_clock::now();
 		frametime = now - last_frame_timestamp;
 		total_frametime += frametime.count();
@@ -75,19 +217,29 @@ void GB::run() {
 		last_frame_timestamp = now;
 		ppu.frame_done = false;
 
-		//Schedule next frame
-		next_frame_time += target_ns;
-		now = std::chrono::steady_clock::now();
-		if (now + sleep_buffer < next_frame_time) {
-			//Sleep until shortly before the deadline
-			std::this_thread::sleep_until(next_frame_time - sleep_buffer);
+		frames_run++;
+		if (frame_limit != 0 && frames_run >= frame_limit) {
+			break;
+		}
+
+		if (audio_sync) {
+			//The sound card's clock paces emulation, wait for room before queueing the frame's audio
+			audio_output.wait_for_space();
+			queue_audio();
+			continue;
 		}
 
-		//Busy-wait after waking until enough time has passed
-		while (std::chrono::steady_clock::now() < next_frame_time) {
-			// spin
+		//With frame deadlines rate control keeps the device's queue from drifting
+		queue_audio();
+
+		if (uncapped) {
+			continue;
 		}
 
+		//Schedule next frame
+		next_frame_time += target_ns;
+		pacer.wait_until(next_frame_time);
+
 		now = std::chrono::steady_clock::now();
 
 		//If 5 frames behind schedule next frame to now
@@ -99,6 +251,24 @@ void GB::run() {
 		}
 	}
 
+	double emulated_seconds = (t_cycle_count - cycles_start) / (double)T_CYCLES_PER_SECOND;
+	if (emulated_seconds > 0) {
+		double cpu_ms = (FramePacer::thread_cpu_seconds() - cpu_time_start) * 1000;
+		LOG("Host CPU: %.1f ms per emulated second", cpu_ms / emulated_seconds);
+	}
+	pacer.print_stats();
+	audio_output.print_stats();
+	audio_output.close();
+	block_cache.print_stats();
+	block_cache.print_pair_stats(32);
+	idle_skip.print_stats();
+	if (cpu.use_jit) {
+		jit.print_stats();
+	}
+	if (benchmark.enabled) {
+		benchmark.print_json();
+	}
+
 	//Save sram 1 final time before stopping emulation
 	cart.save();
 }
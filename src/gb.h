@@ -8,15 +8,33 @@
 #include "mmu.h"
 #include "timer.h"
 #include "input.h"
+#include "scheduler.h"
+#include "block_cache.h"
+#include "jit.h"
+#include "idle_skip.h"
+#include "benchmark.h"
+#include "frame_pacer.h"
+#include "audio_output.h"
+#include "resampler.h"
 #include "TextureBuffer.h"
 #include "SharedBool.h"
 
 class CPU;
 
+//Clock speed of the DMG
+const uint64_t T_CYCLES_PER_SECOND = 4194304;
+
 class GB {
 public: 
 	friend class MMU;
 	friend class CPU;
+	friend class PPU;
+	friend class APU;
+	friend class Timer;
+	friend class BlockCache;
+	friend class JIT;
+	friend class IdleSkip;
+	friend class Benchmark;
 
 	//Initialize GB object with a game cartridge 
 	//TODO: and optionally a save state
@@ -27,10 +45,53 @@ public:
 	//Start emulator loop
 	void run();
 
-	//Tick the PPU, APU, and Timer
+	//Switch between the JIT and the block cache interpreter.
+	// Returns false and keeps interpreting if the JIT can't run on this host
+	bool set_jit_enabled(bool enabled);
+
+	//Blocks the JIT has compiled and times it ran a block as native code
+	uint64_t get_jit_blocks_compiled();
+	uint64_t get_jit_native_runs();
+
+	//Turn fast forwarding of idle polling loops on or off, it is on by default
+	void set_idle_skip_enabled(bool enabled);
+
+	//Load the per ROM idle skip overrides for this cartridge. False if the list can't be opened
+	bool load_idle_skip_list(const char* path);
+
+	//Count the opcode pairs the interpreter runs and log the most common ones when the emulator stops.
+	// Fusion is turned off while counting
+	void set_pair_stats_enabled(bool enabled);
+
+	//Stop run() after this many frames, 0 runs until the power is turned off
+	void set_frame_limit(uint64_t frames);
+
+	//Run as fast as possible instead of pacing frames to 59.737 FPS
+	void set_uncapped(bool enabled);
+
+	//Time every frame and print the results as JSON when run() stops
+	void set_benchmark_enabled(bool enabled);
+
+	//Sleep through most of the time between frames (the default) or spin for the last 2 ms like the old pacing
+	void set_pacing_mode(FramePacer::Mode mode);
+
+	//Pace emulation off the audio device instead of frame deadlines, keeping latency_ms of audio queued.
+	// Falls back to frame deadlines if no audio device can be opened
+	void set_audio_sync(bool enabled, int latency_ms);
+
+	//Play sound on the host's audio device, on by default. The APU still runs without it
+	void set_audio_enabled(bool enabled);
+
+	//Filter used to convert the APU's output to the audio device's rate, sinc by default
+	void set_resampler_mode(Resampler::Mode mode);
+
+	//Advance the other components 1 M-cycle. Components only run when one of their scheduled events is due
 	void tick_other_components();
 
-	int get_t_cycle_count();
+	uint64_t get_t_cycle_count();
+
+	//The CPU that owns IE and IF and runs from run()
+	CPU& get_cpu();
 
 	//Request vblank interrupt
 	void int_vblank();
@@ -64,7 +125,50 @@ private:
 
 	Input input;
 
+	Scheduler scheduler;
+
+	BlockCache block_cache;
+
+	JIT jit;
+
+	IdleSkip idle_skip;
+
+	Benchmark benchmark;
+
+	FramePacer pacer;
+
+	AudioOutput audio_output;
+
+	Resampler resampler;
+
+	bool audio_enabled;
+
+	bool audio_sync;
+
+	int audio_latency_ms;
+
+	//APU output and the same audio at the device's rate
+	std::vector<int16_t> apu_buffer;
+	std::vector<int16_t> audio_buffer;
+
+	uint64_t frame_limit;
+
+	bool uncapped;
+
+	//Number of times each scheduled event has run
+	uint64_t event_counts[(int)Event::COUNT];
+
 	uint8_t OAM_DMA;
 
-	int t_cycle_count;
+	uint64_t t_cycle_count;
+
+	//Run every event that is due at or before t_cycle_count
+	void run_events();
+
+	//Advance t_cycle_count by whole M-cycles to just before the next scheduled event.
+	// Only valid while nothing but the scheduled events can change state, e.g. while the CPU is halted
+	void skip_to_next_event();
+
+	//Read the APU's output up to now and queue it on the audio device
+	void queue_audio();
 };
\ No newline at end of file
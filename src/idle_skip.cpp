@@ -0,0 +1,403 @@
+#include "idle_skip.h"
+#include "gb.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+//Register bits use the r field of the opcode, 0:B 1:C 2:D 3:E 4:H 5:L 7:A. 6 is (HL) so it is never set
+static const uint16_t REG_B = 1 << 0;
+static const uint16_t REG_C = 1 << 1;
+static const uint16_t REG_D = 1 << 2;
+static const uint16_t REG_E = 1 << 3;
+static const uint16_t REG_H = 1 << 4;
+static const uint16_t REG_L = 1 << 5;
+static const uint16_t REG_A = 1 << 7;
+//Only Z and C are ever read by the ops a loop can contain
+static const uint16_t FLAG_Z = 1 << 8;
+static const uint16_t FLAG_C = 1 << 9;
+
+//Loops longer than this are doing real work
+static const int MAX_LOOP_OPS = 16;
+
+enum class MemRead {
+	None,
+	HL,
+	BC,
+	DE,
+	A16,
+	A8,
+	C
+};
+
+struct OpInfo {
+	uint16_t reads;
+	uint16_t writes;
+	MemRead mem;
+	bool branch;
+};
+
+//Register and flag use of an op a loop can contain. False for anything that writes memory, touches the stack,
+// changes the interrupt state or reads a register it also writes (INC, DEC, HL+ and HL-)
+static bool get_op_info(uint16_t opcode, OpInfo& info) {
+	info.reads = 0;
+	info.writes = 0;
+	info.mem = MemRead::None;
+	info.branch = false;
+
+	//BIT b, r leaves C alone
+	if (opcode >= 0x140 && opcode <= 0x17F) {
+		int src = opcode & 7;
+		if (src == 6) {
+			info.reads = REG_H | REG_L;
+			info.mem = MemRead::HL;
+		}
+		else {
+			info.reads = 1 << src;
+		}
+		info.writes = FLAG_Z;
+		return true;
+	}
+	if (opcode > 0xFF) {
+		return false;
+	}
+
+	//LD r, r' and LD r, (HL). 70-77 are the stores and HALT
+	if (opcode >= 0x40 && opcode <= 0x7F && (opcode & 0xF8) != 0x70) {
+		int src = opcode & 7;
+		if (src == 6) {
+			info.reads = REG_H | REG_L;
+			info.mem = MemRead::HL;
+		}
+		else {
+			info.reads = 1 << src;
+		}
+		info.writes = 1 << ((opcode >> 3) & 7);
+		return true;
+	}
+
+	//ALU A, r and ALU A, (HL)
+	if (opcode >= 0x80 && opcode <= 0xBF) {
+		int src = opcode & 7;
+		if (src == 6) {
+			info.reads = REG_H | REG_L;
+			info.mem = MemRead::HL;
+		}
+		else {
+			info.reads = 1 << src;
+		}
+		int alu = (opcode >> 3) & 7;
+		info.reads |= REG_A;
+		//ADC and SBC
+		if (alu == 1 || alu == 3) {
+			info.reads |= FLAG_C;
+		}
+		info.writes = FLAG_Z | FLAG_C;
+		//CP only sets flags
+		if (alu != 7) {
+			info.writes |= REG_A;
+		}
+		return true;
+	}
+
+	switch (opcode) {
+	case 0x00:
+		return true;
+	//LD r, n8
+	case 0x06: case 0x0E: case 0x16: case 0x1E: case 0x26: case 0x2E: case 0x3E:
+		info.writes = 1 << ((opcode >> 3) & 7);
+		return true;
+	//LD A, (BC) and LD A, (DE)
+	case 0x0A:
+		info.reads = REG_B | REG_C;
+		info.writes = REG_A;
+		info.mem = MemRead::BC;
+		return true;
+	case 0x1A:
+		info.reads = REG_D | REG_E;
+		info.writes = REG_A;
+		info.mem = MemRead::DE;
+		return true;
+	//LDH A, (a8), LD A, (C) and LD A, (a16)
+	case 0xF0:
+		info.writes = REG_A;
+		info.mem = MemRead::A8;
+		return true;
+	case 0xF2:
+		info.reads = REG_C;
+		info.writes = REG_A;
+		info.mem = MemRead::C;
+		return true;
+	case 0xFA:
+		info.writes = REG_A;
+		info.mem = MemRead::A16;
+		return true;
+	//ALU A, n8
+	case 0xC6: case 0xD6: case 0xE6: case 0xEE: case 0xF6: case 0xFE:
+		info.reads = REG_A;
+		info.writes = FLAG_Z | FLAG_C | (opcode == 0xFE ? 0 : REG_A);
+		return true;
+	case 0xCE: case 0xDE:
+		info.reads = REG_A | FLAG_C;
+		info.writes = FLAG_Z | FLAG_C | REG_A;
+		return true;
+	//JR and JP
+	case 0x18: case 0xC3:
+		info.branch = true;
+		return true;
+	case 0x20: case 0x28: case 0xC2: case 0xCA:
+		info.reads = FLAG_Z;
+		info.branch = true;
+		return true;
+	case 0x30: case 0x38: case 0xD2: case 0xDA:
+		info.reads = FLAG_C;
+		info.branch = true;
+		return true;
+	default:
+		return false;
+	}
+}
+
+IdleSkip::IdleSkip(GB* in_gb) {
+	gb = in_gb;
+	enabled = true;
+	skipped_cycles = 0;
+	skips = 0;
+	rom_denied = false;
+	last_block = nullptr;
+	last_end = 0;
+	last_limit = 0;
+}
+
+bool IdleSkip::load_list(const char* path, const std::string& rom_title) {
+	std::ifstream file(path);
+	if (!file) {
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		//The title can have spaces so everything before the allow/deny keyword is the title
+		std::istringstream tokens(line);
+		std::string token;
+		std::string title;
+		bool allow = false;
+		bool found_keyword = false;
+		while (tokens >> token) {
+			if (token == "allow" || token == "deny") {
+				allow = token == "allow";
+				found_keyword = true;
+				break;
+			}
+			title += title.empty() ? token : " " + token;
+		}
+		if (!found_keyword) {
+			LOG_WARN("Idle skip list: no allow or deny in line: %s", line.c_str());
+			continue;
+		}
+		if (title != rom_title) {
+			continue;
+		}
+
+		std::vector<uint16_t>& loops = allow ? allowed_loops : denied_loops;
+		size_t listed = loops.size();
+		while (tokens >> token) {
+			char* end;
+			unsigned long pc = strtoul(token.c_str(), &end, 16);
+			if (*end != '\0' || pc > 0xFFFF) {
+				LOG_WARN("Idle skip list: bad loop address %s for %s", token.c_str(), title.c_str());
+				continue;
+			}
+			loops.push_back((uint16_t)pc);
+		}
+		if (!allow && loops.size() == listed) {
+			rom_denied = true;
+		}
+	}
+
+	LOG("Idle skip list: %s%zu allowed loops, %zu denied loops for %s", rom_denied ? "skipping disabled, " : "",
+		allowed_loops.size(), denied_loops.size(), rom_title.c_str());
+	return true;
+}
+
+bool IdleSkip::is_idle_loop(const Block& block) {
+	if (block.ops.size() > MAX_LOOP_OPS) {
+		return false;
+	}
+
+	OpInfo info[MAX_LOOP_OPS];
+	uint16_t written = 0;
+	int length = 0;
+	for (size_t i = 0; i < block.ops.size(); i++) {
+		if (!get_op_info(block.ops[i].opcode, info[i])) {
+			return false;
+		}
+		written |= info[i].writes;
+		length += block.ops[i].length;
+	}
+
+	//Has to end by branching back to the start
+	const MicroOp& last = block.ops.back();
+	if (!info[block.ops.size() - 1].branch) {
+		return false;
+	}
+	if (last.opcode == 0xC3 || (last.opcode & 0xE7) == 0xC2) {
+		if (last.immediate != block.start_pc) {
+			return false;
+		}
+	}
+	else if ((uint16_t)(block.start_pc + length + (int8_t)last.immediate) != block.start_pc) {
+		return false;
+	}
+
+	//Every iteration has to behave the same, so a register written in the loop can't be read before it is written
+	// and the registers addressing memory can't change at all
+	uint16_t defined = 0;
+	for (size_t i = 0; i < block.ops.size(); i++) {
+		if (info[i].reads & written & ~defined) {
+			return false;
+		}
+		uint16_t address_regs = 0;
+		switch (info[i].mem) {
+		case MemRead::HL: address_regs = REG_H | REG_L; break;
+		case MemRead::BC: address_regs = REG_B | REG_C; break;
+		case MemRead::DE: address_regs = REG_D | REG_E; break;
+		case MemRead::C: address_regs = REG_C; break;
+		default: break;
+		}
+		if (address_regs & written) {
+			return false;
+		}
+		defined |= info[i].writes;
+	}
+	return true;
+}
+
+void IdleSkip::after_block(CPU& cpu, const Block* block, uint64_t start) {
+	if (!enabled || rom_denied || cpu.regs.PC != block->start_pc) {
+		last_block = nullptr;
+		return;
+	}
+	//Anything that makes tick() do more than run the next block
+	if (cpu.halted || cpu.ei_scheduled || gb->ppu.frame_done) {
+		last_block = nullptr;
+		return;
+	}
+	if (cpu.interrupt_master_enable && (cpu.interrupt_enable & cpu.interrupt_flag & 0x1F) != 0) {
+		last_block = nullptr;
+		return;
+	}
+
+	//Find how long everything the loop reads stays the same. The address registers aren't written in the loop
+	// so the current values are the ones it read from
+	uint64_t now = gb->t_cycle_count;
+	uint64_t limit = gb->scheduler.next_event_time();
+	for (const MicroOp& op : block->ops) {
+		OpInfo info;
+		get_op_info(op.opcode, info);
+
+		uint16_t addr;
+		switch (info.mem) {
+		case MemRead::None: continue;
+		case MemRead::HL: addr = cpu.regs.HL.word; break;
+		case MemRead::BC: addr = cpu.regs.BC.word; break;
+		case MemRead::DE: addr = cpu.regs.DE.word; break;
+		case MemRead::A16: addr = op.immediate; break;
+		case MemRead::A8: addr = 0xFF00 | op.immediate; break;
+		case MemRead::C: addr = 0xFF00 | cpu.regs.BC.low; break;
+		default: continue;
+		}
+		if (!limit_read(addr, limit)) {
+			last_block = nullptr;
+			return;
+		}
+	}
+
+	//This iteration only read values that were already stable when the last one ended, so the following
+	// iterations up to the limit read the same values and take the same path
+	bool stable = block == last_block && start == last_end && now < last_limit;
+	last_block = block;
+	last_end = now;
+	last_limit = limit;
+
+	if (!stable || !loop_allowed(block->start_pc) || limit == NEVER || limit <= now) {
+		return;
+	}
+
+	//Every memory read of a skipped iteration has to land before the limit so the next iteration that
+	// really runs is the first one that can see the change
+	uint64_t iteration_cycles = now - start;
+	uint64_t iterations = (limit - now - 1) / iteration_cycles;
+	if (iterations == 0) {
+		return;
+	}
+
+	gb->t_cycle_count += iterations * iteration_cycles;
+	last_end = gb->t_cycle_count;
+	skipped_cycles += iterations * iteration_cycles;
+	skips++;
+}
+
+bool IdleSkip::limit_read(uint16_t addr, uint64_t& limit) {
+	//ROM and WRAM only change when the CPU writes them. Cartridge RAM is left out since an RTC can tick on its own
+	if (addr < 0x8000) {
+		return true;
+	}
+	if (addr < 0xA000) {
+		limit = std::min(limit, gb->ppu.next_change_time());
+		return true;
+	}
+	if (addr < 0xC000) {
+		return false;
+	}
+	if (addr < 0xFE00) {
+		return true;
+	}
+	//OAM reads depend on the PPU mode
+	if (addr < 0xFEA0) {
+		limit = std::min(limit, gb->ppu.next_change_time());
+		return true;
+	}
+	//Unusable memory, HRAM and IE
+	if (addr < 0xFF00 || addr >= 0xFF80) {
+		return true;
+	}
+
+	switch (addr & 0x7F) {
+	//DIV and TIMA
+	case 0x04:
+	case 0x05:
+		limit = std::min(limit, gb->timer.next_change_time(gb->t_cycle_count));
+		return true;
+	case 0x41:
+		limit = std::min(limit, gb->ppu.next_change_time());
+		return true;
+	case 0x44:
+		limit = std::min(limit, gb->ppu.next_line_time());
+		return true;
+	//Only changed by CPU writes or scheduled events
+	case 0x06: case 0x07: case 0x0F:
+	case 0x40: case 0x42: case 0x43: case 0x45: case 0x46: case 0x47: case 0x48: case 0x49: case 0x4A: case 0x4B:
+		return true;
+	//Joypad, serial, APU and anything unmapped
+	default:
+		return false;
+	}
+}
+
+bool IdleSkip::loop_allowed(uint16_t pc) {
+	if (std::find(denied_loops.begin(), denied_loops.end(), pc) != denied_loops.end()) {
+		return false;
+	}
+	return allowed_loops.empty() || std::find(allowed_loops.begin(), allowed_loops.end(), pc) != allowed_loops.end();
+}
+
+void IdleSkip::print_stats() {
+	double skipped_percent = gb->t_cycle_count > 0 ? 100.0 * skipped_cycles / gb->t_cycle_count : 0;
+	LOG("Idle skip: %llu T-cycles skipped (%.2f%% of emulated time) in %llu skips",
+		(unsigned long long)skipped_cycles, skipped_percent, (unsigned long long)skips);
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "common.h"
+#include <vector>
+#include <string>
+
+//Forward declaration
+class GB;
+class CPU;
+struct Block;
+
+//Detects busy-wait loops that poll memory until an interrupt handler, the PPU or the timer changes it,
+// e.g. ld a,(ff44); cp n; jr nz or ldh a,(flag); and a; jr z, and fast forwards them.
+//A loop qualifies if it is a single cached block that branches back to its own start, only reads memory and writes
+// every register before reading it, so each iteration does exactly the same thing as the last until a value it reads changes.
+//Once an iteration has run without anything it reads changing, the iterations before the next scheduled event,
+// PPU mode or line change or timer step are skipped by adding their cycles to the cycle count.
+//
+//Per ROM overrides are read from a list file with one ROM per line:
+// <ROM title> allow|deny [loop start addresses in hex]
+//deny without addresses turns skipping off for the ROM, deny with addresses never skips those loops and
+// allow with addresses only skips those loops. Lines starting with # are comments.
+class IdleSkip {
+public:
+	IdleSkip(GB* in_gb);
+
+	//Read the overrides for the ROM titled rom_title from the list at path. False if the list can't be opened
+	bool load_list(const char* path, const std::string& rom_title);
+
+	//True if the decoded block is a loop that can be skipped
+	static bool is_idle_loop(const Block& block);
+
+	//Called after cpu ran an idle loop block, start is the T-cycle it started on
+	void after_block(CPU& cpu, const Block* block, uint64_t start);
+
+	//Log skip statistics
+	void print_stats();
+
+	//Skipping can be turned off from the command line, the list can also turn it off for one ROM
+	bool enabled;
+
+	//Statistics
+	uint64_t skipped_cycles;
+	uint64_t skips;
+
+private:
+	GB* gb;
+
+	//From the list
+	bool rom_denied;
+	std::vector<uint16_t> allowed_loops;
+	std::vector<uint16_t> denied_loops;
+
+	//Last iteration that ran, when it ended and the T-cycle the values it read stay the same until
+	const Block* last_block;
+	uint64_t last_end;
+	uint64_t last_limit;
+
+	//Lower limit to the T-cycle the value at addr can next change.
+	// False if it can change at any time, e.g. joypad and serial
+	bool limit_read(uint16_t addr, uint64_t& limit);
+
+	bool loop_allowed(uint16_t pc);
+};
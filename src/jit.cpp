@@ -0,0 +1,913 @@
+#include "jit.h"
+#include "gb.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X64 1
+#else
+#define JIT_X64 0
+#endif
+
+#if JIT_X64
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+//Size of the executable code buffer
+static const size_t CODE_BUFFER_SIZE = 8 * 1024 * 1024;
+
+//Lookups before a block is compiled, keeps code that only runs once or twice out of the code buffer
+static const uint32_t HOT_COUNT = 16;
+
+#if JIT_X64
+
+namespace {
+
+enum Reg {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15,
+	NO_REG = -1
+};
+
+//Argument registers and the stack space the callee may use for them
+#ifdef _WIN32
+const Reg ARG0 = RCX;
+const Reg ARG1 = RDX;
+const Reg ARG2 = R8;
+const int SHADOW_SPACE = 32;
+#else
+const Reg ARG0 = RDI;
+const Reg ARG1 = RSI;
+const Reg ARG2 = RDX;
+const int SHADOW_SPACE = 0;
+#endif
+
+//Condition codes for jcc and setcc
+enum Condition {
+	CC_B = 0x2,
+	CC_E = 0x4,
+	CC_NE = 0x5
+};
+
+//Memory operand [base + index * scale + disp]
+struct Mem {
+	Reg base;
+	Reg index;
+	int scale;
+	int32_t disp;
+};
+
+Mem mem(Reg base, int32_t disp) {
+	return { base, NO_REG, 1, disp };
+}
+
+Mem mem_index(Reg base, Reg index, int scale, int32_t disp) {
+	return { base, index, scale, disp };
+}
+
+//Minimal x86-64 assembler for the instructions the translator needs.
+//Memory operands always use a 32 bit displacement, code size doesn't matter much next to the calls
+class Emitter {
+public:
+	Emitter(uint8_t* in_buffer, size_t in_capacity) :
+		buffer(in_buffer),
+		capacity(in_capacity),
+		pos(0),
+		overflow(false)
+	{
+	}
+
+	size_t size() { return pos; }
+	bool overflowed() { return overflow; }
+
+	void byte(uint8_t value) {
+		if (pos < capacity) {
+			buffer[pos] = value;
+		}
+		else {
+			overflow = true;
+		}
+		pos++;
+	}
+
+	void word(uint16_t value) {
+		byte(value & 0xFF);
+		byte(value >> 8);
+	}
+
+	void dword(uint32_t value) {
+		word(value & 0xFFFF);
+		word(value >> 16);
+	}
+
+	void qword(uint64_t value) {
+		dword(value & 0xFFFFFFFF);
+		dword(value >> 32);
+	}
+
+	//opcode with a reg field and a memory r/m operand
+	void op_mem(std::initializer_list<uint8_t> opcode, int reg, const Mem& m, bool wide, bool byte_reg = false, bool op16 = false) {
+		if (op16) {
+			byte(0x66);
+		}
+		uint8_t rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((m.index != NO_REG && (m.index & 8)) ? 2 : 0) | ((m.base & 8) ? 1 : 0);
+		if (rex != 0x40 || (byte_reg && reg >= 4 && reg < 8)) {
+			byte(rex);
+		}
+		for (uint8_t b : opcode) {
+			byte(b);
+		}
+
+		if (m.index == NO_REG && (m.base & 7) != 4) {
+			byte(0x80 | ((reg & 7) << 3) | (m.base & 7));
+		}
+		else {
+			int scale_bits = m.scale == 8 ? 3 : m.scale == 4 ? 2 : m.scale == 2 ? 1 : 0;
+			int index = m.index == NO_REG ? 4 : (m.index & 7);
+			byte(0x80 | ((reg & 7) << 3) | 4);
+			byte((scale_bits << 6) | (index << 3) | (m.base & 7));
+		}
+		dword((uint32_t)m.disp);
+	}
+
+	//opcode with a reg field and a register r/m operand
+	void op_reg(std::initializer_list<uint8_t> opcode, int reg, int rm, bool wide, bool byte_reg = false) {
+		uint8_t rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+		if (rex != 0x40 || (byte_reg && ((reg >= 4 && reg < 8) || (rm >= 4 && rm < 8)))) {
+			byte(rex);
+		}
+		for (uint8_t b : opcode) {
+			byte(b);
+		}
+		byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+	}
+
+	//Loads and stores
+	void movzx8(Reg dst, const Mem& m) { op_mem({ 0x0F, 0xB6 }, dst, m, false); }
+	void movzx16(Reg dst, const Mem& m) { op_mem({ 0x0F, 0xB7 }, dst, m, false); }
+	void load32(Reg dst, const Mem& m) { op_mem({ 0x8B }, dst, m, false); }
+	void load64(Reg dst, const Mem& m) { op_mem({ 0x8B }, dst, m, true); }
+	void store8(const Mem& m, Reg src) { op_mem({ 0x88 }, src, m, false, true); }
+	void store8_imm(const Mem& m, uint8_t value) { op_mem({ 0xC6 }, 0, m, false); byte(value); }
+	void store16_imm(const Mem& m, uint16_t value) { op_mem({ 0xC7 }, 0, m, false, false, true); word(value); }
+	void store64_imm(const Mem& m, int32_t value) { op_mem({ 0xC7 }, 0, m, true); dword((uint32_t)value); }
+
+	//Read-modify-write on memory
+	void add16_imm(const Mem& m, int8_t value) { op_mem({ 0x83 }, 0, m, false, false, true); byte((uint8_t)value); }
+	void add64_imm(const Mem& m, int8_t value) { op_mem({ 0x83 }, 0, m, true); byte((uint8_t)value); }
+	void and8_imm(const Mem& m, uint8_t value) { op_mem({ 0x80 }, 4, m, false); byte(value); }
+	void or8_imm(const Mem& m, uint8_t value) { op_mem({ 0x80 }, 1, m, false); byte(value); }
+
+	//Compares
+	void cmp8_imm(const Mem& m, uint8_t value) { op_mem({ 0x80 }, 7, m, false); byte(value); }
+	void cmp32(const Mem& m, Reg src) { op_mem({ 0x39 }, src, m, false); }
+	void cmp64(Reg dst, const Mem& m) { op_mem({ 0x3B }, dst, m, true); }
+	void and8(Reg dst, const Mem& m) { op_mem({ 0x22 }, dst, m, false, true); }
+	void test8_imm(Reg dst, uint8_t value) { op_reg({ 0xF6 }, 0, dst, false, true); byte(value); }
+	void test8(Reg a, Reg b) { op_reg({ 0x84 }, b, a, false, true); }
+	void test64(Reg a, Reg b) { op_reg({ 0x85 }, b, a, true); }
+	void setcc(Condition cc, Reg dst) { op_reg({ 0x0F, (uint8_t)(0x90 | cc) }, 0, dst, false, true); }
+
+	//Register to register
+	void mov32(Reg dst, Reg src) { op_reg({ 0x89 }, src, dst, false); }
+	void mov64(Reg dst, Reg src) { op_reg({ 0x89 }, src, dst, true); }
+	void movzx8(Reg dst, Reg src) { op_reg({ 0x0F, 0xB6 }, dst, src, false, true); }
+	void add32(Reg dst, Reg src) { op_reg({ 0x01 }, src, dst, false); }
+	void sub32(Reg dst, Reg src) { op_reg({ 0x29 }, src, dst, false); }
+	void and32(Reg dst, Reg src) { op_reg({ 0x21 }, src, dst, false); }
+	void or32(Reg dst, Reg src) { op_reg({ 0x09 }, src, dst, false); }
+	void xor32(Reg dst, Reg src) { op_reg({ 0x31 }, src, dst, false); }
+	void and32_imm(Reg dst, uint32_t value) { op_reg({ 0x81 }, 4, dst, false); dword(value); }
+	void or32_imm(Reg dst, uint32_t value) { op_reg({ 0x81 }, 1, dst, false); dword(value); }
+	void add32_imm(Reg dst, uint32_t value) { op_reg({ 0x81 }, 0, dst, false); dword(value); }
+	void shl32(Reg dst, uint8_t count) { op_reg({ 0xC1 }, 4, dst, false); byte(count); }
+	void shr32(Reg dst, uint8_t count) { op_reg({ 0xC1 }, 5, dst, false); byte(count); }
+
+	void mov32_imm(Reg dst, uint32_t value) {
+		if (dst & 8) {
+			byte(0x41);
+		}
+		byte(0xB8 + (dst & 7));
+		dword(value);
+	}
+
+	void mov64_imm(Reg dst, uint64_t value) {
+		byte(0x48 | ((dst & 8) ? 1 : 0));
+		byte(0xB8 + (dst & 7));
+		qword(value);
+	}
+
+	//Stack and calls
+	void push(Reg reg) {
+		if (reg & 8) {
+			byte(0x41);
+		}
+		byte(0x50 + (reg & 7));
+	}
+
+	void pop(Reg reg) {
+		if (reg & 8) {
+			byte(0x41);
+		}
+		byte(0x58 + (reg & 7));
+	}
+
+	void sub_rsp(uint8_t value) { op_reg({ 0x83 }, 5, RSP, true); byte(value); }
+	void add_rsp(uint8_t value) { op_reg({ 0x83 }, 0, RSP, true); byte(value); }
+	void call(Reg reg) { op_reg({ 0xFF }, 2, reg, false); }
+	void ret() { byte(0xC3); }
+
+	//Forward jumps, return the position of the rel32 to patch with bind()
+	size_t jcc(Condition cc) {
+		byte(0x0F);
+		byte(0x80 | cc);
+		dword(0);
+		return pos - 4;
+	}
+
+	size_t jmp() {
+		byte(0xE9);
+		dword(0);
+		return pos - 4;
+	}
+
+	//Point the jump at patch to the current position
+	void bind(size_t patch) {
+		int32_t rel = (int32_t)(pos - (patch + 4));
+		if (patch + 4 <= capacity) {
+			memcpy(buffer + patch, &rel, 4);
+		}
+	}
+
+private:
+	uint8_t* buffer;
+	size_t capacity;
+	size_t pos;
+	bool overflow;
+};
+
+//Offsets of everything compiled code touches, from the CPU* in rbx or the GB* in rbp
+struct Offsets {
+	int32_t reg8[8];
+	int32_t reg16[4];
+	int32_t A;
+	int32_t F;
+	int32_t flag_op;
+	int32_t PC;
+	int32_t current_op;
+	int32_t halted;
+	int32_t ei_scheduled;
+	int32_t interrupt_master_enable;
+	int32_t interrupt_enable;
+	int32_t interrupt_flag;
+
+	int32_t t_cycle_count;
+	int32_t next_event_time;
+	int32_t read_page;
+	int32_t write_page;
+	int32_t frame_done;
+	int32_t generation;
+	int32_t ops_executed;
+};
+
+//Emits the native code for one block.
+//rbx holds the CPU*, rbp the GB* and r12d the block cache generation when the block started
+class Translator {
+public:
+	Translator(Emitter& in_e, const Offsets& in_o, void* in_run_events, void* in_read_slow, void* in_write_slow, void* in_materialize_flags) :
+		e(in_e),
+		o(in_o),
+		run_events(in_run_events),
+		read_slow(in_read_slow),
+		write_slow(in_write_slow),
+		materialize_flags(in_materialize_flags)
+	{
+	}
+
+	void prologue() {
+		e.push(RBX);
+		e.push(RBP);
+		e.push(R12);
+		if (SHADOW_SPACE > 0) {
+			e.sub_rsp(SHADOW_SPACE);
+		}
+		e.mov64(RBX, ARG0);
+	}
+
+	void load_gb(GB* gb) {
+		e.mov64_imm(RBP, (uint64_t)gb);
+		e.load32(R12, mem(RBP, o.generation));
+	}
+
+	void epilogue() {
+		for (size_t patch : exits) {
+			e.bind(patch);
+		}
+		e.store64_imm(mem(RBX, o.current_op), 0);
+		if (SHADOW_SPACE > 0) {
+			e.add_rsp(SHADOW_SPACE);
+		}
+		e.pop(R12);
+		e.pop(RBP);
+		e.pop(RBX);
+		e.ret();
+	}
+
+	//Native code for op, returns false without emitting anything if op isn't translated
+	bool native(const MicroOp& op) {
+		if (op.opcode >= 0x100) {
+			return native_CB(op);
+		}
+
+		int opcode = op.opcode;
+		int x = opcode >> 6;
+		int y = (opcode >> 3) & 7;
+		int z = opcode & 7;
+		int p = y >> 1;
+		int q = y & 1;
+
+		if (opcode == 0x00) {
+			//NOP
+			tick();
+		}
+		else if (x == 0 && z == 1 && q == 0) {
+			//LD rr,n16
+			tick();
+			tick();
+			tick();
+			e.store16_imm(mem(RBX, o.reg16[p]), op.immediate);
+		}
+		else if (x == 0 && z == 2) {
+			//LD (BC),A LD (DE),A LD (HL+),A LD (HL-),A and the loads the other way
+			int32_t addr = o.reg16[p < 2 ? p : 2];
+			tick();
+			tick();
+			e.movzx16(RCX, mem(RBX, addr));
+			if (q == 0) {
+				e.movzx8(R9, mem(RBX, o.A));
+				write();
+			}
+			else {
+				read();
+				e.store8(mem(RBX, o.A), RAX);
+			}
+			if (p == 2) {
+				e.add16_imm(mem(RBX, o.reg16[2]), 1);
+			}
+			else if (p == 3) {
+				e.add16_imm(mem(RBX, o.reg16[2]), -1);
+			}
+		}
+		else if (x == 0 && z == 3) {
+			//INC rr, DEC rr
+			tick();
+			tick();
+			e.add16_imm(mem(RBX, o.reg16[p]), q == 0 ? 1 : -1);
+		}
+		else if (x == 0 && (z == 4 || z == 5) && y != 6) {
+			//INC r, DEC r
+			tick();
+			inc_dec(o.reg8[y], z == 5);
+		}
+		else if (x == 0 && z == 6) {
+			tick();
+			tick();
+			if (y != 6) {
+				//LD r,n8
+				e.store8_imm(mem(RBX, o.reg8[y]), (uint8_t)op.immediate);
+			}
+			else {
+				//LD (HL),n8
+				tick();
+				e.movzx16(RCX, mem(RBX, o.reg16[2]));
+				e.mov32_imm(R9, (uint8_t)op.immediate);
+				write();
+			}
+		}
+		else if (x == 1 && opcode != 0x76) {
+			tick();
+			if (z == 6) {
+				//LD r,(HL)
+				tick();
+				e.movzx16(RCX, mem(RBX, o.reg16[2]));
+				read();
+				e.store8(mem(RBX, o.reg8[y]), RAX);
+			}
+			else if (y == 6) {
+				//LD (HL),r
+				tick();
+				e.movzx16(RCX, mem(RBX, o.reg16[2]));
+				e.movzx8(R9, mem(RBX, o.reg8[z]));
+				write();
+			}
+			else {
+				//LD r,r
+				e.movzx8(RAX, mem(RBX, o.reg8[z]));
+				e.store8(mem(RBX, o.reg8[y]), RAX);
+			}
+		}
+		else if (x == 2) {
+			//ALU A,r and ALU A,(HL)
+			tick();
+			if (z == 6) {
+				tick();
+				e.movzx16(RCX, mem(RBX, o.reg16[2]));
+				read();
+				e.mov32(RCX, RAX);
+			}
+			else {
+				e.movzx8(RCX, mem(RBX, o.reg8[z]));
+			}
+			alu(y);
+		}
+		else if (x == 3 && z == 6) {
+			//ALU A,n8
+			tick();
+			tick();
+			e.mov32_imm(RCX, (uint8_t)op.immediate);
+			alu(y);
+		}
+		else if (opcode == 0xE0 || opcode == 0xF0 || opcode == 0xEA || opcode == 0xFA) {
+			//LDH (n8),A LDH A,(n8) LD (n16),A LD A,(n16)
+			for (int i = 0; i < op.length + 1; i++) {
+				tick();
+			}
+			uint16_t addr = op.length == 2 ? 0xFF00 + (uint8_t)op.immediate : op.immediate;
+			e.mov32_imm(RCX, addr);
+			if (opcode == 0xE0 || opcode == 0xEA) {
+				e.movzx8(R9, mem(RBX, o.A));
+				write();
+			}
+			else {
+				read();
+				e.store8(mem(RBX, o.A), RAX);
+			}
+		}
+		else if (opcode == 0xE2 || opcode == 0xF2) {
+			//LD (C),A LD A,(C)
+			tick();
+			tick();
+			e.movzx8(RCX, mem(RBX, o.reg8[1]));
+			e.add32_imm(RCX, 0xFF00);
+			if (opcode == 0xE2) {
+				e.movzx8(R9, mem(RBX, o.A));
+				write();
+			}
+			else {
+				read();
+				e.store8(mem(RBX, o.A), RAX);
+			}
+		}
+		else {
+			return false;
+		}
+
+		e.add16_imm(mem(RBX, o.PC), op.length);
+		return true;
+	}
+
+	//Call the opcode_table handler like the interpreter does. Always the op's own handler, not a fused one,
+	// since the second op of a pair is compiled separately
+	void fallback(const MicroOp& op) {
+		for (int i = 0; i < op.fetch_length; i++) {
+			tick();
+		}
+		e.add16_imm(mem(RBX, o.PC), op.fetch_length);
+
+		e.mov64_imm(RAX, (uint64_t)&op);
+		e.op_mem({ 0x89 }, RAX, mem(RBX, o.current_op), true);
+		e.mov64(ARG0, RBX);
+		e.mov64_imm(RAX, (uint64_t)CPU::opcode_table[op.opcode]);
+		e.call(RAX);
+
+		//Native ops read and write F directly so the handler's lazy flags have to be written out
+		e.cmp8_imm(mem(RBX, o.flag_op), 0);
+		size_t flags_done = e.jcc(CC_E);
+		e.mov64(ARG0, RBX);
+		call(materialize_flags);
+		e.bind(flags_done);
+	}
+
+	//Leave the block when the interpreter's run_block() would stop after this op
+	void check_exit(bool may_halt) {
+		e.add64_imm(mem(RBP, o.ops_executed), 1);
+
+		if (may_halt) {
+			e.movzx8(RAX, mem(RBX, o.halted));
+			e.op_mem({ 0x0A }, RAX, mem(RBX, o.ei_scheduled), false, true);
+			e.test8(RAX, RAX);
+			exits.push_back(e.jcc(CC_NE));
+		}
+
+		e.cmp8_imm(mem(RBP, o.frame_done), 0);
+		exits.push_back(e.jcc(CC_NE));
+		e.cmp32(mem(RBP, o.generation), R12);
+		exits.push_back(e.jcc(CC_NE));
+
+		e.cmp8_imm(mem(RBX, o.interrupt_master_enable), 0);
+		size_t no_ime = e.jcc(CC_E);
+		e.movzx8(RAX, mem(RBX, o.interrupt_enable));
+		e.and8(RAX, mem(RBX, o.interrupt_flag));
+		e.test8_imm(RAX, 0x1F);
+		exits.push_back(e.jcc(CC_NE));
+		e.bind(no_ime);
+	}
+
+private:
+	Emitter& e;
+	const Offsets& o;
+	void* run_events;
+	void* read_slow;
+	void* write_slow;
+	void* materialize_flags;
+
+	//Jumps to the epilogue
+	std::vector<size_t> exits;
+
+	void call(void* function) {
+		e.mov64_imm(RAX, (uint64_t)function);
+		e.call(RAX);
+	}
+
+	//GB::tick_other_components()
+	void tick() {
+		e.add64_imm(mem(RBP, o.t_cycle_count), 4);
+		e.load64(RAX, mem(RBP, o.t_cycle_count));
+		e.cmp64(RAX, mem(RBP, o.next_event_time));
+		size_t skip = e.jcc(CC_B);
+		e.mov64(ARG0, RBP);
+		call(run_events);
+		e.bind(skip);
+	}
+
+	//eax = byte at ecx through the MMU page table, the cycle was already ticked
+	void read() {
+		e.mov32(RAX, RCX);
+		e.shr32(RAX, 8);
+		e.load64(RDX, mem_index(RBP, RAX, 8, o.read_page));
+		e.test64(RDX, RDX);
+		size_t slow = e.jcc(CC_E);
+		e.movzx8(RAX, RCX);
+		e.movzx8(RAX, mem_index(RDX, RAX, 1, 0));
+		size_t done = e.jmp();
+
+		e.bind(slow);
+		e.mov32(ARG1, RCX);
+		e.mov64(ARG0, RBP);
+		call(read_slow);
+		e.movzx8(RAX, RAX);
+		e.bind(done);
+	}
+
+	//Write r9b to ecx through the MMU page table, the cycle was already ticked
+	void write() {
+		e.mov32(RAX, RCX);
+		e.shr32(RAX, 8);
+		e.load64(RDX, mem_index(RBP, RAX, 8, o.write_page));
+		e.test64(RDX, RDX);
+		size_t slow = e.jcc(CC_E);
+		e.movzx8(RAX, RCX);
+		e.store8(mem_index(RDX, RAX, 1, 0), R9);
+		size_t done = e.jmp();
+
+		e.bind(slow);
+		e.mov32(ARG2, R9);
+		e.mov32(ARG1, RCX);
+		e.mov64(ARG0, RBP);
+		call(write_slow);
+		e.bind(done);
+	}
+
+	//r8d |= 0x80 if dl is zero
+	void zero_flag() {
+		e.xor32(R9, R9);
+		e.test8(RDX, RDX);
+		e.setcc(CC_E, R9);
+		e.shl32(R9, 7);
+		e.or32(R8, R9);
+	}
+
+	//F = (F & keep) | r8d
+	void store_flags(uint8_t keep) {
+		e.movzx8(R9, mem(RBX, o.F));
+		e.and32_imm(R9, keep);
+		e.or32(R8, R9);
+		e.store8(mem(RBX, o.F), R8);
+	}
+
+	//8 bit ALU op y on A with the operand in ecx
+	void alu(int y) {
+		e.movzx8(RAX, mem(RBX, o.A));
+
+		if (y == 4 || y == 5 || y == 6) {
+			//AND XOR OR
+			e.mov32(RDX, RAX);
+			if (y == 4) e.and32(RDX, RCX);
+			else if (y == 5) e.xor32(RDX, RCX);
+			else e.or32(RDX, RCX);
+			e.xor32(R8, R8);
+			zero_flag();
+			if (y == 4) {
+				e.or32_imm(R8, CPU::H);
+			}
+			store_flags(0x0F);
+			e.store8(mem(RBX, o.A), RDX);
+			return;
+		}
+
+		//ADD ADC SUB SBC CP. edx is the full result so bit 8 is the carry or borrow
+		bool uses_carry = y == 1 || y == 3;
+		if (uses_carry) {
+			e.movzx8(RDX, mem(RBX, o.F));
+			e.shr32(RDX, 4);
+			e.and32_imm(RDX, 1);
+		}
+		if (y == 0 || y == 1) {
+			if (y == 0) {
+				e.mov32(RDX, RAX);
+			}
+			else {
+				e.add32(RDX, RAX);
+			}
+			e.add32(RDX, RCX);
+		}
+		else {
+			if (uses_carry) {
+				e.mov32(R8, RDX);
+			}
+			e.mov32(RDX, RAX);
+			e.sub32(RDX, RCX);
+			if (uses_carry) {
+				e.sub32(RDX, R8);
+			}
+		}
+
+		//Half carry is bit 4 of a ^ operand ^ result, moved to bit 5
+		e.mov32(R8, RAX);
+		e.xor32(R8, RCX);
+		e.xor32(R8, RDX);
+		e.and32_imm(R8, 0x10);
+		e.shl32(R8, 1);
+		//Carry is bit 8 of the result, moved to bit 4
+		e.mov32(R9, RDX);
+		e.shr32(R9, 4);
+		e.and32_imm(R9, 0x10);
+		e.or32(R8, R9);
+		zero_flag();
+		if (y >= 2) {
+			e.or32_imm(R8, CPU::N);
+		}
+		store_flags(0x0F);
+		if (y != 7) {
+			e.store8(mem(RBX, o.A), RDX);
+		}
+	}
+
+	//INC r or DEC r, carry is left alone
+	void inc_dec(int32_t reg, bool dec) {
+		e.movzx8(RAX, mem(RBX, reg));
+		e.mov32(RDX, RAX);
+		e.add32_imm(RDX, dec ? 0xFFFFFFFF : 1);
+		e.mov32(R8, RAX);
+		e.xor32(R8, RDX);
+		e.and32_imm(R8, 0x10);
+		e.shl32(R8, 1);
+		zero_flag();
+		if (dec) {
+			e.or32_imm(R8, CPU::N);
+		}
+		store_flags(0x1F);
+		e.store8(mem(RBX, reg), RDX);
+	}
+
+	//BIT, RES and SET on registers
+	bool native_CB(const MicroOp& op) {
+		int x = (op.opcode >> 6) & 3;
+		int y = (op.opcode >> 3) & 7;
+		int z = op.opcode & 7;
+		if (x == 0 || z == 6) {
+			return false;
+		}
+
+		tick();
+		tick();
+		if (x == 1) {
+			e.movzx8(RAX, mem(RBX, o.reg8[z]));
+			e.xor32(R8, R8);
+			e.test8_imm(RAX, 1 << y);
+			e.setcc(CC_E, R8);
+			e.shl32(R8, 7);
+			e.or32_imm(R8, CPU::H);
+			store_flags(0x1F);
+		}
+		else if (x == 2) {
+			e.and8_imm(mem(RBX, o.reg8[z]), ~(1 << y));
+		}
+		else {
+			e.or8_imm(mem(RBX, o.reg8[z]), 1 << y);
+		}
+
+		e.add16_imm(mem(RBX, o.PC), op.length);
+		return true;
+	}
+};
+
+} //namespace
+
+#endif
+
+JIT::JIT(GB* in_gb) :
+	gb(in_gb)
+{
+	blocks_compiled = 0;
+	blocks_rejected = 0;
+	native_ops = 0;
+	fallback_ops = 0;
+	native_runs = 0;
+	flushes = 0;
+	code = nullptr;
+	code_size = 0;
+	code_used = 0;
+}
+
+JIT::~JIT() {
+#if JIT_X64
+	if (code != nullptr) {
+#ifdef _WIN32
+		VirtualFree(code, 0, MEM_RELEASE);
+#else
+		munmap(code, code_size);
+#endif
+	}
+#endif
+}
+
+bool JIT::is_supported() {
+#if JIT_X64
+	//The code buffer is only allocated once the JIT is used
+	if (code == nullptr && code_size == 0) {
+#ifdef _WIN32
+		void* memory = VirtualAlloc(nullptr, CODE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+		void* memory = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED) {
+			memory = nullptr;
+		}
+#endif
+		if (memory == nullptr) {
+			LOG_ERROR("Failed to allocate executable memory for the JIT");
+			//Don't try again
+			code_size = 1;
+			return false;
+		}
+		code = (uint8_t*)memory;
+		code_size = CODE_BUFFER_SIZE;
+	}
+	return code != nullptr;
+#else
+	return false;
+#endif
+}
+
+bool JIT::run(CPU& cpu, Block* block) {
+	if (block->native_code == nullptr) {
+		if (block->jit_rejected || ++block->exec_count < HOT_COUNT || !is_supported()) {
+			return false;
+		}
+
+		//Self-modifying code would just be compiled over and over, the interpreter handles it
+		if (gb->block_cache.has_self_modifying_code(block)) {
+			block->jit_rejected = true;
+			blocks_rejected++;
+			return false;
+		}
+
+		if (!compile(cpu, block)) {
+			flush();
+			if (!compile(cpu, block)) {
+				LOG_ERROR("Block at 0x%X is too large for the JIT", block->start_pc);
+				block->jit_rejected = true;
+				blocks_rejected++;
+				return false;
+			}
+		}
+	}
+
+	typedef void (*NativeBlock)(CPU* cpu);
+	((NativeBlock)block->native_code)(&cpu);
+	native_runs++;
+	return true;
+}
+
+void JIT::flush() {
+	gb->block_cache.clear_native_code();
+	code_used = 0;
+	flushes++;
+}
+
+void JIT::print_stats() {
+	LOG("JIT: %llu blocks compiled, %llu left to the interpreter, %llu native runs, %llu flushes",
+		(unsigned long long)blocks_compiled, (unsigned long long)blocks_rejected, (unsigned long long)native_runs, (unsigned long long)flushes);
+	double native_percent = native_ops + fallback_ops > 0 ? 100.0 * native_ops / (native_ops + fallback_ops) : 0;
+	LOG("JIT: %.2f%% of compiled ops translated natively, %zu KB of code", native_percent, code_used / 1024);
+}
+
+bool JIT::compile(CPU& cpu, Block* block) {
+#if JIT_X64
+	auto cpu_offset = [&](const void* field) {
+		return (int32_t)((const uint8_t*)field - (const uint8_t*)&cpu);
+	};
+	auto gb_offset = [&](const void* field) {
+		return (int32_t)((const uint8_t*)field - (const uint8_t*)gb);
+	};
+
+	Offsets o;
+	o.reg8[0] = cpu_offset(&cpu.regs.BC.high);
+	o.reg8[1] = cpu_offset(&cpu.regs.BC.low);
+	o.reg8[2] = cpu_offset(&cpu.regs.DE.high);
+	o.reg8[3] = cpu_offset(&cpu.regs.DE.low);
+	o.reg8[4] = cpu_offset(&cpu.regs.HL.high);
+	o.reg8[5] = cpu_offset(&cpu.regs.HL.low);
+	o.reg8[6] = 0;
+	o.reg8[7] = cpu_offset(&cpu.regs.AF.high);
+	o.reg16[0] = cpu_offset(&cpu.regs.BC.word);
+	o.reg16[1] = cpu_offset(&cpu.regs.DE.word);
+	o.reg16[2] = cpu_offset(&cpu.regs.HL.word);
+	o.reg16[3] = cpu_offset(&cpu.regs.SP.word);
+	o.A = cpu_offset(&cpu.regs.AF.high);
+	o.F = cpu_offset(&cpu.regs.AF.low);
+	o.flag_op = cpu_offset(&cpu.flag_op);
+	o.PC = cpu_offset(&cpu.regs.PC);
+	o.current_op = cpu_offset(&cpu.current_op);
+	o.halted = cpu_offset(&cpu.halted);
+	o.ei_scheduled = cpu_offset(&cpu.ei_scheduled);
+	o.interrupt_master_enable = cpu_offset(&cpu.interrupt_master_enable);
+	o.interrupt_enable = cpu_offset(&cpu.interrupt_enable);
+	o.interrupt_flag = cpu_offset(&cpu.interrupt_flag);
+	o.t_cycle_count = gb_offset(&gb->t_cycle_count);
+	o.next_event_time = gb_offset(&gb->scheduler.next_time);
+	o.read_page = gb_offset(&gb->mmu.read_page[0]);
+	o.write_page = gb_offset(&gb->mmu.write_page[0]);
+	o.frame_done = gb_offset(&gb->ppu.frame_done);
+	o.generation = gb_offset(&gb->block_cache.generation);
+	o.ops_executed = gb_offset(&gb->block_cache.ops_executed);
+
+	Emitter e(code + code_used, code_size - code_used);
+	Translator t(e, o, (void*)&JIT::run_events, (void*)&JIT::read_slow, (void*)&JIT::write_slow, (void*)&JIT::materialize_flags);
+
+	t.prologue();
+	t.load_gb(gb);
+
+	uint64_t translated = 0;
+	for (const MicroOp& op : block->ops) {
+		if (t.native(op)) {
+			translated++;
+			t.check_exit(false);
+		}
+		else {
+			t.fallback(op);
+			t.check_exit(true);
+		}
+	}
+	t.epilogue();
+
+	if (e.overflowed()) {
+		return false;
+	}
+
+	block->native_code = code + code_used;
+	//Keep blocks 16 byte aligned
+	code_used = (code_used + e.size() + 15) & ~(size_t)15;
+	if (code_used > code_size) {
+		code_used = code_size;
+	}
+
+	blocks_compiled++;
+	native_ops += translated;
+	fallback_ops += block->ops.size() - translated;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void JIT::run_events(GB* gb) {
+	gb->run_events();
+}
+
+uint8_t JIT::read_slow(GB* gb, uint16_t addr) {
+	return gb->mmu.read_slow(addr);
+}
+
+void JIT::write_slow(GB* gb, uint16_t addr, uint8_t byte) {
+	gb->mmu.write_slow(addr, byte);
+}
+
+void JIT::materialize_flags(CPU* cpu) {
+	cpu->materialize_flags();
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "common.h"
+#include "block_cache.h"
+
+//Forward declaration
+class GB;
+class CPU;
+
+//Dynamic recompiler that turns hot blocks from the block cache into x86-64 code.
+//Register moves, 8 bit ALU ops, immediates and the common loads and stores are translated to native code,
+// everything else is compiled as a call to the opcode's opcode_table handler so any block can be compiled.
+//Every M-cycle still advances the other components at the same point as the interpreter and memory goes through
+// the MMU page tables, so a compiled block leaves the GB in exactly the state the interpreter would have.
+//Code from WRAM/HRAM pages that have been written over is left to the interpreter.
+//Only available on x86-64 hosts, is_supported() is false everywhere else.
+class JIT {
+public:
+	JIT(GB* in_gb);
+	~JIT();
+
+	//Owns the executable code buffer
+	JIT(const JIT&) = delete;
+	JIT& operator=(const JIT&) = delete;
+
+	//True if compiled code can run on this host
+	bool is_supported();
+
+	//Run block as native code, compiling it once it is hot.
+	// Returns false if nothing was run and the interpreter has to run the block instead
+	bool run(CPU& cpu, Block* block);
+
+	//Throw away all compiled code
+	void flush();
+
+	//Log compile statistics
+	void print_stats();
+
+	//Statistics
+	uint64_t blocks_compiled;
+	uint64_t blocks_rejected;
+	uint64_t native_ops;
+	uint64_t fallback_ops;
+	uint64_t native_runs;
+	uint64_t flushes;
+
+private:
+	GB* gb;
+
+	//Executable memory compiled blocks are appended to
+	uint8_t* code;
+	size_t code_size;
+	size_t code_used;
+
+	//Compile block to the end of the code buffer. False if the buffer is full
+	bool compile(CPU& cpu, Block* block);
+
+	//Called from compiled code
+	static void run_events(GB* gb);
+	static uint8_t read_slow(GB* gb, uint16_t addr);
+	static void write_slow(GB* gb, uint16_t addr, uint8_t byte);
+	static void materialize_flags(CPU* cpu);
+};
@@ -5,6 +5,7 @@
 #include "TextureBuffer.h"
 #include <thread>
 #include <chrono>
+#include <cstring>
 #include "3d.h"
 
 Cartridge* cart = new Cartridge();
@@ -14,18 +15,24 @@ void saveAtExit() {
 	cart->save();
 }
 
-//Fills texture buffer with default green color
+//Publishes a frame of the default green color. Only the emulator side may call this, it is the buffer's producer
 void resetTexBuffer(TextureBuffer* emuScreenTexBuffer) {
-	std::lock_guard<std::mutex> lock(emuScreenTexBuffer->mutex);
-
-	for (size_t i = 0; i < emuScreenTexBuffer->pixels.size(); i += 4)
-	{
-		emuScreenTexBuffer->pixels[i + 0] = 155;
-		emuScreenTexBuffer->pixels[i + 1] = 188;
-		emuScreenTexBuffer->pixels[i + 2] = 15;
-		emuScreenTexBuffer->pixels[i + 3] = 255;
+	uint8_t* pixels = emuScreenTexBuffer->back();
+
+	if (emuScreenTexBuffer->format == PixelFormat::Indexed8) {
+		//Shade 0 of the background palette, the lightest green in the renderer's default palette
+		memset(pixels, 0, emuScreenTexBuffer->frame_size());
+	}
+	else {
+		for (size_t i = 0; i < emuScreenTexBuffer->frame_size(); i += 4)
+		{
+			pixels[i + 0] = 155;
+			pixels[i + 1] = 188;
+			pixels[i + 2] = 15;
+			pixels[i + 3] = 255;
+		}
 	}
-	emuScreenTexBuffer->dirty = true;
+	emuScreenTexBuffer->publish();
 }
 
 int main(int argc, char* argv[]) {
@@ -33,14 +40,120 @@ int main(int argc, char* argv[]) {
 	atexit(SDL_Quit);
 	atexit(saveAtExit);
 
-	//TextureBuffer used by the emulator and 3d renderer
-	TextureBuffer emuScreenTexBuffer;
-	//Set size to screen w * h * 4 bytes for RGBA
-	emuScreenTexBuffer.pixels.resize(160 * 144 * 4);
-	emuScreenTexBuffer.width = 160;
-	emuScreenTexBuffer.height = 144;
+	//Optional flags after the ROM path
+	// --jit: run hot code through the x86-64 recompiler
+	// --no-idle-skip: run polling loops instead of fast forwarding them
+	// --idle-list <path>: per ROM idle skip overrides, idle_skip.cfg by default
+	// --pair-stats: log the most common opcode pairs on exit for tuning FUSED_PAIRS. Only counts interpreted blocks
+	// --headless: run without SDL or the 3d renderer and print benchmark results as JSON on exit.
+	//  The JSON is the only thing on stdout, logs go to stderr
+	// --frames <n>: with --headless, stop after n frames. 3600 by default
+	// --uncapped: don't pace frames to 59.737 FPS
+	// --spin-pacing: spin for the last 2 ms before each frame instead of sleeping through nearly all of it
+	// --audio-sync: pace emulation off the audio device instead of the wall clock
+	// --audio-latency <ms>: audio kept buffered ahead of the sound card, 60 by default
+	// --resampler <sinc|cubic|linear>: filter for converting audio to the sound card's rate, sinc by default
+	// --indexed-output: hand the renderer 1 byte palette indices per pixel and color them in the screen shader
+	bool use_jit = false;
+	bool use_idle_skip = true;
+	const char* idle_list = "idle_skip.cfg";
+	bool idle_list_given = false;
+	bool pair_stats = false;
+	bool headless = false;
+	bool uncapped = false;
+	FramePacer::Mode pacing = FramePacer::Mode::Sleep;
+	bool audio_sync = false;
+	int audio_latency_ms = 60;
+	Resampler::Mode resampler_mode = Resampler::Mode::Sinc;
+	uint64_t frame_limit = 0;
+	PixelFormat screen_format = PixelFormat::RGBA8;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--jit") == 0) {
+			use_jit = true;
+		}
+		else if (strcmp(argv[i], "--no-idle-skip") == 0) {
+			use_idle_skip = false;
+		}
+		else if (strcmp(argv[i], "--pair-stats") == 0) {
+			pair_stats = true;
+		}
+		else if (strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+			set_log_stream(stderr);
+		}
+		else if (strcmp(argv[i], "--uncapped") == 0) {
+			uncapped = true;
+		}
+		else if (strcmp(argv[i], "--spin-pacing") == 0) {
+			pacing = FramePacer::Mode::Spin;
+		}
+		else if (strcmp(argv[i], "--audio-sync") == 0) {
+			audio_sync = true;
+		}
+		else if (strcmp(argv[i], "--idle-list") == 0 && i + 1 < argc) {
+			idle_list = argv[++i];
+			idle_list_given = true;
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			frame_limit = strtoull(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--audio-latency") == 0 && i + 1 < argc) {
+			audio_latency_ms = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--resampler") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			if (strcmp(name, "sinc") == 0) {
+				resampler_mode = Resampler::Mode::Sinc;
+			}
+			else if (strcmp(name, "cubic") == 0) {
+				resampler_mode = Resampler::Mode::Cubic;
+			}
+			else if (strcmp(name, "linear") == 0) {
+				resampler_mode = Resampler::Mode::Linear;
+			}
+			else {
+				LOG_WARN("Unknown resampler %s, using sinc", name);
+			}
+		}
+		else if (strcmp(argv[i], "--indexed-output") == 0) {
+			//1 byte per pixel instead of 4 for RGBA
+			screen_format = PixelFormat::Indexed8;
+		}
+	}
+
+	//Screen frames passed from the emulator to the 3d renderer
+	TextureBuffer emuScreenTexBuffer(160, 144, screen_format);
 	resetTexBuffer(&emuScreenTexBuffer);
 
+	//Headless benchmark, runs on this thread and never touches SDL
+	if (headless) {
+		if (frame_limit == 0) {
+			LOG_WARN("--headless without --frames, stopping after 3600 frames");
+			frame_limit = 3600;
+		}
+
+		if (!cart->load_rom(argv[1])) {
+			return 1;
+		}
+		SharedBool alwaysOn;
+		alwaysOn.value = true;
+		GB* gameboy = new GB(*cart, &emuScreenTexBuffer, &alwaysOn);
+		gameboy->set_jit_enabled(use_jit);
+		gameboy->set_idle_skip_enabled(use_idle_skip);
+		gameboy->set_pair_stats_enabled(pair_stats);
+		if (!gameboy->load_idle_skip_list(idle_list) && idle_list_given) {
+			LOG_WARN("Could not open idle skip list: %s", idle_list);
+		}
+		gameboy->set_frame_limit(frame_limit);
+		gameboy->set_uncapped(uncapped);
+		gameboy->set_pacing_mode(pacing);
+		gameboy->set_audio_enabled(false);
+		gameboy->set_benchmark_enabled(true);
+		gameboy->run();
+		delete gameboy;
+		return 0;
+	}
+
 	//Shared emulator power state
 	SharedBool isPowerOn;
 	isPowerOn.value = false;
@@ -55,6 +168,16 @@ int main(int argc, char* argv[]) {
 				//TODO: ability to select roms with spaces
 				cart->load_rom(argv[1]);
 				GB* gameboy = new GB(*cart, &emuScreenTexBuffer, &isPowerOn);
+				gameboy->set_jit_enabled(use_jit);
+				gameboy->set_idle_skip_enabled(use_idle_skip);
+				gameboy->set_pair_stats_enabled(pair_stats);
+				if (!gameboy->load_idle_skip_list(idle_list) && idle_list_given) {
+					LOG_WARN("Could not open idle skip list: %s", idle_list);
+				}
+				gameboy->set_uncapped(uncapped);
+				gameboy->set_pacing_mode(pacing);
+				gameboy->set_audio_sync(audio_sync, audio_latency_ms);
+				gameboy->set_resampler_mode(resampler_mode);
 				gameboy->run();
 
 				//Clear out texture buffer
@@ -0,0 +1,210 @@
+#include "mapper.h"
+#include "cartridge.h"
+
+//No MBC
+
+void Mapper<0>::write_ROM(Cartridge&, uint16_t, uint8_t) {
+	//No registers
+}
+
+int Mapper<0>::get_rom_addr(const Cartridge&, uint16_t addr) {
+	return addr;
+}
+
+int Mapper<0>::get_ram_addr(const Cartridge&, uint16_t addr) {
+	return addr - 0xA000;
+}
+
+//MBC1
+
+void Mapper<1>::write_ROM(Cartridge& cart, uint16_t addr, uint8_t byte) {
+	if (addr >= 0x0000 && addr <= 0x1FFF) {
+		if ((byte & 0xF) == 0xA) {
+			cart.RAM_enabled = true;
+		}
+		else {
+			cart.RAM_enabled = false;
+			cart.save();
+		}
+	}
+	else if (addr >= 0x2000 && addr <= 0x3FFF) {
+		byte = byte & 0x1F;
+		if (byte == 0) {
+			cart.rom_bank_num = 1;
+		}
+		else {
+			//Mask unneeded bits
+			if (byte > cart.rom_bank_count) {
+				byte &= (1 << cart.rom_bank_count) - 1;
+			}
+			cart.rom_bank_num = byte;
+		}
+		cart.update_banks();
+	}
+	else if (addr >= 0x4000 && addr <= 0x5FFF) {
+		cart.ram_bank_num = byte & 0x03;
+		cart.update_banks();
+	}
+	else if (addr >= 0x6000 && addr <= 0x7FFF) {
+		cart.banking_mode = byte & 1;
+		cart.update_banks();
+	}
+}
+
+int Mapper<1>::get_rom_addr(const Cartridge& cart, uint16_t addr) {
+	if (addr < 0x4000) {
+		if (cart.banking_mode == 1) {
+			//If > 5 bit bank number is not needed
+			if (cart.rom_bank_count < 32) {
+				return addr;
+			}
+			return (cart.ram_bank_num << 19) + addr;
+		}
+		else {
+			return addr;
+		}
+	}
+	else {
+		//If > 5 bit bank number is not needed
+		if (cart.rom_bank_count < 32) {
+			return (cart.rom_bank_num << 14) + (addr - 0x4000);
+		}
+		return (cart.ram_bank_num << 19) + (cart.rom_bank_num << 14) + (addr - 0x4000);
+	}
+}
+
+int Mapper<1>::get_ram_addr(const Cartridge& cart, uint16_t addr) {
+	addr -= 0xA000;
+	if (cart.banking_mode == 1) {
+		//if only one ram bank
+		if ((cart.ram_size / 1024) / 8 == 1) {
+			return addr;
+		}
+		return (cart.ram_bank_num << 13) + addr;
+	}
+	else {
+		return addr;
+	}
+}
+
+//MBC2
+
+void Mapper<2>::write_ROM(Cartridge& cart, uint16_t addr, uint8_t byte) {
+	if (addr >= 0x0000 && addr <= 0x3FFF) {
+		if ((addr >> 8) == 0) {
+			if ((byte & 0xF) == 0xA) {
+				cart.RAM_enabled = true;
+			}
+			else {
+				cart.RAM_enabled = false;
+				cart.save();
+			}
+		}
+		else {
+			cart.rom_bank_num = byte & 0xF;
+			if (cart.rom_bank_num == 0) cart.rom_bank_num = 1;
+			cart.update_banks();
+		}
+	}
+}
+
+int Mapper<2>::get_rom_addr(const Cartridge& cart, uint16_t addr) {
+	if (addr < 0x4000) {
+		return addr;
+	}
+	else {
+		return (cart.rom_bank_num << 14) + (addr - 0x4000);
+	}
+}
+
+int Mapper<2>::get_ram_addr(const Cartridge&, uint16_t addr) {
+	//512 half-bytes built into the MBC
+	return (addr - 0xA000) & 0x1FF;
+}
+
+//MBC3
+
+void Mapper<3>::write_ROM(Cartridge& cart, uint16_t addr, uint8_t byte) {
+	if (addr >= 0x0000 && addr <= 0x1FFF) {
+		if ((byte & 0xF) == 0xA) {
+			cart.RAM_enabled = true;
+		}
+		else if (byte == 0) {
+			cart.RAM_enabled = false;
+			cart.save();
+		}
+	}
+	else if (addr >= 0x2000 && addr <= 0x3FFF) {
+		cart.rom_bank_num = byte & 0x7F;
+		if (cart.rom_bank_num == 0) cart.rom_bank_num = 1;
+		cart.update_banks();
+	}
+	else if (addr >= 0x4000 && addr <= 0x5FFF) {
+		if ((byte & 0xF) > 0xC) {
+			byte = 0xC;
+			LOG_WARN("To large of a value written to RAM Bank Number, defaulting to max acceptable value");
+		}
+		cart.ram_bank_num = byte & 0xF;
+		cart.update_banks();
+	}
+	else if (addr >= 0x6000 && addr <= 0x7FFF) {
+		//TODO: Implement RTC registers
+		LOG_WARN("Attempted latch unimplemented RTC clock");
+	}
+}
+
+int Mapper<3>::get_rom_addr(const Cartridge& cart, uint16_t addr) {
+	if (addr < 0x4000) {
+		return addr;
+	}
+	else {
+		return (cart.rom_bank_num << 14) + (addr - 0x4000);
+	}
+}
+
+int Mapper<3>::get_ram_addr(const Cartridge& cart, uint16_t addr) {
+	//Banks 0x8-0xC select the RTC registers
+	if (cart.ram_bank_num > 0x7) {
+		return -1;
+	}
+	return (cart.ram_bank_num << 13) + (addr - 0xA000);
+}
+
+//MBC5
+
+void Mapper<5>::write_ROM(Cartridge& cart, uint16_t addr, uint8_t byte) {
+	if (addr >= 0x0000 && addr <= 0x1FFF) {
+		if ((byte & 0xF) == 0xA) {
+			cart.RAM_enabled = true;
+		}
+		else if (byte == 0) {
+			cart.RAM_enabled = false;
+			cart.save();
+		}
+	}
+	else if (addr >= 0x2000 && addr <= 0x2FFF) {
+		cart.rom_bank_num = byte;
+		cart.update_banks();
+	}
+	else if (addr >= 0x3000 && addr <= 0x3FFF) {
+		cart.rom_bank_extra_bit = byte & 1;
+		cart.update_banks();
+	}
+	else if (addr >= 0x4000 && addr <= 0x5FFF) {
+		cart.ram_bank_num = byte & 0xF;
+		cart.update_banks();
+	}
+}
+
+int Mapper<5>::get_rom_addr(const Cartridge& cart, uint16_t addr) {
+	if (addr < 0x4000) {
+		return addr;
+	}
+	else {
+		return (cart.rom_bank_extra_bit << 22) + (cart.rom_bank_num << 14) + (addr - 0x4000);
+	}
+}
+
+int Mapper<5>::get_ram_addr(const Cartridge& cart, uint16_t addr) {
+	return (cart.ram_bank_num << 13) + (addr - 0xA000);
+}
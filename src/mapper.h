@@ -0,0 +1,66 @@
+#pragma once
+#include "common.h"
+
+//Forward declaration
+class Cartridge;
+
+//The memory bank controller functions a Cartridge calls through.
+//Bound once in Cartridge::load_rom so cartridge accesses never branch on the mbc type
+struct MapperFuncs {
+	//Writing to ROM doesnt actually write but it changes the mapper registers
+	void (*write_ROM)(Cartridge& cart, uint16_t addr, uint8_t byte);
+
+	//Map address to rom address with the current bank registers
+	int (*get_rom_addr)(const Cartridge& cart, uint16_t addr);
+
+	//Map address to ram address with the current bank registers, -1 if the selected bank isn't RAM
+	int (*get_ram_addr)(const Cartridge& cart, uint16_t addr);
+};
+
+//One specialization per supported mbc_num, defined in mapper.cpp.
+//Adding a mapper only needs a new specialization and a case in Cartridge::load_rom, the others are unaffected
+template<int MBC>
+struct Mapper;
+
+//No MBC, 32KB ROM only
+template<>
+struct Mapper<0> {
+	static void write_ROM(Cartridge& cart, uint16_t addr, uint8_t byte);
+	static int get_rom_addr(const Cartridge& cart, uint16_t addr);
+	static int get_ram_addr(const Cartridge& cart, uint16_t addr);
+};
+
+template<>
+struct Mapper<1> {
+	static void write_ROM(Cartridge& cart, uint16_t addr, uint8_t byte);
+	static int get_rom_addr(const Cartridge& cart, uint16_t addr);
+	static int get_ram_addr(const Cartridge& cart, uint16_t addr);
+};
+
+template<>
+struct Mapper<2> {
+	static void write_ROM(Cartridge& cart, uint16_t addr, uint8_t byte);
+	static int get_rom_addr(const Cartridge& cart, uint16_t addr);
+	static int get_ram_addr(const Cartridge& cart, uint16_t addr);
+};
+
+template<>
+struct Mapper<3> {
+	static void write_ROM(Cartridge& cart, uint16_t addr, uint8_t byte);
+	static int get_rom_addr(const Cartridge& cart, uint16_t addr);
+	static int get_ram_addr(const Cartridge& cart, uint16_t addr);
+};
+
+template<>
+struct Mapper<5> {
+	static void write_ROM(Cartridge& cart, uint16_t addr, uint8_t byte);
+	static int get_rom_addr(const Cartridge& cart, uint16_t addr);
+	static int get_ram_addr(const Cartridge& cart, uint16_t addr);
+};
+
+template<int MBC>
+constexpr MapperFuncs mapper_funcs = {
+	&Mapper<MBC>::write_ROM,
+	&Mapper<MBC>::get_rom_addr,
+	&Mapper<MBC>::get_ram_addr
+};
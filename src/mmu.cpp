@@ -8,6 +8,55 @@ MMU::MMU(GB* in_gb) :
 	memset(WRAM1, 0, sizeof(WRAM1));
 	memset(WRAM2, 0, sizeof(WRAM2));
 	memset(HRAM, 0, sizeof(HRAM));
+
+	for (int page = 0; page < 256; page++) {
+		read_page[page] = nullptr;
+		write_page[page] = nullptr;
+	}
+
+	//WRAM never moves so it is mapped once here, cartridge pages are mapped by map_cart()
+	for (int page = 0xC0; page <= 0xCF; page++) {
+		read_page[page] = write_page[page] = &WRAM1[(page - 0xC0) << 8];
+	}
+	for (int page = 0xD0; page <= 0xDF; page++) {
+		read_page[page] = write_page[page] = &WRAM2[(page - 0xD0) << 8];
+	}
+
+	init_io_handlers();
+}
+
+void MMU::map_cart() {
+	Cartridge& cart = gb->cart;
+
+	//ROM pages are read only, writes change the MBC registers so they always go through write_slow()
+	for (int page = 0; page < 0x40; page++) {
+		read_page[page] = cart.rom_bank0_base != nullptr ? cart.rom_bank0_base + (page << 8) : nullptr;
+		read_page[0x40 + page] = cart.rom_bankN_base != nullptr ? cart.rom_bankN_base + (page << 8) : nullptr;
+	}
+
+	//External RAM is only mapped while it is enabled, RTC registers and pages outside the RAM stay on the slow path
+	bool ram_mappable = cart.RAM_enabled && cart.ram_bank_base != nullptr;
+	for (int page = 0xA0; page <= 0xBF; page++) {
+		int offset = (page - 0xA0) << 8;
+		uint8_t* ptr = nullptr;
+		if (ram_mappable && offset + 0x100 <= cart.ram_size) {
+			ptr = cart.ram_bank_base + offset;
+		}
+		read_page[page] = write_page[page] = ptr;
+	}
+}
+
+void MMU::set_code_page(int page, bool has_code) {
+	if (page < 0xC0 || page > 0xDF) {
+		return;
+	}
+
+	if (has_code) {
+		write_page[page] = nullptr;
+	}
+	else {
+		write_page[page] = read_page[page];
+	}
 }
 
 uint8_t MMU::read(uint16_t addr) {
@@ -15,8 +64,17 @@ uint8_t MMU::read(uint16_t addr) {
 	return read_no_tick(addr);
 }
 
-uint8_t MMU::read_no_tick(uint16_t addr) {
-	if (addr >= 0x0000 && addr <= 0x7FFF) {
+uint8_t MMU::read_slow(uint16_t addr) {
+	if (addr >= 0xFF00 && addr <= 0xFF7F) {
+		return io_read[addr & 0x7F](gb, addr);
+	}
+	else if (addr >= 0xFF80 && addr <= 0xFFFE) {
+		return HRAM[addr - 0xFF80];
+	}
+	else if (addr == 0xFFFF) {
+		return gb->cpu.interrupt_enable;
+	}
+	else if (addr >= 0x0000 && addr <= 0x7FFF) {
 		return gb->cart.read_ROM(addr);
 	}
 	else if (addr >= 0x8000 && addr <= 0x9FFF) {
@@ -25,12 +83,6 @@ uint8_t MMU::read_no_tick(uint16_t addr) {
 	else if (addr >= 0xA000 && addr <= 0xBFFF) {
 		return gb->cart.read_RAM(addr);
 	}
-	else if (addr >= 0xC000 && addr <= 0xCFFF) {
-		return WRAM1[addr - 0xC000];
-	}
-	else if (addr >= 0xD000 && addr <= 0xDFFF) {
-		return WRAM2[addr - 0xD000];
-	}
 	else if (addr >= 0xE000 && addr <= 0xFDFF) {
 		//Echo ram unimplemented
 		return 0xFF;
@@ -38,306 +90,218 @@ uint8_t MMU::read_no_tick(uint16_t addr) {
 	else if (addr >= 0xFE00 && addr <= 0xFE9F) {
 		return gb->ppu.read_OAM(addr);
 	}
-	else if (addr >= 0xFEA0 && addr <= 0xFEFF) {
-		//Should return 0xFF during OAM block
+	else {
+		//FEA0-FEFF, should return 0xFF during OAM block
 		return 0xFF;
 	}
-	else if (addr == 0xFF00) {
-		return gb->input.read_joypad();
-	}
-	else if (addr == 0xFF04) {
-		return gb->timer.DIV;
-	}
-	else if (addr == 0xFF05) {
-		return gb->timer.TIMA;
-	}
-	else if (addr == 0xFF06) {
-		return gb->timer.TMA;
-	}
-	else if (addr == 0xFF07) {
-		return gb->timer.TAC;
-	}
-	else if (addr == 0xFF0F) {
-		return gb->cpu.interrupt_flag;
-	}
-	else if (addr == 0xFF10) {
-		return gb->apu.NR10;
-	}
-	else if (addr == 0xFF11) {
-		return gb->apu.NR11;
-	}
-	else if (addr == 0xFF12) {
-		return gb->apu.NR12;
-	}
-	else if (addr == 0xFF13) {
-		return gb->apu.NR13;
-	}
-	else if (addr == 0xFF14) {
-		return gb->apu.NR14;
-	}
-	else if (addr == 0xFF16) {
-		return gb->apu.NR21;
-	}
-	else if (addr == 0xFF17) {
-		return gb->apu.NR22;
-	}
-	else if (addr == 0xFF18) {
-		return gb->apu.NR23;
-	}
-	else if (addr == 0xFF19) {
-		return gb->apu.NR24;
-	}
-	else if (addr == 0xFF1A) {
-		return gb->apu.NR30;
-	}
-	else if (addr == 0xFF1B) {
-		return gb->apu.NR31;
+}
+
+void MMU::write(uint16_t addr, uint8_t byte) {
+	gb->tick_other_components();
+
+	uint8_t* page = write_page[addr >> 8];
+	if (page != nullptr) {
+		page[addr & 0xFF] = byte;
 	}
-	else if (addr == 0xFF1C) {
-		return gb->apu.NR32;
+	else {
+		write_slow(addr, byte);
 	}
-	else if (addr == 0xFF1D) {
-		return gb->apu.NR33;
+}
+
+void MMU::write_slow(uint16_t addr, uint8_t byte) {
+	if (addr >= 0xFF00 && addr <= 0xFF7F) {
+		io_write[addr & 0x7F](gb, addr, byte);
 	}
-	else if (addr == 0xFF1E) {
-		return gb->apu.NR34;
+	else if (addr >= 0xFF80 && addr <= 0xFFFE) {
+		HRAM[addr - 0xFF80] = byte;
+		gb->block_cache.invalidate_write(addr);
 	}
-	else if (addr == 0xFF20) {
-		return gb->apu.NR41;
+	else if (addr == 0xFFFF) {
+		gb->cpu.interrupt_enable = byte;
 	}
-	else if (addr == 0xFF21) {
-		return gb->apu.NR42;
+	else if (addr >= 0xC000 && addr <= 0xDFFF) {
+		//Only reached for WRAM pages the block cache holds code from
+		if (addr <= 0xCFFF) {
+			WRAM1[addr - 0xC000] = byte;
+		}
+		else {
+			WRAM2[addr - 0xD000] = byte;
+		}
+		gb->block_cache.invalidate_write(addr);
 	}
-	else if (addr == 0xFF22) {
-		return gb->apu.NR43;
+	else if (addr >= 0x0000 && addr <= 0x7FFF) {
+		gb->cart.write_ROM(addr, byte);
+		//Bank or RAM enable may have changed
+		map_cart();
+		gb->block_cache.rom_banks_changed();
 	}
-	else if (addr == 0xFF23) {
-		return gb->apu.NR44;
+	else if (addr >= 0x8000 && addr <= 0x9FFF) {
+		gb->ppu.write_VRAM(addr, byte);
 	}
-	else if (addr == 0xFF24) {
-		return gb->apu.NR50;
+	else if (addr >= 0xA000 && addr <= 0xBFFF) {
+		gb->cart.write_RAM(addr, byte);
 	}
-	else if (addr == 0xFF25) {
-		return gb->apu.NR51;
+	else if (addr >= 0xFE00 && addr <= 0xFE9F) {
+		gb->ppu.write_OAM(addr, byte);
 	}
-	else if (addr == 0xFF26) {
-		return gb->apu.NR52;
+	else {
+		//Echo ram and FEA0-FEFF unwritable
+		//LOG_WARN("Write to unmapped address, %X", addr);
 	}
-	else if (addr >= 0xFF30 && addr <= 0xFF3F) {
-		return gb->apu.wave[addr - 0xFF30];
+}
+
+void MMU::init_io_handlers() {
+	//Unmapped registers read 0xFF and ignore writes
+	for (int i = 0; i < 128; i++) {
+		io_read[i] = [](GB*, uint16_t) -> uint8_t {
+			//LOG_WARN("Invalid read at addr: 0x%X", addr);
+			return 0xFF;
+		};
+		io_write[i] = [](GB*, uint16_t, uint8_t) {
+			//LOG_WARN("Write to unmapped address, %X", addr);
+		};
 	}
-	else if (addr == 0xFF40) {
+
+	io_read[0x00] = [](GB* gb, uint16_t) -> uint8_t {
+		return gb->input.read_joypad();
+	};
+	io_read[0x04] = [](GB* gb, uint16_t) -> uint8_t {
+		return gb->timer.DIV_read();
+	};
+	io_read[0x05] = [](GB* gb, uint16_t) -> uint8_t {
+		return gb->timer.TIMA_read();
+	};
+	io_read[0x06] = [](GB* gb, uint16_t) -> uint8_t {
+		return gb->timer.TMA;
+	};
+	io_read[0x07] = [](GB* gb, uint16_t) -> uint8_t {
+		return gb->timer.TAC;
+	};
+	io_read[0x0F] = [](GB* gb, uint16_t) -> uint8_t {
+		return gb->cpu.interrupt_flag;
+	};
+	//Sound registers and wave RAM
+	for (int i = 0x10; i <= 0x3F; i++) {
+		io_read[i] = [](GB* gb, uint16_t addr) -> uint8_t {
+			return gb->apu.read_register(addr);
+		};
+		io_write[i] = [](GB* gb, uint16_t addr, uint8_t byte) {
+			gb->apu.write_register(addr, byte);
+		};
+	}
+	io_read[0x40] = [](GB* gb, uint16_t) -> uint8_t {
 		return gb->ppu.lcd_control;
-	}
-	else if (addr == 0xFF41) {
+	};
+	io_read[0x41] = [](GB* gb, uint16_t) -> uint8_t {
+		gb->ppu.sync();
 		return gb->ppu.lcd_status;
-	}
-	else if (addr == 0xFF42) {
+	};
+	io_read[0x42] = [](GB* gb, uint16_t) -> uint8_t {
+		gb->ppu.sync();
 		return gb->ppu.bg_viewport_y;
-	}
-	else if (addr == 0xFF43) {
+	};
+	io_read[0x43] = [](GB* gb, uint16_t) -> uint8_t {
+		gb->ppu.sync();
 		return gb->ppu.bg_viewport_x;
-	}
-	else if (addr == 0xFF44) {
+	};
+	io_read[0x44] = [](GB* gb, uint16_t) -> uint8_t {
+		gb->ppu.sync();
 		return gb->ppu.ly;
-	}
-	else if (addr == 0xFF45) {
+	};
+	io_read[0x45] = [](GB* gb, uint16_t) -> uint8_t {
 		return gb->ppu.ly_comp;
-	}
-	else if (addr == 0xFF46) {
+	};
+	io_read[0x46] = [](GB* gb, uint16_t) -> uint8_t {
 		return gb->OAM_DMA;
-	}
-	else if (addr == 0xFF47) {
+	};
+	io_read[0x47] = [](GB* gb, uint16_t) -> uint8_t {
 		return gb->ppu.bg_palette;
-	}
-	else if (addr == 0xFF48) {
+	};
+	io_read[0x48] = [](GB* gb, uint16_t) -> uint8_t {
 		return gb->ppu.obj_palette0;
-	}
-	else if (addr == 0xFF49) {
+	};
+	io_read[0x49] = [](GB* gb, uint16_t) -> uint8_t {
 		return gb->ppu.obj_palette1;
-	}
-	else if (addr == 0xFF4A) {
+	};
+	io_read[0x4A] = [](GB* gb, uint16_t) -> uint8_t {
 		return gb->ppu.win_y;
-	}
-	else if (addr == 0xFF4B) {
+	};
+	io_read[0x4B] = [](GB* gb, uint16_t) -> uint8_t {
 		return gb->ppu.win_x;
-	}
-	else if (addr >= 0xFF80 && addr <= 0xFFFE) {
-		return HRAM[addr - 0xFF80];
-	}
-	else if (addr == 0xFFFF) {
-		return gb->cpu.interrupt_enable;
-	}
-	else {
-		//Unmapped addresss
-		//LOG_WARN("Invalid read at addr: 0x%X", addr);
-		return 0xFF;
-	}
-}
+	};
 
-void MMU::write(uint16_t addr, uint8_t byte) {
-	gb->tick_other_components();
-
-	if (addr >= 0x0000 && addr <= 0x7FFF) {
-		gb->cart.write_ROM(addr, byte);
-	}
-	else if (addr >= 0x8000 && addr <= 0x9FFF) {
-		gb->ppu.write_VRAM(addr, byte);
-	}
-	else if (addr >= 0xA000 && addr <= 0xBFFF) {
-		gb->cart.write_RAM(addr, byte);
-	}
-	else if (addr >= 0xC000 && addr <= 0xCFFF) {
-		WRAM1[addr - 0xC000] = byte;
-	}
-	else if (addr >= 0xD000 && addr <= 0xDFFF) {
-		WRAM2[addr - 0xD000] = byte;
-	}
-	else if (addr >= 0xFE00 && addr <= 0xFE9F) {
-		gb->ppu.write_OAM(addr, byte);
-	}
-	else if (addr >= 0xFEA0 && addr <= 0xFEFF) {
-		//Unwritable
-	}
-	else if (addr == 0xFF00) {
+	io_write[0x00] = [](GB* gb, uint16_t, uint8_t byte) {
 		gb->input.write_joypad(byte);
-	}
-	else if (addr == 0xFF01) {
+	};
+	io_write[0x01] = [](GB*, uint16_t, uint8_t) {
 		//LOG("SERIAL PORT: %c",byte);
-	}
-	else if (addr == 0xFF02) {
+	};
+	io_write[0x02] = [](GB*, uint16_t, uint8_t) {
 		//ignore
-	}
-	else if (addr == 0xFF04) {
+	};
+	io_write[0x04] = [](GB* gb, uint16_t, uint8_t) {
 		//Writing any byte resets the DIV register
-		gb->timer.DIV = 0;  
-	}
-	else if (addr == 0xFF05) {
-		gb->timer.TIMA = byte;
-	}
-	else if (addr == 0xFF06) {
-		gb->timer.TMA = byte;
-	}
-	else if (addr == 0xFF07) {
-		gb->timer.TAC = byte;
-	}
-	else if (addr == 0xFF0F) {
+		gb->timer.DIV_write();
+	};
+	io_write[0x05] = [](GB* gb, uint16_t, uint8_t byte) {
+		gb->timer.TIMA_write(byte);
+	};
+	io_write[0x06] = [](GB* gb, uint16_t, uint8_t byte) {
+		gb->timer.TMA_write(byte);
+	};
+	io_write[0x07] = [](GB* gb, uint16_t, uint8_t byte) {
+		gb->timer.TAC_write(byte);
+	};
+	io_write[0x0F] = [](GB* gb, uint16_t, uint8_t byte) {
 		gb->cpu.interrupt_flag = byte | 0b11100000;
-	}
-	else if (addr == 0xFF10) {
-		gb->apu.NR10 = byte;
-	}
-	else if (addr == 0xFF11) {
-		gb->apu.NR11 = byte;
-	}
-	else if (addr == 0xFF12) {
-		gb->apu.NR12 = byte;
-	}
-	else if (addr == 0xFF13) {
-		gb->apu.NR13 = byte;
-	}
-	else if (addr == 0xFF14) {
-		gb->apu.NR14 = byte;
-	}
-	else if (addr == 0xFF16) {
-		gb->apu.NR21 = byte;
-	}
-	else if (addr == 0xFF17) {
-		gb->apu.NR22 = byte;
-	}
-	else if (addr == 0xFF18) {
-		gb->apu.NR23 = byte;
-	}
-	else if (addr == 0xFF19) {
-		gb->apu.NR24 = byte;
-	}
-	else if (addr == 0xFF1A) {
-		gb->apu.NR30 = byte;
-	}
-	else if (addr == 0xFF1B) {
-		gb->apu.NR31 = byte;
-	}
-	else if (addr == 0xFF1C) {
-		gb->apu.NR32 = byte;
-	}
-	else if (addr == 0xFF1D) {
-		gb->apu.NR33 = byte;
-	}
-	else if (addr == 0xFF1E) {
-		gb->apu.NR34 = byte;
-	}
-	else if (addr == 0xFF20) {
-		gb->apu.NR41 = byte;
-	}
-	else if (addr == 0xFF21) {
-		gb->apu.NR42 = byte;
-	}
-	else if (addr == 0xFF22) {
-		gb->apu.NR43 = byte;
-	}
-	else if (addr == 0xFF23) {
-		gb->apu.NR44 = byte;
-	}
-	else if (addr == 0xFF24) {
-		gb->apu.NR50 = byte;
-	}
-	else if (addr == 0xFF25) {
-		gb->apu.NR51 = byte;
-	}
-	else if (addr == 0xFF26) {
-		gb->apu.NR52 = byte;
-	}
-	else if (addr >= 0xFF30 && addr <= 0xFF3F) {
-		gb->apu.wave[addr - 0xFF30] = byte;
-	}
-	else if (addr == 0xFF40) {
+	};
+	io_write[0x40] = [](GB* gb, uint16_t, uint8_t byte) {
 		gb->ppu.lcd_control_write(byte);
-	}
-	else if (addr == 0xFF41) {
+	};
+	io_write[0x41] = [](GB* gb, uint16_t, uint8_t byte) {
 		gb->ppu.lcd_status_write(byte);
-	}
-	else if (addr == 0xFF42) {
+	};
+	io_write[0x42] = [](GB* gb, uint16_t, uint8_t byte) {
+		gb->ppu.sync();
 		gb->ppu.temp_bg_viewport_y = byte;
-	}
-	else if (addr == 0xFF43) {
+	};
+	io_write[0x43] = [](GB* gb, uint16_t, uint8_t byte) {
+		gb->ppu.sync();
 		gb->ppu.temp_bg_viewport_x = byte;
-	}
-	else if (addr == 0xFF44) {
+	};
+	io_write[0x44] = [](GB*, uint16_t, uint8_t) {
 		//ly read only
-	}
-	else if (addr == 0xFF45) {
+	};
+	io_write[0x45] = [](GB* gb, uint16_t, uint8_t byte) {
 		gb->ppu.ly_comp_write(byte);
-	}
-	else if (addr == 0xFF46) {
+	};
+	io_write[0x46] = [](GB* gb, uint16_t, uint8_t byte) {
+		gb->ppu.sync();
 		gb->OAM_DMA = byte;
 		//DMA transfer
 		for (int i = 0; i <=  0x9F; i++) {
-			gb->ppu.OAM[i] = read_no_tick((byte << 8) + i);
+			gb->ppu.OAM[i] = gb->mmu.read_no_tick((byte << 8) + i);
 		}
-	}
-	else if (addr == 0xFF47) {
+		gb->ppu.objects_dirty = true;
+	};
+	io_write[0x47] = [](GB* gb, uint16_t, uint8_t byte) {
+		gb->ppu.sync();
 		gb->ppu.bg_palette = byte;
-	}
-	else if (addr == 0xFF48) {
+	};
+	io_write[0x48] = [](GB* gb, uint16_t, uint8_t byte) {
+		gb->ppu.sync();
 		gb->ppu.obj_palette0 = byte;
-	}
-	else if (addr == 0xFF49) {
+	};
+	io_write[0x49] = [](GB* gb, uint16_t, uint8_t byte) {
+		gb->ppu.sync();
 		gb->ppu.obj_palette1 = byte;
-	}
-	else if (addr == 0xFF4A) {
+	};
+	io_write[0x4A] = [](GB* gb, uint16_t, uint8_t byte) {
+		gb->ppu.sync();
 		gb->ppu.win_y = byte;
-	}
-	else if (addr == 0xFF4B) {
+	};
+	io_write[0x4B] = [](GB* gb, uint16_t, uint8_t byte) {
+		gb->ppu.sync();
 		gb->ppu.win_x = byte;
-	}
-	else if (addr >= 0xFF80 && addr <= 0xFFFE) {
-		HRAM[addr - 0xFF80] = byte;
-	}
-	else if (addr == 0xFFFF) {
-		gb->cpu.interrupt_enable = byte;
-	}
-	else {
-		//Unmapped address
-		//LOG_WARN("Write to unmapped address, %X", addr);
-	}
+	};
 }
\ No newline at end of file
@@ -13,11 +13,46 @@ public:
 
 	//Write byte and tick components other than the cpu 1 M-cycle
 	void write(uint16_t addr, uint8_t byte);
+
+	//Point the ROM and external RAM pages at the currently selected cartridge banks
+	// Called at startup and whenever the cartridge registers are written
+	void map_cart();
+
+	//Remove the fast write pointer of a WRAM page while the block cache holds code from it
+	// so writes to the page go through write_slow() and invalidate the blocks
+	void set_code_page(int page, bool has_code);
 private:
+	friend class BlockCache;
+	friend class JIT;
+
 	GB* gb;
 
+	//Handlers for the 0xFF00-0xFF7F IO registers, indexed by addr & 0x7F
+	typedef uint8_t (*IORead)(GB* gb, uint16_t addr);
+	typedef void (*IOWrite)(GB* gb, uint16_t addr, uint8_t byte);
+	IORead io_read[128];
+	IOWrite io_write[128];
+
+	//Host pointer for each 256 byte page of the address map, indexed by addr >> 8.
+	//Plain memory (ROM banks, WRAM, enabled external RAM) is accessed directly through these,
+	// nullptr means the page has side effects or mixed contents and goes through read_slow()/write_slow()
+	uint8_t* read_page[256];
+	uint8_t* write_page[256];
+
 	//Read byte and tick components without ticking a cycle, used for DMA and called by read()
-	uint8_t read_no_tick(uint16_t addr);
+	uint8_t read_no_tick(uint16_t addr) {
+		uint8_t* page = read_page[addr >> 8];
+		if (page != nullptr) {
+			return page[addr & 0xFF];
+		}
+		return read_slow(addr);
+	}
+
+	//Reads and writes to pages that aren't directly mapped
+	uint8_t read_slow(uint16_t addr);
+	void write_slow(uint16_t addr, uint8_t byte);
+
+	void init_io_handlers();
 
 	//C000-CFFF
 	uint8_t WRAM1[4 * 1024];
@@ -30,4 +65,4 @@ private:
 
 	//FF80-FFFE
 	uint8_t HRAM[127];
-};
\ No newline at end of file
+};
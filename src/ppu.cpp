@@ -1,5 +1,6 @@
 #include "ppu.h"
 #include "cstring"
+#include <algorithm>
 #include "gb.h"
 
 //If true ppu will start up its own SDL window to display the emulator
@@ -11,21 +12,12 @@ PPU::PPU(GB* in_gb, TextureBuffer* in_tex_buffer) :
 	if (NO_3D_MODE) {
 		init_SDL();
 	}
-	//Set size to screen w * h * 4 bytes for RGBA
-	pixels.resize(160 * 144 * 4);
-
-	//Init pixels with green color
-	for (size_t i = 0; i < pixels.size(); i += 4)
-	{
-		pixels[i + 0] = 155;
-		pixels[i + 1] = 188;
-		pixels[i + 2] = 15;
-		pixels[i + 3] = 255;
-	}
+	indexed_output = emuScreenTexBuffer->format == PixelFormat::Indexed8;
 
 
 	current_mode = VBlank;
 	dot_count = 0;
+	last_dot = 0;
 	frame_done = false;
 	lcd_control = 0x91;
 	lcd_status = 0x85;
@@ -42,6 +34,9 @@ PPU::PPU(GB* in_gb, TextureBuffer* in_tex_buffer) :
 	wy_equals_ly = false;
 	memset(OAM, 0, sizeof(OAM));
 	memset(VRAM, 0, sizeof(VRAM));
+	memset(tile_dirty, 0xFF, sizeof(tile_dirty));
+	objects_dirty = true;
+	objects_height = 8;
 	stat_line = false;
 }
 
@@ -64,45 +59,15 @@ void PPU::init_SDL() {
 	renderer = SDL_CreateRenderer(window, -1, 0);
 }
 
-void PPU::set_pixel_color(int id, uint8_t palette, int x, int y) {
-	int color = (palette >> (id * 2)) & 0b11;
-	int index = (y * 160 + x) * 4;
-
-	if (x < 0 || x >= 160) return;
-
-	switch (color) {
-	case 0:
-		pixels[index + 0] = 155;
-		pixels[index + 1] = 188;
-		pixels[index + 2] = 15;
-		pixels[index + 3] = 255;
-		break;
-	case 1:
-		pixels[index + 0] = 139;
-		pixels[index + 1] = 172;
-		pixels[index + 2] = 15;
-		pixels[index + 3] = 255;
-		break;
-	case 2:
-		pixels[index + 0] = 48;
-		pixels[index + 1] = 98;
-		pixels[index + 2] = 48;
-		pixels[index + 3] = 255;
-		break;
-	case 3:
-		pixels[index + 0] = 15;
-		pixels[index + 1] = 56;
-		pixels[index + 2] = 15;
-		pixels[index + 3] = 255;
-		break;
-	}
-}
-
 void PPU::lcd_status_write(uint8_t byte) {
+	sync();
 	lcd_status = (byte & 0b01111000) | (lcd_status & 0b10000111);
+	schedule_after_write();
 }
 void PPU::lcd_control_write(uint8_t byte) {
+	sync();
 	lcd_control = byte;
+	schedule_after_write();
 }
 
 void PPU::lcd_status_write_bit(uint8_t bit_index, bool bit) {
@@ -140,6 +105,7 @@ void PPU::ly_write(uint8_t value) {
 	}
 }
 void PPU::ly_comp_write(uint8_t value) {
+	sync();
 	ly_comp = value;
 	if (ly == ly_comp && lcd_status_read_bit(6)) {
 		lcd_status_write_bit(2, 1);
@@ -148,9 +114,12 @@ void PPU::ly_comp_write(uint8_t value) {
 	else {
 		lcd_status_write_bit(2, 0);
 	}
+	schedule_after_write();
 }
 
 uint8_t PPU::read_OAM(uint16_t addr) {
+	sync();
+
 	//Block if mode 2 or 3 
 	if ((current_mode == OAM_scan || current_mode == Draw) && lcd_control_read_bit(7)) {
 		return 0xFF;
@@ -161,6 +130,8 @@ uint8_t PPU::read_OAM(uint16_t addr) {
 }
 
 void PPU::write_OAM(uint16_t addr, uint8_t byte){
+	sync();
+
 	//Block if mode 2 or 3 
 	if ((current_mode == OAM_scan || current_mode == Draw) && lcd_control_read_bit(7)) {
 		return;
@@ -168,9 +139,15 @@ void PPU::write_OAM(uint16_t addr, uint8_t byte){
 
 	addr -= 0xFE00;
 	OAM[addr] = byte;
+	//Y and X decide which lines an object is on and its priority, tile and flags are read when it is drawn
+	if ((addr & 3) < 2) {
+		objects_dirty = true;
+	}
 }
 
 uint8_t PPU::read_VRAM(uint16_t addr) {
+	sync();
+
 	//Block if mode 3 
 	if (current_mode == Draw && lcd_control_read_bit(7)) {
 		return 0xFF;
@@ -181,6 +158,8 @@ uint8_t PPU::read_VRAM(uint16_t addr) {
 }
 
 void PPU::write_VRAM(uint16_t addr, uint8_t byte) {
+	sync();
+
 	//Block if mode 3 
 	if (current_mode == Draw && lcd_control_read_bit(7)) {
 		return;
@@ -188,6 +167,34 @@ void PPU::write_VRAM(uint16_t addr, uint8_t byte) {
 
 	addr -= 0x8000;
 	VRAM[addr] = byte;
+
+	//Tile data is 16 bytes per tile, the tile maps after it aren't cached
+	if (addr < TILE_COUNT * 16) {
+		tile_dirty[addr / (16 * 64)] |= 1ULL << ((addr / 16) % 64);
+	}
+}
+
+const uint8_t* PPU::tile_row(uint16_t tile_index, int row, bool xflip) {
+	if ((tile_dirty[tile_index / 64] >> (tile_index % 64)) & 1) {
+		decode_tile(tile_index);
+	}
+	return xflip ? tile_cache_flipped[tile_index][row] : tile_cache[tile_index][row];
+}
+
+void PPU::decode_tile(uint16_t tile_index) {
+	tile_dirty[tile_index / 64] &= ~(1ULL << (tile_index % 64));
+
+	//Each row is 2 bytes, the first has the low bit of every pixel's color id and the second the high bit
+	const uint8_t* data = &VRAM[tile_index * 0x10];
+	for (int row = 0; row < 8; row++) {
+		uint8_t byte1 = data[row * 2];
+		uint8_t byte2 = data[row * 2 + 1];
+		for (int pixel_x = 0; pixel_x < 8; pixel_x++) {
+			uint8_t color_id = (((byte2 >> (7 - pixel_x)) << 1) & 0b10) | ((byte1 >> (7 - pixel_x)) & 0b1);
+			tile_cache[tile_index][row][pixel_x] = color_id;
+			tile_cache_flipped[tile_index][row][7 - pixel_x] = color_id;
+		}
+	}
 }
 
 void PPU::update_bg_viewports() {
@@ -195,6 +202,148 @@ void PPU::update_bg_viewports() {
 	bg_viewport_y = temp_bg_viewport_y;
 }
 
+void PPU::sync() {
+	sync(gb->get_t_cycle_count());
+}
+
+void PPU::sync(uint64_t time) {
+	while (lcd_control_read_bit(7)) {
+		uint64_t change_dot = last_dot + dots_until_mode_change(current_mode, dot_count);
+		if (change_dot > time) {
+			break;
+		}
+		catch_up(change_dot - 1);
+		last_dot = change_dot;
+		tick();
+	}
+	catch_up(time);
+}
+
+uint64_t PPU::next_change_time() {
+	sync();
+	if (!lcd_control_read_bit(7)) {
+		return NEVER;
+	}
+	return last_dot + dots_until_mode_change(current_mode, dot_count);
+}
+
+uint64_t PPU::next_line_time() {
+	sync();
+	if (!lcd_control_read_bit(7)) {
+		return NEVER;
+	}
+
+	//OAM scan and draw stay on the line, the end of HBlank and every VBlank change move to another one
+	PPUMode mode = current_mode;
+	int dots = dot_count;
+	uint64_t dot = last_dot;
+	while (true) {
+		int wait = dots_until_mode_change(mode, dots);
+		dot += wait;
+		switch (mode) {
+		case OAM_scan:
+			mode = Draw;
+			dots = 0;
+			break;
+		case Draw:
+			mode = HBlank;
+			dots = 0;
+			break;
+		default:
+			return dot;
+		}
+	}
+}
+
+void PPU::catch_up(uint64_t time) {
+	//While disabled dot_count is held at the end of VBlank
+	if (lcd_control_read_bit(7) && time > last_dot) {
+		dot_count += (int)(time - last_dot);
+	}
+	if (time > last_dot) {
+		last_dot = time;
+	}
+}
+
+void PPU::handle_event(uint64_t time) {
+	sync(time - 1);
+	last_dot = time;
+	tick();
+	schedule_next_event();
+}
+
+void PPU::schedule_after_write() {
+	gb->scheduler.schedule(Event::PPU, gb->get_t_cycle_count() + 1);
+}
+
+void PPU::schedule_next_event() {
+	//Nothing changes while the PPU is disabled until LCDC is written
+	if (!lcd_control_read_bit(7)) {
+		gb->scheduler.cancel(Event::PPU);
+		return;
+	}
+	gb->scheduler.schedule(Event::PPU, next_event_dot());
+}
+
+int PPU::dots_until_mode_change(PPUMode mode, int dots) {
+	//Modes end on the first dot where dot_count is past the mode length
+	switch (mode) {
+	case OAM_scan:
+		return DOTS_PER_OAM_SCAN + 1 - dots;
+	case Draw:
+		return DOTS_PER_DRAW + 1 - dots;
+	case HBlank:
+		return DOTS_PER_HBLANK + 1 - dots;
+	case VBlank: {
+		//Next invisible line or end of VBlank, whichever is first
+		int next_line = 456 - (dots % 456);
+		int vblank_end = DOTS_PER_VBLANK + 1 - dots;
+		return next_line < vblank_end ? next_line : vblank_end;
+	}
+	}
+	return 1;
+}
+
+uint64_t PPU::next_event_dot() {
+	//A stat interrupt needs a stat source to become true, so only dots that enter an enabled mode source or
+	// change ly to ly_comp can request one. Entering VBlank always requests vblank and the end of VBlank finishes the frame.
+	bool lyc_source = lcd_status_read_bit(6);
+	PPUMode mode = current_mode;
+	int dots = dot_count;
+	int line = ly;
+	uint64_t dot = last_dot;
+
+	while (true) {
+		int wait = dots_until_mode_change(mode, dots);
+		dot += wait;
+		dots += wait;
+
+		switch (mode) {
+		case OAM_scan:
+			mode = Draw;
+			dots = 0;
+			break;
+		case Draw:
+			mode = HBlank;
+			dots = 0;
+			if (lcd_status_read_bit(3)) return dot;
+			break;
+		case HBlank:
+			line++;
+			dots = 0;
+			if (line == 144) return dot;
+			mode = OAM_scan;
+			if (lcd_status_read_bit(5) || (lyc_source && line == ly_comp)) return dot;
+			break;
+		case VBlank:
+			if (dots > DOTS_PER_VBLANK) return dot;
+			line++;
+			if (lyc_source && line == ly_comp) return dot;
+			break;
+		}
+	}
+}
+
 void PPU::tick() {
 	//If ppu disabled ly should be 0 and ppu should be in hblank
 	//With the way modes here are implemented this would skip ly = 0 when enabling the ppu
@@ -297,10 +446,42 @@ void PPU::check_stat() {
 	}
 }
 
+void PPU::select_objects(int obj_height) {
+	memset(line_object_count, 0, sizeof(line_object_count));
+
+	for (int object_id = 0; object_id < 40; object_id++) {
+		//Line of the object's top row, objects can start up to 16 lines above the screen
+		int top = OAM[object_id * 4] - 16;
+		uint8_t obj_x = OAM[(object_id * 4) + 1];
+
+		for (int line = std::max(top, 0); line < std::min(top + obj_height, 144); line++) {
+			uint8_t* objects = line_objects[line];
+			uint8_t& count = line_object_count[line];
+			//Only the first 10 objects in OAM order are drawn on a line
+			if (count == 10) continue;
+
+			//Insertion sort by X. Objects already on the line come earlier in OAM, so one with the same X stays ahead
+			int i = count++;
+			for (; i > 0 && OAM[(objects[i - 1] * 4) + 1] > obj_x; i--) {
+				objects[i] = objects[i - 1];
+			}
+			objects[i] = object_id;
+		}
+	}
+
+	objects_height = obj_height;
+	objects_dirty = false;
+}
+
 void PPU::draw_line() {
-	//Used to check bg color ids to determine object priority
-	int bg_color_ids[8 * 32];
+	//Palette index of every pixel on the line, shade 0 where the background is disabled
+	uint8_t line[160];
+	memset(line, LINE_RAW | 0, sizeof(line));
+
+	//Used to check bg color ids to determine object priority. Indexed by internal x, screen x is offset by the fine scroll
+	uint8_t bg_color_ids[8 * 32];
 	memset(bg_color_ids, 0, sizeof(bg_color_ids));
+	int fine_x = bg_viewport_x % 8;
 
 	//If PPU enabled and bg/window enabled
 	if (lcd_control_read_bit(7) && lcd_control_read_bit(0)) {
@@ -319,9 +500,8 @@ void PPU::draw_line() {
 		//Index of current tile
 		uint16_t tile_index;
 
-		//2 bytes that represent 8 pixels of the current scanline
-		uint8_t byte1;
-		uint8_t byte2;
+		//Color ids of the 8 pixels of the current tile on this scanline
+		const uint8_t* row;
 
 		for (int tile_x = 0; tile_x < 32; tile_x++) {
 			if (win_drawn || (lcd_control_read_bit(5) && wy_equals_ly && win_x <= 166 && (tile_x * 8) + 7 >= win_x)) {
@@ -334,8 +514,7 @@ void PPU::draw_line() {
 				if (!lcd_control_read_bit(4) && tile_index < 128) {
 					tile_index += 256;
 				}
-				byte1 = VRAM[(tile_index * 0x10) + ((win_line_counter % 8) * 2)];
-				byte2 = VRAM[(tile_index * 0x10) + ((win_line_counter % 8) * 2) + 1];
+				row = tile_row(tile_index, win_line_counter % 8, false);
 			}
 			else {
 				//Draw backround
@@ -346,61 +525,38 @@ void PPU::draw_line() {
 				if (!lcd_control_read_bit(4) && tile_index < 128) {
 					tile_index += 256;
 				}
-				byte1 = VRAM[(tile_index * 0x10) + (((ly + bg_viewport_y) % 8) * 2)];
-				byte2 = VRAM[(tile_index * 0x10) + (((ly + bg_viewport_y) % 8) * 2) + 1];
-			}
-
-			//Draw 8 pixels of this tile
-			//pixel_x is the x value of the pixel within the tile 0-7
-			//internal_x is the internal x value of the pixel, can be beyond the screen bound
-			//screen_x is the position of the pixel on the screen
-			for (int pixel_x = 0; pixel_x < 8; pixel_x++) {
-				int internal_x = (tile_x * 8) + pixel_x;
-				int screen_x = (internal_x - (bg_viewport_x % 8));
-
-				int color_id = (((byte2 >> (7 - pixel_x)) << 1) & 0b10) | ((byte1 >> (7 - pixel_x)) & 0b1);
-				bg_color_ids[internal_x] = color_id;
-
-				set_pixel_color(color_id, bg_palette, screen_x, ly);
+				row = tile_row(tile_index, (ly + bg_viewport_y) % 8, false);
 			}
+			memcpy(&bg_color_ids[tile_x * 8], row, 8);
 			if (win_drawn) win_tile_x++;
 		}
 
 		if (win_drawn) win_line_counter++;
+
+		//The line starts fine_x pixels into the first tile. LINE_BG is 0 so the color ids are already palette indices
+		memcpy(line, &bg_color_ids[fine_x], sizeof(line));
 	}
 
 	//If PPU and objects are enabled
 	if (lcd_control_read_bit(7) && lcd_control_read_bit(1)) {
 		//Draw objects
 
-		//Array for each pixel if the scanline. When an object draws an opaque pixel obj_opaque_x_coords[x] = obj_x
-		// This is used to determine priority between objects with overlapping opaque pixels
-		int obj_opaque_x_coords[255];
-		memset(obj_opaque_x_coords, 0, sizeof(obj_opaque_x_coords));
-		int obj_this_scanline = 0;
-		
 		int obj_height = 8;
 		if (lcd_control_read_bit(2)) {
 			obj_height = 16;
 		}
 
-		for (int object_id = 0; object_id < 40; object_id++) {
+		if (objects_dirty || obj_height != objects_height) {
+			select_objects(obj_height);
+		}
+
+		//Lowest priority first, so where opaque pixels overlap the higher priority object's are drawn last and stay on top
+		for (int n = line_object_count[ly] - 1; n >= 0; n--) {
+			int object_id = line_objects[ly][n];
 			uint8_t obj_y = OAM[object_id * 4];
-			//The line of the obj tile that will be drawn, 
-			// if this is less than 0 or greater than or equal to the object height this object is not on this scanline
+			//The line of the obj tile that will be drawn
 			int obj_tile_y = ly - (obj_y - 16);
 
-			//If object is not on this scanline continue
-			if (obj_tile_y < 0 || obj_tile_y >= obj_height) {
-				continue;
-			}
-
-			obj_this_scanline++;
-			//If 10 objects have already been drawn this scanline stop drawing objects
-			if (obj_this_scanline > 10) {
-				break;
-			}
-
 			uint8_t obj_x = OAM[(object_id * 4) + 1];
 			uint8_t obj_tile_index = OAM[(object_id * 4) + 2];
 			uint8_t obj_flags = OAM[(object_id * 4) + 3];
@@ -408,10 +564,10 @@ void PPU::draw_line() {
 			uint8_t obj_palette;
 			//Palette selection
 			if ((obj_flags >> 4) & 1) {
-				obj_palette = obj_palette1;
+				obj_palette = LINE_OBP1;
 			}
 			else {
-				obj_palette = obj_palette0;
+				obj_palette = LINE_OBP0;
 			}
 
 			bool xflip = false;
@@ -446,26 +602,32 @@ void PPU::draw_line() {
 				bg_priority = true;
 			}
 
-			uint8_t byte1 = VRAM[(obj_tile_index * 0x10) + ((obj_tile_y % 8) * 2)];
-			uint8_t byte2 = VRAM[(obj_tile_index * 0x10) + ((obj_tile_y % 8) * 2) + 1];
+			//Already mirrored if X flipped
+			const uint8_t* row = tile_row(obj_tile_index, obj_tile_y % 8, xflip);
 
 			//Draw 8 pixels of object tile
 			for (int i = 0; i < 8; i++) {
-				int pixel_x = xflip ? (7 - i) : i;
 				int internal_x = obj_x - 8 + i;
+				//Objects can start up to 8 pixels left of the screen or past its right edge
+				if (internal_x < 0 || internal_x >= 160) continue;
 
-				if (bg_priority && bg_color_ids[internal_x] > 0) continue;
-				int color_id = (((byte2 >> (7 - pixel_x)) << 1) & 0b10) | ((byte1 >> (7 - pixel_x)) & 0b1);
+				if (bg_priority && bg_color_ids[internal_x + fine_x] > 0) continue;
+				int color_id = row[i];
 				if (color_id == 0) continue;
 
-				//If an object with higher priority has already drawn an opaque pixel at this coord continue
-				if (obj_opaque_x_coords[internal_x] != 0 && obj_x >= obj_opaque_x_coords[internal_x]) continue;
-				obj_opaque_x_coords[internal_x] = obj_x;
-
-				set_pixel_color(color_id, obj_palette, internal_x, ly);
+				line[internal_x] = color_id | obj_palette;
 			}
 		}
 	}
+
+	//Straight into the frame the renderer gets next
+	uint8_t* pixels = emuScreenTexBuffer->back();
+	if (indexed_output) {
+		compositor.index_line(line, bg_palette, obj_palette0, obj_palette1, &pixels[ly * 160]);
+	}
+	else {
+		compositor.expand_line(line, bg_palette, obj_palette0, obj_palette1, &pixels[ly * 160 * 4]);
+	}
 }
 
 void PPU::render_frame() {
@@ -474,20 +636,24 @@ void PPU::render_frame() {
 		SDL_Rect pixel = SDL_Rect();
 		pixel.w = WINDOW_SCALE_FACTOR;
 		pixel.h = WINDOW_SCALE_FACTOR;
-		for (int i = 0; i < 160 * 144 * 4; i += 4) {
-			pixel.x = (i / 4) % 160 * WINDOW_SCALE_FACTOR;
-			pixel.y = (i / 4) / 160 * WINDOW_SCALE_FACTOR;
-			SDL_SetRenderDrawColor(renderer, pixels[i], pixels[i + 1], pixels[i + 2], pixels[i + 3]);
+		const uint8_t* pixels = emuScreenTexBuffer->back();
+		for (int i = 0; i < 160 * 144; i++) {
+			pixel.x = i % 160 * WINDOW_SCALE_FACTOR;
+			pixel.y = i / 160 * WINDOW_SCALE_FACTOR;
+			if (indexed_output) {
+				const uint8_t* color = SHADE_COLORS[pixels[i] & 0b11];
+				SDL_SetRenderDrawColor(renderer, color[0], color[1], color[2], 255);
+			}
+			else {
+				SDL_SetRenderDrawColor(renderer, pixels[i * 4], pixels[i * 4 + 1], pixels[i * 4 + 2], pixels[i * 4 + 3]);
+			}
 			SDL_RenderFillRect(renderer, &pixel);
 		}
 		SDL_PumpEvents();
 		SDL_RenderPresent(renderer);
 		SDL_RenderClear(renderer);
 	}
-	else {
-		std::lock_guard<std::mutex> lock(emuScreenTexBuffer->mutex);
-		emuScreenTexBuffer->pixels = pixels;
-		emuScreenTexBuffer->dirty = true;
-	}
+	//Hand the finished frame over and start the next one in another buffer
+	emuScreenTexBuffer->publish();
 	frame_done = true;
 }
\ No newline at end of file
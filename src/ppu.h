@@ -2,6 +2,7 @@
 #include "common.h"
 #include <SDL.h>
 #include "TextureBuffer.h"
+#include "compositor.h"
 
 class GB;
 
@@ -11,6 +12,9 @@ const int DOTS_PER_HBLANK = 204;
 const int DOTS_PER_VBLANK = 4560;
 const int WINDOW_SCALE_FACTOR = 5;
 
+//Tiles in the 3 blocks of tile data at 8000-97FF
+const int TILE_COUNT = 384;
+
 class PPU {
 public:
 	friend class MMU;
@@ -39,8 +43,21 @@ public:
 		Draw
 	};
 
-	//Execute one cycle;
-	void tick();
+	//A scheduled PPU event is due at T-cycle time
+	void handle_event(uint64_t time);
+
+	//Schedule the next dot that could request an interrupt or finish a frame
+	void schedule_next_event();
+
+	//Catch the PPU up to the current T-cycle. Must be called before the CPU reads or writes anything the PPU owns
+	void sync();
+
+	//T-cycle of the next mode or line change, LY, STAT, VRAM and OAM reads give the same values until then.
+	// NEVER while the LCD is off
+	uint64_t next_change_time();
+
+	//T-cycle LY next changes, NEVER while the LCD is off
+	uint64_t next_line_time();
 private:
 	//Pointer to GB object to call interrupts
 	GB* gb;
@@ -48,8 +65,26 @@ private:
 	PPUMode current_mode;
 	//How many dots have passed this current PPU mode
 	int dot_count;
-	//Raw pixel buffer. Each pixel is 4 bytes RGBA
-	std::vector<uint8_t> pixels;
+	//T-cycle of the last dot the PPU has executed
+	uint64_t last_dot;
+
+	//Execute one dot
+	void tick();
+	//Execute every dot up to and including T-cycle time. Only dots where the mode or line changes do any work,
+	// the dots in between just increment dot_count
+	void sync(uint64_t time);
+	//Account for dots up to T-cycle time that do not change the mode or line
+	void catch_up(uint64_t time);
+	//Dots from a mode at dot_count dots until its next mode change or line change
+	static int dots_until_mode_change(PPUMode mode, int dots);
+	//Look ahead for the next dot where a mode or line change can request an interrupt or finish a frame.
+	// Changes in between are only executed when the CPU accesses the PPU or the next event runs
+	uint64_t next_event_dot();
+	//Run the next dot as an event so the effect of a register write is seen on the same dot it would be when ticking every dot
+	void schedule_after_write();
+	//Lines are drawn into emuScreenTexBuffer's back buffer. Each pixel is 4 bytes RGBA, or 1 byte
+	// PixelFormat::Indexed8 when indexed_output is set and the renderer applies the palettes instead of the PPU
+	bool indexed_output;
 	SDL_Renderer* renderer;
 
 	void lcd_status_write_bit(uint8_t bit_index, bool bit);
@@ -83,10 +118,33 @@ private:
 	uint8_t VRAM[8 * 1024];
 	uint8_t OAM[160];
 
+	//Tile data decoded to one color id per byte, rows of 8 pixels left to right. tile_cache_flipped has the same rows
+	// mirrored for X flipped objects. write_VRAM marks a tile dirty in tile_dirty and it is decoded again on its next use
+	uint8_t tile_cache[TILE_COUNT][8][8];
+	uint8_t tile_cache_flipped[TILE_COUNT][8][8];
+	uint64_t tile_dirty[TILE_COUNT / 64];
+
+	//Decoded row of a tile, decoding the tile first if it is dirty
+	const uint8_t* tile_row(uint16_t tile_index, int row, bool xflip);
+	void decode_tile(uint16_t tile_index);
+
+	//OAM indices of the objects drawn on each line, the first 10 in OAM order whose rows cover the line, sorted highest
+	// priority first: lower X, then lower OAM index. Writes to an object's Y or X and DMA set objects_dirty, and the
+	// lines are selected again before the next line is drawn
+	uint8_t line_objects[144][10];
+	uint8_t line_object_count[144];
+	bool objects_dirty;
+	//Object height in LCDC when the lines were selected, changing it also needs them selected again
+	int objects_height;
+	void select_objects(int obj_height);
+
+	//Turns each composed line into RGBA or indexed pixels
+	Compositor compositor;
+
 	void init_SDL();
-	void set_pixel_color(int id, uint8_t palette, int x, int y);
 	bool stat_line;
 	void check_stat();
+	//Compose the line as palette indices, background first and then the line's objects over it, and expand it into pixels
 	void draw_line();
 	void render_frame();
 };
\ No newline at end of file
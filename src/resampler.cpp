@@ -0,0 +1,184 @@
+#include "resampler.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define RESAMPLER_SSE 1
+#include <xmmintrin.h>
+#else
+#define RESAMPLER_SSE 0
+#endif
+
+//Passband as a fraction of the lower of the two Nyquist frequencies, the rest is the window's transition band
+static const double CUTOFF = 0.9;
+
+//Zero crossings of the sinc on each side of its center, more gives a sharper cutoff for more taps
+static const int ZERO_CROSSINGS = 8;
+
+static int16_t to_sample(float value) {
+	return (int16_t)std::clamp(value, -32768.0f, 32767.0f);
+}
+
+Resampler::Resampler() {
+	mode = Mode::Sinc;
+	in_rate = 1;
+	out_rate = 1;
+	base_step = 1;
+	step = 1;
+	build_filter();
+}
+
+void Resampler::set_mode(Mode in_mode) {
+	mode = in_mode;
+	build_filter();
+}
+
+void Resampler::set_rates(int in_in_rate, int in_out_rate) {
+	in_rate = in_in_rate;
+	out_rate = in_out_rate;
+	base_step = (double)in_rate / out_rate;
+	step = base_step;
+	build_filter();
+}
+
+void Resampler::set_rate_adjust(double adjust) {
+	//More output frames per second means a smaller step through the input
+	step = base_step / adjust;
+}
+
+void Resampler::build_filter() {
+	filter.clear();
+	switch (mode) {
+	case Mode::Linear:
+		taps = 2;
+		break;
+	case Mode::Cubic:
+		taps = 4;
+		break;
+	case Mode::Sinc: {
+		//Cutoff in cycles per input frame
+		double cutoff = 0.5 * CUTOFF * std::min(1.0, 1.0 / base_step);
+		taps = ((int)std::ceil(ZERO_CROSSINGS / cutoff) + 3) & ~3;
+
+		//Blackman windowed sinc for each phase, the output frame is phase / PHASES after tap taps / 2 - 1.
+		// Each phase is normalized to sum to 1 so DC passes through unchanged
+		const double PI = 3.14159265358979323846;
+		filter.resize((size_t)PHASES * taps);
+		for (int phase = 0; phase < PHASES; phase++) {
+			float* coefficients = &filter[(size_t)phase * taps];
+			double center = taps / 2 - 1 + (double)phase / PHASES;
+			double sum = 0;
+			for (int i = 0; i < taps; i++) {
+				double x = i - center;
+				double sinc = x == 0 ? 1 : std::sin(2 * PI * cutoff * x) / (2 * PI * cutoff * x);
+				double w = x / taps;
+				double window = std::fabs(w) > 0.5 ? 0 : 0.42 + 0.5 * std::cos(2 * PI * w) + 0.08 * std::cos(4 * PI * w);
+				coefficients[i] = (float)(sinc * window);
+				sum += coefficients[i];
+			}
+			for (int i = 0; i < taps; i++) {
+				coefficients[i] = (float)(coefficients[i] / sum);
+			}
+		}
+		break;
+	}
+	}
+
+	//Start from silence, the first output frame waits until the input fills its taps
+	history_left.assign(taps, 0.0f);
+	history_right.assign(taps, 0.0f);
+	position = 0;
+}
+
+void Resampler::process(const int16_t* in, size_t frames, std::vector<int16_t>& out) {
+	out.clear();
+
+	size_t old_size = history_left.size();
+	history_left.resize(old_size + frames);
+	history_right.resize(old_size + frames);
+	for (size_t i = 0; i < frames; i++) {
+		history_left[old_size + i] = in[i * 2];
+		history_right[old_size + i] = in[i * 2 + 1];
+	}
+
+	size_t size = history_left.size();
+	out.reserve((size_t)(frames / step + 2) * 2);
+	while ((size_t)position + taps <= size) {
+		size_t index = (size_t)position;
+		double frac = position - index;
+		int16_t frame[2];
+		switch (mode) {
+		case Mode::Sinc:
+			sinc_frame(index, frac, frame);
+			break;
+		case Mode::Cubic:
+			cubic_frame(index, frac, frame);
+			break;
+		case Mode::Linear:
+			linear_frame(index, frac, frame);
+			break;
+		}
+		out.push_back(frame[0]);
+		out.push_back(frame[1]);
+		position += step;
+	}
+
+	//Drop the frames every later output frame is past
+	size_t used = std::min((size_t)position, size);
+	history_left.erase(history_left.begin(), history_left.begin() + used);
+	history_right.erase(history_right.begin(), history_right.begin() + used);
+	position -= used;
+}
+
+void Resampler::sinc_frame(size_t index, double frac, int16_t* out) {
+	const float* coefficients = &filter[(size_t)(frac * PHASES) * taps];
+	const float* left = &history_left[index];
+	const float* right = &history_right[index];
+
+#if RESAMPLER_SSE
+	__m128 left_sum = _mm_setzero_ps();
+	__m128 right_sum = _mm_setzero_ps();
+	for (int i = 0; i < taps; i += 4) {
+		__m128 c = _mm_loadu_ps(coefficients + i);
+		left_sum = _mm_add_ps(left_sum, _mm_mul_ps(c, _mm_loadu_ps(left + i)));
+		right_sum = _mm_add_ps(right_sum, _mm_mul_ps(c, _mm_loadu_ps(right + i)));
+	}
+	//Horizontal sums, left in lane 0 and right in lane 1
+	__m128 low = _mm_unpacklo_ps(left_sum, right_sum);
+	__m128 high = _mm_unpackhi_ps(left_sum, right_sum);
+	__m128 sums = _mm_add_ps(low, high);
+	sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+	float result[4];
+	_mm_storeu_ps(result, sums);
+	out[0] = to_sample(result[0]);
+	out[1] = to_sample(result[1]);
+#else
+	float left_sum = 0;
+	float right_sum = 0;
+	for (int i = 0; i < taps; i++) {
+		left_sum += coefficients[i] * left[i];
+		right_sum += coefficients[i] * right[i];
+	}
+	out[0] = to_sample(left_sum);
+	out[1] = to_sample(right_sum);
+#endif
+}
+
+void Resampler::cubic_frame(size_t index, double frac, int16_t* out) {
+	//Catmull-Rom spline through 4 frames, the output frame is between the middle two
+	float t = (float)frac;
+	const std::vector<float>* channels[2] = { &history_left, &history_right };
+	for (int i = 0; i < 2; i++) {
+		const float* p = &(*channels[i])[index];
+		float a = -0.5f * p[0] + 1.5f * p[1] - 1.5f * p[2] + 0.5f * p[3];
+		float b = p[0] - 2.5f * p[1] + 2.0f * p[2] - 0.5f * p[3];
+		float c = -0.5f * p[0] + 0.5f * p[2];
+		out[i] = to_sample(((a * t + b) * t + c) * t + p[1]);
+	}
+}
+
+void Resampler::linear_frame(size_t index, double frac, int16_t* out) {
+	float t = (float)frac;
+	out[0] = to_sample(history_left[index] + (history_left[index + 1] - history_left[index]) * t);
+	out[1] = to_sample(history_right[index] + (history_right[index + 1] - history_right[index]) * t);
+}
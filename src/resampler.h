@@ -0,0 +1,68 @@
+#pragma once
+#include "common.h"
+#include <vector>
+
+//Converts interleaved stereo int16 frames from the APU's rate to the audio device's rate.
+//Sinc mode is a polyphase windowed sinc filter with its cutoff below the output's Nyquist frequency, so nothing
+// above it folds back down as aliasing. Its dot products use SSE where available. Cubic and linear modes only
+// interpolate between neighbouring input frames, they are much cheaper but alias when downsampling.
+//The ratio can be nudged between calls for audio sync, the position between input frames carries over so
+// consecutive calls give one continuous stream.
+class Resampler {
+public:
+	enum class Mode {
+		Sinc,
+		Cubic,
+		Linear
+	};
+
+	Resampler();
+
+	//Pick the mode and rebuild the filter, restarting the stream from silence
+	void set_mode(Mode in_mode);
+
+	void set_rates(int in_rate, int out_rate);
+
+	//Scale the output rate by adjust, from AudioOutput::rate_control(). The filter stays designed for the base ratio,
+	// its cutoff has enough margin for the small changes rate control makes
+	void set_rate_adjust(double adjust);
+
+	//Resample frames stereo frames from in, replacing the contents of out
+	void process(const int16_t* in, size_t frames, std::vector<int16_t>& out);
+
+	Mode get_mode() { return mode; }
+
+private:
+	//Sinc filter positions between two input frames, the position of each output frame is rounded down to one
+	static const int PHASES = 256;
+
+	Mode mode;
+
+	int in_rate;
+	int out_rate;
+
+	//Input frames per output frame before and after the adjustment
+	double base_step;
+	double step;
+
+	//Input frames each output frame is computed from, a multiple of 4 in sinc mode so the SSE loop has no tail
+	int taps;
+
+	//Sinc coefficients, taps per phase
+	std::vector<float> filter;
+
+	//Input frames not fully used yet, one array per channel so the filter reads them contiguously
+	std::vector<float> history_left;
+	std::vector<float> history_right;
+
+	//Position of the next output frame in the history, the integer part is its first tap
+	double position;
+
+	//Build the coefficients for the mode and base ratio, and restart the history with silence
+	void build_filter();
+
+	//One output frame from the taps frames starting at history index, frac is the position between them
+	void sinc_frame(size_t index, double frac, int16_t* out);
+	void cubic_frame(size_t index, double frac, int16_t* out);
+	void linear_frame(size_t index, double frac, int16_t* out);
+};
@@ -0,0 +1,47 @@
+#include "scheduler.h"
+
+Scheduler::Scheduler() {
+	for (int i = 0; i < (int)Event::COUNT; i++) {
+		times[i] = NEVER;
+	}
+	next_time = NEVER;
+}
+
+void Scheduler::schedule(Event event, uint64_t time) {
+	times[(int)event] = time;
+	update_next_time();
+}
+
+void Scheduler::cancel(Event event) {
+	times[(int)event] = NEVER;
+	update_next_time();
+}
+
+bool Scheduler::pop_due(uint64_t now, Event& event, uint64_t& time) {
+	if (next_time > now) {
+		return false;
+	}
+
+	//Lowest index wins ties so same cycle events run in Event order
+	int due = 0;
+	for (int i = 1; i < (int)Event::COUNT; i++) {
+		if (times[i] < times[due]) {
+			due = i;
+		}
+	}
+
+	event = (Event)due;
+	time = times[due];
+	times[due] = NEVER;
+	update_next_time();
+	return true;
+}
+
+void Scheduler::update_next_time() {
+	next_time = times[0];
+	for (int i = 1; i < (int)Event::COUNT; i++) {
+		if (times[i] < next_time) {
+			next_time = times[i];
+		}
+	}
+}
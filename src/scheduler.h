@@ -0,0 +1,48 @@
+#pragma once
+#include "common.h"
+
+//Things a component can ask to be woken up for at a specific T-cycle
+// When two events are due on the same T-cycle they run in this order
+enum class Event {
+	PPU,
+	TIMA,
+	COUNT
+};
+
+//T-cycle used for events that are not scheduled
+const uint64_t NEVER = UINT64_MAX;
+
+//Central event scheduler owned by GB.
+//Instead of every component being ticked each M-cycle, components schedule the T-cycle where they next have work to do
+// and the CPU only advances the cycle counter until that point.
+//There is at most one pending event per Event type. With only a handful of event types a linear scan is cheaper than a heap,
+// and the earliest time is cached so the per M-cycle "is anything due" check is a single compare.
+class Scheduler {
+public:
+	friend class JIT;
+
+	Scheduler();
+
+	//Schedule event to run at T-cycle time, replaces the pending event of the same type
+	void schedule(Event event, uint64_t time);
+
+	//Remove the pending event of this type
+	void cancel(Event event);
+
+	//T-cycle of the earliest pending event, NEVER if nothing is scheduled
+	uint64_t next_event_time() const { return next_time; }
+
+	//T-cycle the event is scheduled for, NEVER if it is not scheduled
+	uint64_t event_time(Event event) const { return times[(int)event]; }
+
+	//If an event is due at or before now, remove it and return it in event and time
+	bool pop_due(uint64_t now, Event& event, uint64_t& time);
+
+private:
+	uint64_t times[(int)Event::COUNT];
+
+	//Cached minimum of times
+	uint64_t next_time;
+
+	void update_next_time();
+};
@@ -3,50 +3,158 @@
 
 Timer::Timer(GB* in_gb) :
 	gb(in_gb) {
-	DIV = 0xAB;
 	TIMA = 0;
 	TMA = 0;
 	TAC = 0xF8;
-	div_cycle_counter = 0;
-	tima_cycle_counter = 0;
+	//DIV is 0xAB after the boot ROM
+	counter_offset = 0xABCC;
+	tima_time = 0;
+	reload_pending = false;
+	reload_time = 0;
 }
 
-void Timer::tick() {
-	div_cycle_counter++;
-	tima_cycle_counter++;
+uint64_t Timer::counter(uint64_t time) {
+	return time + counter_offset;
+}
+
+bool Timer::tima_signal(uint64_t time) {
+	return ((TAC >> 2) & 1) && ((counter(time) >> TIMA_COUNTER_BIT[TAC & 0b11]) & 1);
+}
 
-	if (div_cycle_counter == DIV_INC_RATE) {
-		DIV++;
-		div_cycle_counter = 0;
+void Timer::increment_TIMA(uint64_t time, int increments) {
+	if (TIMA + increments > 0xFF) {
+		TIMA = 0;
+		reload_pending = true;
+		reload_time = time + TIMA_RELOAD_DELAY;
+	}
+	else {
+		TIMA += increments;
+	}
+}
+
+void Timer::sync(uint64_t time) {
+	if (reload_pending && time >= reload_time) {
+		//The event normally handles this, only reachable while the scheduler has not caught up to the reload yet
+		handle_tima_event(reload_time);
+	}
+
+	if (time <= tima_time) {
+		return;
 	}
 
-	//If TIMA enabled
 	if ((TAC >> 2) & 1) {
-		int tima_inc_rate = 0;
-		switch (TAC & 0b11) {
-		case 0:
-			tima_inc_rate = 256;
-			break;
-		case 1:
-			tima_inc_rate = 4;
-			break;
-		case 2:
-			tima_inc_rate = 16;
-			break;
-		case 3:
-			tima_inc_rate = 64;
-			break;
+		//Falling edges of counter bit n happen each time the counter reaches a multiple of 2^(n+1)
+		int period_shift = TIMA_COUNTER_BIT[TAC & 0b11] + 1;
+		uint64_t edges = (counter(time) >> period_shift) - (counter(tima_time) >> period_shift);
+		//Overflows happen at scheduled events so at most the edges up to the next overflow are pending here
+		if (edges > 0) {
+			increment_TIMA(time, (int)edges);
+		}
+	}
+	tima_time = time;
+}
+
+void Timer::schedule_events() {
+	schedule_tima();
+}
+
+void Timer::schedule_tima() {
+	if (reload_pending) {
+		gb->scheduler.schedule(Event::TIMA, reload_time);
+		return;
+	}
+
+	//If TIMA disabled
+	if (((TAC >> 2) & 1) == 0) {
+		gb->scheduler.cancel(Event::TIMA);
+		return;
+	}
+
+	//T-cycle of the falling edge that takes TIMA from 0xFF to 0
+	int period_shift = TIMA_COUNTER_BIT[TAC & 0b11] + 1;
+	uint64_t edges_to_overflow = 0x100 - TIMA;
+	uint64_t overflow_counter = ((counter(tima_time) >> period_shift) + edges_to_overflow) << period_shift;
+	gb->scheduler.schedule(Event::TIMA, overflow_counter - counter_offset);
+}
+
+void Timer::handle_tima_event(uint64_t time) {
+	if (reload_pending) {
+		if (time < reload_time) {
+			return;
 		}
+		reload_pending = false;
+		TIMA = TMA;
+		tima_time = reload_time;
+		gb->int_timer();
+	}
+	else {
+		sync(time);
+	}
+	schedule_tima();
+}
+
+uint8_t Timer::DIV_read() {
+	return (counter(gb->get_t_cycle_count()) >> 8) & 0xFF;
+}
+
+uint8_t Timer::TIMA_read() {
+	sync(gb->get_t_cycle_count());
+	return TIMA;
+}
 
-		if (tima_cycle_counter > tima_inc_rate) {
-			TIMA++;
-			tima_cycle_counter = 0;
+uint64_t Timer::next_change_time(uint64_t time) {
+	//DIV steps every 256 T-cycles
+	uint64_t next = time + 256 - (counter(time) & 0xFF);
 
-			//If TIMA overflowed
-			if (TIMA == 0) {
-				TIMA = TMA;
-				gb->int_timer();
-			}
+	//TIMA steps when the selected counter bit falls, i.e. when the bits up to it wrap to 0
+	if ((TAC >> 2) & 1) {
+		uint64_t period = 2ULL << TIMA_COUNTER_BIT[TAC & 0b11];
+		uint64_t edge = time + period - (counter(time) & (period - 1));
+		if (edge < next) {
+			next = edge;
 		}
 	}
-}
\ No newline at end of file
+	return next;
+}
+
+void Timer::DIV_write() {
+	uint64_t now = gb->get_t_cycle_count();
+	sync(now);
+
+	//The APU's frame sequencer runs off the same counter
+	gb->apu.DIV_write(now);
+
+	//Resetting the counter is a falling edge if the selected bit was set
+	if (tima_signal(now)) {
+		increment_TIMA(now, 1);
+	}
+	counter_offset = 0 - now;
+	schedule_tima();
+}
+
+void Timer::TIMA_write(uint8_t byte) {
+	sync(gb->get_t_cycle_count());
+
+	//Writing during the reload delay cancels the reload and the interrupt
+	reload_pending = false;
+	TIMA = byte;
+	schedule_tima();
+}
+
+void Timer::TMA_write(uint8_t byte) {
+	sync(gb->get_t_cycle_count());
+	TMA = byte;
+}
+
+void Timer::TAC_write(uint8_t byte) {
+	uint64_t now = gb->get_t_cycle_count();
+	sync(now);
+
+	//On DMG disabling TIMA or switching to a clock bit that is low is a falling edge if the old bit was set
+	bool old_signal = tima_signal(now);
+	TAC = byte;
+	if (old_signal && !tima_signal(now)) {
+		increment_TIMA(now, 1);
+	}
+	schedule_tima();
+}
@@ -3,26 +3,69 @@
 
 class GB;
 
+//DIV and TIMA are not ticked. They are computed from the global T-cycle count when read, and the only scheduled
+// event is the next TIMA overflow.
+//DIV is the upper 8 bits of an internal 16 bit counter that increments every T-cycle. TIMA increments on the falling edge
+// of (TIMA enabled AND the counter bit selected by TAC), which is what makes DIV writes and TAC changes able to increment TIMA.
+//https://gbdev.io/pandocs/Timer_Obscure_Behaviour.html
 class Timer {
 public:
 	friend class MMU;
+	friend class APU;
 
 	Timer(GB* in_gb);
 
-	//Execute one cycle
-	void tick();
+	//Schedule the next TIMA overflow, called once the scheduler exists
+	void schedule_events();
+
+	//TIMA overflow or the reload after it is due at T-cycle time
+	void handle_tima_event(uint64_t time);
+
+	uint8_t DIV_read();
+	uint8_t TIMA_read();
+
+	//T-cycle after time where DIV or TIMA next increments
+	uint64_t next_change_time(uint64_t time);
+
+	void DIV_write();
+	void TIMA_write(uint8_t byte);
+	void TMA_write(uint8_t byte);
+	void TAC_write(uint8_t byte);
 private:
 	//Pointer to GB object to call interrupts
 	GB* gb;
 
-	//Div is incremented at 16384Hz which is once every 64 M cycles
-	const int DIV_INC_RATE = 64;
+	//Counter bit that clocks TIMA for each TAC clock select. 4096Hz, 262144Hz, 65536Hz, 16384Hz
+	const int TIMA_COUNTER_BIT[4] = { 9, 3, 5, 7 };
+
+	//TIMA reads 0 for 1 M-cycle after overflowing before TMA is loaded and the interrupt is requested
+	const int TIMA_RELOAD_DELAY = 4;
 
-	uint8_t DIV;
 	uint8_t TIMA;
 	uint8_t TMA;
 	uint8_t TAC;
 
-	int div_cycle_counter;
-	int tima_cycle_counter;
-};
\ No newline at end of file
+	//Internal counter at T-cycle t is t + counter_offset, DIV writes change the offset so the counter restarts at 0
+	uint64_t counter_offset;
+
+	//T-cycle TIMA was last brought up to date
+	uint64_t tima_time;
+
+	//TIMA overflowed and TMA is loaded at reload_time
+	bool reload_pending;
+	uint64_t reload_time;
+
+	uint64_t counter(uint64_t time);
+
+	//TIMA's clock signal, TIMA increments when this goes from true to false
+	bool tima_signal(uint64_t time);
+
+	//Add increments to TIMA at T-cycle time, starting the reload delay on overflow
+	void increment_TIMA(uint64_t time, int increments);
+
+	//Apply the falling edges between tima_time and time
+	void sync(uint64_t time);
+
+	//Schedule the reload or the next overflow, or cancel the event if TIMA is disabled
+	void schedule_tima();
+};